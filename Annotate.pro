@@ -38,6 +38,16 @@ DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs depr
 #QT += widgets
 QT += network
 
+# the video frames are decoded ahead in a background thread
+CONFIG += thread
+
+# the record text is written and parsed with std::to_chars / std::from_chars
+CONFIG += c++17
+
+# the contours kernel is written to be vectorized, which gcc only does at -O2 when asked to. The vectors are the ones of the
+# target baseline (SSE2 on x86-64, NEON on aarch64) : add -march=native for wider ones, the build being then tied to its CPU
+*-g++*: QMAKE_CXXFLAGS += -ftree-vectorize -fvect-cost-model=dynamic
+
 
 
 
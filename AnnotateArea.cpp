@@ -726,7 +726,7 @@ void AnnotateArea::mousePressEvent(QMouseEvent *event)
             {
                 // we're in edition mode - find which one : TL, T, TR, R..., L?
 
-                const cv::Rect2i& currBB = this->annotations->getRecord().getAnnotationById(selectedAnnot).BoundingBox;
+                const cv::Rect2i currBB = this->annotations->getRecord().getAnnotationById(selectedAnnot).BoundingBox;
 
                 int distToTop     = abs(currBB.tl().y -     actualInImgPos.y());
                 int distToLeft    = abs(currBB.tl().x -     actualInImgPos.x());
@@ -820,8 +820,8 @@ void AnnotateArea::mousePressEvent(QMouseEvent *event)
             {
                 // we're in edition mode - find which one : TL, T, TR, R..., L?
 
-                const cv::Point2i& currCentroid = this->annotations->getRecord().getAnnotationById(selectedAnnot).Centroid;
-                const cv::Point2i& currFront    = this->annotations->getRecord().getAnnotationById(selectedAnnot).Front;
+                const cv::Point2i currCentroid = this->annotations->getRecord().getAnnotationById(selectedAnnot).Centroid;
+                const cv::Point2i currFront    = this->annotations->getRecord().getAnnotationById(selectedAnnot).Front;
 
                 int distToCentroidY = abs(currCentroid.y - actualInImgPos.y());
                 int distToCentroidX = abs(currCentroid.x - actualInImgPos.x());
@@ -1255,19 +1255,21 @@ void AnnotateArea::drawBoundingBoxes(const QRect& ROI)
 
 
 
-    // now displaying the bounding boxes
-    const std::vector<int>& currFrameObjects = this->annotations->getObjectsListOnCurrentFrame();
+    // now displaying the bounding boxes - only the ones located around the painted area
+    const std::vector<int> currFrameObjects = this->annotations->getObjectsListOnCurrentFrame(QtCvUtils::qRectToCvRect2i(origImgRect));
 
     for (size_t k=0; k<currFrameObjects.size(); k++)
     {
-        if (this->annotations->getConfig().getProperty(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ClassId).classType == _ACT_CentroidFrontOnly)
+        const AnnotationObject currObj = this->annotations->getRecord().getAnnotationById(currFrameObjects[k]);
+
+        if (this->annotations->getConfig().getProperty(currObj.ClassId).classType == _ACT_CentroidFrontOnly)
             continue;
 
-        QRect currBB = QtCvUtils::cvRect2iToQRect(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).BoundingBox);
+        QRect currBB = QtCvUtils::cvRect2iToQRect(currObj.BoundingBox);
 
         if (origImgRect.intersects(currBB))
         {
-            int currClass = this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ClassId;
+            int currClass = currObj.ClassId;
 
             QColor rightColor = QtCvUtils::cvVec3bToQColor(this->annotations->getConfig().getProperty(currClass).displayRGBColor, 255);
             // setting the right color
@@ -1301,7 +1303,7 @@ void AnnotateArea::drawBoundingBoxes(const QRect& ROI)
                 QPoint textPos = this->adaptToScaleMul(currBB).topLeft();
                 textPos.setY(textPos.y() + 13);
 
-                textPath.addText(textPos, numberFont, QString::number(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ObjectId));
+                textPath.addText(textPos, numberFont, QString::number(currObj.ObjectId));
                 painter.setBrush(Qt::white);    // filling the characters with white
                 painter.drawPath(textPath);
                 painter.setBrush(Qt::transparent);  // don't forget to remove the filling
@@ -1310,7 +1312,7 @@ void AnnotateArea::drawBoundingBoxes(const QRect& ROI)
                 // we draw the text then
                 /*
                 painter.drawText(this->adaptToScaleMul(currBB),
-                                 QString::number(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ObjectId),
+                                 QString::number(currObj.ObjectId),
                                  Qt::AlignBottom | Qt::AlignRight);
                                  */
 
@@ -1378,21 +1380,23 @@ void AnnotateArea::drawArrows(const QRect& ROI)
 
 
 
-    // now displaying the bounding boxes
-    const std::vector<int>& currFrameObjects = this->annotations->getObjectsListOnCurrentFrame();
+    // now displaying the arrows - only the ones located around the painted area
+    const std::vector<int> currFrameObjects = this->annotations->getObjectsListOnCurrentFrame(QtCvUtils::qRectToCvRect2i(origImgRect));
 
     for (size_t k=0; k<currFrameObjects.size(); k++)
     {
-        if (this->annotations->getConfig().getProperty(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ClassId).classType != _ACT_CentroidFrontOnly)
+        const AnnotationObject currObj = this->annotations->getRecord().getAnnotationById(currFrameObjects[k]);
+
+        if (this->annotations->getConfig().getProperty(currObj.ClassId).classType != _ACT_CentroidFrontOnly)
             continue;
 
-        QRect currBB = QtCvUtils::cvRect2iToQRect(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).BoundingBox);
-        QPoint currCenter(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).Centroid.x, this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).Centroid.y);
-        QPoint currArrowHead(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).Front.x, this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).Front.y);
+        QRect currBB = QtCvUtils::cvRect2iToQRect(currObj.BoundingBox);
+        QPoint currCenter(currObj.Centroid.x, currObj.Centroid.y);
+        QPoint currArrowHead(currObj.Front.x, currObj.Front.y);
 
         if (origImgRect.intersects(currBB))
         {
-            int currClass = this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ClassId;
+            int currClass = currObj.ClassId;
 
             QColor rightColor = QtCvUtils::cvVec3bToQColor(this->annotations->getConfig().getProperty(currClass).displayRGBColor, 255);
             // setting the right color
@@ -1442,7 +1446,7 @@ void AnnotateArea::drawArrows(const QRect& ROI)
                 QPoint textPos = this->adaptToScaleMul(currCenter);
                 textPos.setY(textPos.y() + 13);
 
-                textPath.addText(textPos, numberFont, QString::number(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ObjectId));
+                textPath.addText(textPos, numberFont, QString::number(currObj.ObjectId));
                 painter.setBrush(Qt::white);    // filling the characters with white
                 painter.drawPath(textPath);
                 painter.setBrush(Qt::transparent);  // don't forget to remove the filling
@@ -1451,7 +1455,7 @@ void AnnotateArea::drawArrows(const QRect& ROI)
                 // we draw the text then
                 /*
                 painter.drawText(this->adaptToScaleMul(currBB),
-                                 QString::number(this->annotations->getRecord().getAnnotationById(currFrameObjects[k]).ObjectId),
+                                 QString::number(currObj.ObjectId),
                                  Qt::AlignBottom | Qt::AlignRight);
                                  */
 
@@ -1555,7 +1559,7 @@ void AnnotateArea::updatePaintImages(const QRect& ROI, bool contoursOnly)
         // this->SPContoursImage.fill(_AA_CI_NoC);
 
         // perhaps it's enough already? use the annotations index to know if we need to go any further
-        const std::vector<int>& currentFrameAnnots = this->annotations->getRecord().getFrameContentIds(this->annotations->getCurrentFramePosition());
+        AnnotationIdsRange currentFrameAnnots = this->annotations->getRecord().getFrameContentIds(this->annotations->getCurrentFramePosition());
 
         // answer : no, we have some annotations to look at
         if (currentFrameAnnots.size()>0)
@@ -1598,6 +1602,19 @@ void AnnotateArea::updatePaintImages(const QRect& ROI, bool contoursOnly)
         selectedObjId = this->annotations->getRecord().getAnnotationById(this->selectedObjectId).ObjectId;
     }
 
+    // the selected object is recognized with a single comparison when the packed labels are available
+    // (the labels are never negative, -1 doesn't match anything)
+    const cv::Mat& currLabels = this->annotations->getCurrentAnnotationsLabels();
+    bool usePackedLabels = this->annotations->hasPackedLabels() && currLabels.data;
+    int32_t selectedObjLabel = (this->selectedObjectId != -1) ? AnnotationsSet::packLabel(selectedObjClass, selectedObjId) : -1;
+
+    // the classes and ids planes would have to be derived from the packed labels : they're only read without them
+    const cv::Mat* currClasses = usePackedLabels ? NULL : &this->annotations->getCurrentAnnotationsClasses();
+    const cv::Mat* currIds = usePackedLabels ? NULL : &this->annotations->getCurrentAnnotationsIds();
+
+    // only the contours tiles that are about to be painted are computed
+    const cv::Mat& currContours = this->annotations->getCurrentContours(QtCvUtils::qRectToCvRect2i(localROI));
+
 
     // now run through the ROI of the image and fill the pixels
     // for some reason, Qt's BR corner is inclusive - it means that unlike the rest of the whole framework, we need <= comparisons
@@ -1605,22 +1622,24 @@ void AnnotateArea::updatePaintImages(const QRect& ROI, bool contoursOnly)
     {
         for (int j=localROI.left(); j<=localROI.right(); j++)
         {
+            int pixelClass = usePackedLabels ? AnnotationsSet::unpackLabelClass(currLabels.at<int32_t>(i,j)) : currClasses->at<int16_t>(i,j);
+
             if (!contoursOnly)
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
-                this->PaintingImage.setPixelColor(j,i, classesColorList[this->annotations->getCurrentAnnotationsClasses().at<int16_t>(i,j)]);
+                this->PaintingImage.setPixelColor(j,i, classesColorList[pixelClass]);
 #else
             {
-                QColor col = classesColorList[this->annotations->getCurrentAnnotationsClasses().at<int16_t>(i,j)];
+                QColor col = classesColorList[pixelClass];
                 this->PaintingImage.setPixel(j,i,col.rgba());
             }
 #endif
 
             unsigned int currContourColor = _AA_CI_NoC;
-            if (this->annotations->getCurrentContours().at<uchar>(i,j) > 0)
+            if (currContours.at<uchar>(i,j) > 0)
             {
                 // try to know if the object was selected or not
-                if ( (this->annotations->getCurrentAnnotationsClasses().at<int16_t>(i,j)==selectedObjClass) &&
-                     (this->annotations->getCurrentAnnotationsIds().at<int32_t>(i,j)==selectedObjId) )
+                if ( usePackedLabels ? (currLabels.at<int32_t>(i,j)==selectedObjLabel)
+                                     : ( (pixelClass==selectedObjClass) && (currIds->at<int32_t>(i,j)==selectedObjId) ) )
                     currContourColor = _AA_CI_SelC;
                 else
                     currContourColor = _AA_CI_NotSelC;
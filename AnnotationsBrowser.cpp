@@ -235,7 +235,7 @@ void AnnotationsBrowser::updateBrowser(int selected)
         startingFrame = this->annots->getRecord().getAnnotationById(selected).FrameNumber;
 
         // we store locally the frame record content pointer for more convenience
-        const std::vector<int>& frameRecordContent = this->annots->getRecord().getFrameContentIds(startingFrame);
+        AnnotationIdsRange frameRecordContent = this->annots->getRecord().getFrameContentIds(startingFrame);
 
         // the selected object is not the first from the frame, we can start the source within this frame
         if (frameRecordContent.size()>0 && frameRecordContent[0] != selected)
@@ -289,7 +289,8 @@ void AnnotationsBrowser::updateBrowser(int selected)
 
 
     QRect filteredArea;
-    if ((this->currentAnnotSelected==-1) || (this->filterObjectAreaCheckBox->checkState()==Qt::Unchecked))
+    bool filterByArea = (this->currentAnnotSelected!=-1) && (this->filterObjectAreaCheckBox->checkState()==Qt::Checked);
+    if (!filterByArea)
     {
         filteredArea = QtCvUtils::cvRect2iToQRect(cv::Rect2i(cv::Point2i(0,0), this->annots->getCurrentOriginalImg().size()));
     }
@@ -301,11 +302,40 @@ void AnnotationsBrowser::updateBrowser(int selected)
     }
 
 
-    for (int iFrame=iFrameStartPoint; iFrame<iFrameEndPoint; iFrame++)
+    // when filtering by object id, we only run through the frames of the selected object track (which is sorted by frame)
+    bool filterByObject = (this->currentAnnotSelected!=-1) && (this->filterObjectCheckBox->checkState()==Qt::Checked);
+    AnnotationIdsRange selectedTrack;
+    if (filterByObject)
     {
+        const AnnotationObject selectedObj = this->annots->getRecord().getAnnotationById(this->currentAnnotSelected);
+        selectedTrack = this->annots->getRecord().getTrackBetween(selectedObj.ClassId, selectedObj.ObjectId, iFrameStartPoint, iFrameEndPoint-1);
+    }
+
+    int framesNumber = filterByObject ? (int)selectedTrack.size() : (iFrameEndPoint-iFrameStartPoint);
+
+
+    for (int kFrame=0; kFrame<framesNumber; kFrame++)
+    {
+        int iFrame = filterByObject ? this->annots->getRecord().getFrameNumbersColumn()[selectedTrack[kFrame]] : (iFrameStartPoint+kFrame);
+
+        AnnotationIdsRange frameContent = this->annots->getRecord().getFrameContentIds(iFrame);
+
+        // when filtering by area, we only run through the objects located there by the record spatial index
+        // the frame content is sorted, which allows us to retrieve their position within the frame
+        std::vector<int> frameCandidates;
+        if (filterByObject)
+            frameCandidates.push_back(selectedTrack[kFrame]);
+        else if (filterByArea)
+            frameCandidates = this->annots->getRecord().getFrameContentIdsWithin(iFrame, QtCvUtils::qRectToCvRect2i(filteredArea));
+
+        bool useCandidates = filterByObject || filterByArea;
+        int candidatesNumber = useCandidates ? (int)frameCandidates.size() : (int)frameContent.size();
+
         // objects loop
-        for (int jAnnotId=0; jAnnotId<(int)this->annots->getRecord().getFrameContentIds(iFrame).size(); jAnnotId++)
+        for (int kCandidate=0; kCandidate<candidatesNumber; kCandidate++)
         {
+            int jAnnotId = useCandidates ? (int)(std::lower_bound(frameContent.begin(), frameContent.end(), frameCandidates[kCandidate]) - frameContent.begin()) : kCandidate;
+
             QString sourceTag = "";
 
             // even if the element is not inside the selection, keep the source tag so that the display isn't too annoying
@@ -313,7 +343,7 @@ void AnnotationsBrowser::updateBrowser(int selected)
                 sourceTag += "<a name='source'></a>";
 
 
-            int currAnnotId = this->annots->getRecord().getFrameContentIds(iFrame)[jAnnotId];
+            int currAnnotId = frameContent[jAnnotId];
 
             // store the object informations
             const AnnotationObject& currObj = this->annots->getRecord().getAnnotationById(currAnnotId);
@@ -322,14 +352,10 @@ void AnnotationsBrowser::updateBrowser(int selected)
             if (this->filterClassCheckBox->checkState() == Qt::Checked && currObj.ClassId != this->currentClassSelected)
                 continue;
 
-            // filter out the object id
-            if ((this->filterObjectCheckBox->checkState() == Qt::Checked) && (this->currentAnnotSelected!=-1)
-                    && ( (currObj.ClassId!=this->annots->getRecord().getAnnotationById(this->currentAnnotSelected).ClassId)
-                       ||(currObj.ObjectId!=this->annots->getRecord().getAnnotationById(this->currentAnnotSelected).ObjectId) ))
-                continue;
+            // (the object id filter is already handled by the selected track)
 
             // reject an object contained into an irrelevant area
-            if ((this->filterObjectCheckBox->checkState() == Qt::Checked) && (!QtCvUtils::cvRect2iToQRect(currObj.BoundingBox).intersects(filteredArea)))
+            if (filterByArea && (!QtCvUtils::cvRect2iToQRect(currObj.BoundingBox).intersects(filteredArea)))
                 continue;
 
 
@@ -67,6 +67,7 @@ AnnotationsConfig::AnnotationsConfig(const AnnotationsConfig& ac)
     this->imageFileNamingRule = ac.getImageFileNamingRule();
     this->summaryFileNamingRule = ac.getSummaryFileNamingRule();
     this->csvFileNamingRule = ac.getCsvFileNamingRule();
+    this->labelsFileNamingRule = ac.getLabelsFileNamingRule();
 }
 
 
@@ -96,6 +97,9 @@ void AnnotationsConfig::setDefaultConfig()
     this->imageFileNamingRule = _AnnotationsConfig_FileNamingToken_OrigImgPath + "annotations/" + _AnnotationsConfig_FileNamingToken_OrigImgFileName + "_annotations/" + _AnnotationsConfig_FileNamingToken_FrameNumber + ".png";
     this->summaryFileNamingRule = _AnnotationsConfig_FileNamingToken_OrigImgPath + "annotations/" + _AnnotationsConfig_FileNamingToken_OrigImgFileName + "_annotations.yaml";
     this->csvFileNamingRule = _AnnotationsConfig_FileNamingToken_OrigImgPath + "annotations/" + _AnnotationsConfig_FileNamingToken_OrigImgFileName + "_annotations.csv";
+
+    // the native labels files have to be asked for, e.g. with %OrImPa%annotations/%OrImFiNa%_annotations/%FrNu%.labels
+    this->labelsFileNamingRule = "";
 }
 
 
@@ -103,7 +107,23 @@ void AnnotationsConfig::setDefaultConfig()
 
 string AnnotationsConfig::getAnnotatedImageFileName(const std::string& origImgPath, const std::string& origImgFileName, int frameNumber) const
 {
-    string ret = this->imageFileNamingRule;
+    return applyFrameNamingRule(this->imageFileNamingRule, origImgPath, origImgFileName, frameNumber);
+}
+
+
+string AnnotationsConfig::getLabelsFileName(const std::string& origImgPath, const std::string& origImgFileName, int frameNumber) const
+{
+    // no rule means no labels file
+    if (!this->useLabelsFiles())
+        return "";
+
+    return applyFrameNamingRule(this->labelsFileNamingRule, origImgPath, origImgFileName, frameNumber);
+}
+
+
+string AnnotationsConfig::applyFrameNamingRule(const std::string& rule, const std::string& origImgPath, const std::string& origImgFileName, int frameNumber)
+{
+    string ret = rule;
     AnnotationUtilities::strReplace(ret, _AnnotationsConfig_FileNamingToken_OrigImgPath, origImgPath);
     AnnotationUtilities::strReplace(ret, _AnnotationsConfig_FileNamingToken_OrigImgFileName, origImgFileName);
 
@@ -145,6 +165,8 @@ void AnnotationsConfig::writeContentToYaml(cv::FileStorage& fs) const
     fs << _AnnotsConfig_YAMLKey_ImageFileNamingRule << this->imageFileNamingRule;
     fs << _AnnotsConfig_YAMLKey_SummaryFileNamingRule << this->summaryFileNamingRule;
     fs << _AnnotsConfig_YAMLKey_CsvFileNamingRule << this->csvFileNamingRule;
+    if (this->useLabelsFiles())
+        fs << _AnnotsConfig_YAMLKey_LabelsFileNamingRule << this->labelsFileNamingRule;
 
     fs << _AnnotsConfig_YAMLKey_ClassesDefs_Node << "[";
     for (size_t k=0; k<this->propsSet.size(); k++)
@@ -170,6 +192,9 @@ void AnnotationsConfig::readContentFromYaml(const cv::FileNode& fnd)
     currNode[_AnnotsConfig_YAMLKey_SummaryFileNamingRule] >> this->summaryFileNamingRule;
     if (!currNode[_AnnotsConfig_YAMLKey_CsvFileNamingRule].empty())
         currNode[_AnnotsConfig_YAMLKey_CsvFileNamingRule] >> this->csvFileNamingRule;
+    this->labelsFileNamingRule = "";
+    if (!currNode[_AnnotsConfig_YAMLKey_LabelsFileNamingRule].empty())
+        currNode[_AnnotsConfig_YAMLKey_LabelsFileNamingRule] >> this->labelsFileNamingRule;
 
     // now reading the properties
     this->propsSet.clear();
@@ -197,663 +222,2663 @@ void AnnotationsConfig::readContentFromYaml(const cv::FileNode& fnd)
 
 
 
-AnnotationsRecord::AnnotationsRecord()
+AnnotationIdsRange AnnotationsFlatIndex::getRow(int key) const
 {
-    // nothing to be done there, all of the vectors will be created without any help
-}
+    if (key<0 || key>=this->rowsNumber)
+        return AnnotationIdsRange();
 
-AnnotationsRecord::~AnnotationsRecord()
-{
-    // same as for the constructor
+    // has this key been edited since the last rebuild?
+    if (!this->editedRows.empty())
+    {
+        unordered_map<int, vector<int> >::const_iterator it = this->editedRows.find(key);
+        if (it != this->editedRows.end())
+            return AnnotationIdsRange(it->second.data(), it->second.data()+it->second.size());
+    }
+
+    // keys beyond the flat part have been created after the last rebuild, and they haven't been edited : they're empty
+    if (key+1 >= (int)this->offsets.size())
+        return AnnotationIdsRange();
+
+    return AnnotationIdsRange(this->ids.data()+this->offsets[key], this->ids.data()+this->offsets[key+1]);
 }
 
-const std::vector<AnnotationObject>& AnnotationsRecord::getRecord() const
+
+vector<int>& AnnotationsFlatIndex::accessEditedRow(int key)
 {
-    // access the entire record
-    return this->record;
+    unordered_map<int, vector<int> >::iterator it = this->editedRows.find(key);
+    if (it != this->editedRows.end())
+        return it->second;
+
+    // first edition of this key since the last rebuild : copy its content into the overflow table
+    AnnotationIdsRange currContent = this->getRow(key);
+    return (this->editedRows[key] = currContent.toVector());
 }
 
-const vector<int>& AnnotationsRecord::getAnnotationIds(int classId, int objectId) const
-{
-    // retrieve the index of an object
 
-    // generate an empty vector, that will be returned when no data corresponds to the request
-    static vector<int> emptyVec;
+void AnnotationsFlatIndex::append(int key, int id)
+{
+    if (key<0)
+        return;
 
-    // don't forget that the classId index starts from 1...
-    if (classId<1 || classId>(int)this->objectsIndex.size())
-        return emptyVec;
+    // the overflow table is merged before adding some more stuff - this way the reference that we access stays valid
+    if ((int)this->editedRows.size() > QtCvUtils::getMax(_AnnotsFlatIndex_default_minEditedRowsBeforeRebuild, this->rowsNumber/16))
+        this->rebuild();
 
-    if (objectId<0 || objectId>=(int)this->objectsIndex[classId-1].size())
-        return emptyVec;
+    if (key >= this->rowsNumber)
+        this->rowsNumber = key+1;
 
-    return this->objectsIndex[classId-1][objectId];
+    this->accessEditedRow(key).push_back(id);
 }
 
-const std::vector<int>& AnnotationsRecord::getFrameContentIds(int id) const
+
+void AnnotationsFlatIndex::insertSorted(int key, int id, const std::vector<int>& sortingValues)
 {
-    // get all the IDs inside a frame
+    if (key<0)
+        return;
 
-    // generate an empty vector, that will be returned when no data corresponds to the request
-    static vector<int> emptyVec;
+    // same as append, except for the position
+    if ((int)this->editedRows.size() > QtCvUtils::getMax(_AnnotsFlatIndex_default_minEditedRowsBeforeRebuild, this->rowsNumber/16))
+        this->rebuild();
 
-    if (id<0 || id>=(int)this->framesIndex.size())
-        return emptyVec;
+    if (key >= this->rowsNumber)
+        this->rowsNumber = key+1;
 
-    return this->framesIndex[id];
+    vector<int>& row = this->accessEditedRow(key);
+    row.insert(upper_bound(row.begin(), row.end(), id, [&sortingValues](int a, int b) -> bool {
+                   return (sortingValues[a] < sortingValues[b]) || ((sortingValues[a] == sortingValues[b]) && (a < b)); }), id);
 }
 
-const AnnotationObject& AnnotationsRecord::getAnnotationById(int id) const
+
+bool AnnotationsFlatIndex::erase(int key, int id)
 {
-    // retrieve a specific object by his ID
+    if (key<0 || key>=this->rowsNumber)
+        return false;
+
+    // don't copy anything if the id isn't there
+    AnnotationIdsRange currContent = this->getRow(key);
+    if (find(currContent.begin(), currContent.end(), id) == currContent.end())
+        return false;
 
-    // generate an empty object to be returned when no answer is possible
-    static AnnotationObject emptyAnnot; // its classId shall be 0 (by default), which should allow us to know whether there's data or not
+    if ((int)this->editedRows.size() > QtCvUtils::getMax(_AnnotsFlatIndex_default_minEditedRowsBeforeRebuild, this->rowsNumber/16))
+        this->rebuild();
 
-    if (id<0 || id>=(int)this->record.size())
-        return emptyAnnot;
+    vector<int>& row = this->accessEditedRow(key);
+    row.erase(find(row.begin(), row.end(), id));
 
-    return this->record[id];
+    return true;
 }
 
-int AnnotationsRecord::addNewAnnotation(const AnnotationObject& annot)
-{
-    // push a new annotation object, at the end of the main vector - returns the new annotation index... if it is not an update!!
 
-    // verify that this object is possible
-    if ((annot.ClassId<1) || (annot.ObjectId<0) || (annot.FrameNumber<0))
-        return -1;
+void AnnotationsFlatIndex::rebuild()
+{
+    // compute the new offsets, then copy every key content at once
+    vector<int> newOffsets(this->rowsNumber+1, 0);
+    for (int k=0; k<this->rowsNumber; k++)
+        newOffsets[k+1] = newOffsets[k] + (int)this->getRow(k).size();
 
-    // first, we must verify whether this is actually an update, or a brand new annotation
-    int searchRes = this->searchAnnotation(annot.FrameNumber, annot.ClassId, annot.ObjectId);
-    if (searchRes != -1)
+    vector<int> newIds(newOffsets[this->rowsNumber]);
+    for (int k=0; k<this->rowsNumber; k++)
     {
-        // this addition is actually an update, we update the bounding box using the | operator
-        this->updateBoundingBox(searchRes, (this->getAnnotationById(searchRes).BoundingBox | annot.BoundingBox) );
-
-        // that's it, we're done
-        return searchRes;
+        AnnotationIdsRange currContent = this->getRow(k);
+        copy(currContent.begin(), currContent.end(), newIds.begin()+newOffsets[k]);
     }
 
-    // otherwise... creation of a new annotation
-
+    this->offsets.swap(newOffsets);
+    this->ids.swap(newIds);
+    this->editedRows.clear();
+}
 
-    // storing the new record index
-    int newInd = this->record.size();
 
-    // recording the annotation
-    this->record.push_back(annot);
+void AnnotationsFlatIndex::assign(const std::vector<int>& keys, int minRowsNumber)
+{
+    this->editedRows.clear();
+
+    this->rowsNumber = minRowsNumber;
+    for (size_t id=0; id<keys.size(); id++)
+        if (keys[id] >= this->rowsNumber)
+            this->rowsNumber = keys[id]+1;
+
+    // counting sort : first count the number of ids per key...
+    this->offsets.assign(this->rowsNumber+1, 0);
+    for (size_t id=0; id<keys.size(); id++)
+        if (keys[id] >= 0)
+            this->offsets[keys[id]+1]++;
+
+    for (int k=0; k<this->rowsNumber; k++)
+        this->offsets[k+1] += this->offsets[k];
+
+    // ... then store them at the right place, in increasing order
+    this->ids.resize(this->offsets[this->rowsNumber]);
+    vector<int> fillPositions(this->offsets.begin(), this->offsets.end()-1);
+    for (size_t id=0; id<keys.size(); id++)
+        if (keys[id] >= 0)
+            this->ids[fillPositions[keys[id]]++] = (int)id;
+}
 
-    // filling the framesIndex matrix if needed with empty vectors
-    while((int)this->framesIndex.size()<=annot.FrameNumber)
-        this->framesIndex.push_back(vector<int>());
 
-    // recording the index into the frames record
-    this->framesIndex[annot.FrameNumber].push_back(newInd);
+void AnnotationsFlatIndex::sortRows(const std::vector<int>& sortingValues)
+{
+    // the overflow table is merged first, so that every key content lies within the flat vectors
+    this->rebuild();
 
-    // filling the class matrix with empty vectors if needed
-    while((int)this->objectsIndex.size()<annot.ClassId)
-        this->objectsIndex.push_back(vector< vector<int> >());
+    for (int k=0; k<this->rowsNumber; k++)
+        sort(this->ids.begin()+this->offsets[k], this->ids.begin()+this->offsets[k+1], [&sortingValues](int a, int b) -> bool {
+             return (sortingValues[a] < sortingValues[b]) || ((sortingValues[a] == sortingValues[b]) && (a < b)); });
+}
 
-    // now the corresponding objects index...
-    while((int)this->objectsIndex[annot.ClassId-1].size()<=annot.ObjectId)
-        this->objectsIndex[annot.ClassId-1].push_back(vector<int>());
 
-    // finally, storing the index into the objects record...
-    this->objectsIndex[annot.ClassId-1][annot.ObjectId].push_back(newInd);
+void AnnotationsFlatIndex::exportFlat(std::vector<int>& rowsOffsets, std::vector<int>& rowsIds)
+{
+    this->rebuild();
 
-    return newInd;
+    rowsOffsets = this->offsets;
+    rowsIds = this->ids;
+    if (rowsOffsets.empty())    // an empty index has no offsets at all
+        rowsOffsets.push_back(0);
 }
 
 
-
-int AnnotationsRecord::getFirstAvailableObjectId(int classId) const
+void AnnotationsFlatIndex::importFlat(std::vector<int>& rowsOffsets, std::vector<int>& rowsIds)
 {
-    // returns the first available object Id given a class id
-
-    // perform some tests first
-    if (classId < 1)
-        return -1;  // such value is not supposed to exist...
+    this->editedRows.clear();
 
-    // is there anything recorded for this class yet?
-    if ((int)this->objectsIndex.size() < classId)
-        return 0; // answer : no -> we set the object Id to 0
+    this->offsets.swap(rowsOffsets);
+    this->ids.swap(rowsIds);
+    this->rowsNumber = this->offsets.empty() ? 0 : (int)this->offsets.size()-1;
+}
 
-    // explore and find the first available object id...
-    // basically the right one will be when we find an empty vector of objectsIndex[classId-1]
-    // if there is none, the right answer is just the size of objectsIndex[classId-1]
-    int rightObjectId = 0;
-    while ( (rightObjectId < (int)this->objectsIndex[classId-1].size())
-            && (this->objectsIndex[classId-1][rightObjectId].size()>0) )
-        rightObjectId++;
 
-    // that's all, when we're out of the loop we've reached the right spot
-    return rightObjectId;
+void AnnotationsFlatIndex::clear()
+{
+    this->rowsNumber = 0;
+    this->offsets.clear();
+    this->ids.clear();
+    this->editedRows.clear();
 }
 
 
-int AnnotationsRecord::searchAnnotation(int frameId, int classId, int objectId) const
-{
-    /*
-     * this is an old version, probably sub-optimal when looking at big videos with a lot of frames
-     * and some objects that are visible throughout the video
-     * It is likely more optimal to search the frame index
-    // find the right object through the objectsIndex vector
-    if (classId>=1 && classId<=(int)this->objectsIndex.size())
-    {
-        if (objectId>=0 && objectId<(int)this->objectsIndex[classId-1].size())
-        {
-            for (size_t k=0; k<this->objectsIndex[classId-1][objectId].size(); k++)
-            {
-                if (this->getAnnotationById(this->objectsIndex[classId-1][objectId][k]).FrameNumber == frameId)
-                    return this->objectsIndex[classId-1][objectId][k];
-            }
-        }
-    }
-    */
 
-    // look at the frames record..
-    if (frameId>=0 && frameId<(int)this->framesIndex.size())
-    {
-        for (size_t k=0; k<this->framesIndex[frameId].size(); k++)
-        {
-            int candidateInd = this->framesIndex[frameId][k];
 
-            if (this->getAnnotationById(candidateInd).ClassId==classId && this->getAnnotationById(candidateInd).ObjectId==objectId)
-                return candidateInd;
-        }
-    }
 
-    return -1;
-}
 
 
-void AnnotationsRecord::updateBoundingBox(int annotationIndex, const cv::Rect2i newBB)
-{
-    // edit a bounding box given the object ID in the record vector
 
-    // this is the most straightforward thing that we can hope for
-    if (annotationIndex<0 || annotationIndex>=(int)this->record.size())
-        return;
 
-    this->record[annotationIndex].BoundingBox = newBB;
-}
 
 
 
 
-void AnnotationsRecord::updateCentroidFront(int annotationIndex, const cv::Point2i newCt, const cv::Point2i newFt)
-{
-    // edit a bounding box given the object ID in the record vector
 
-    // this is the most straightforward thing that we can hope for
-    if (annotationIndex<0 || annotationIndex>=(int)this->record.size())
+void AnnotationsSpatialIndex::insert(int frameId, int annotationId, const cv::Rect2i& area)
+{
+    if (frameId<0 || annotationId<0)
         return;
 
-    this->record[annotationIndex].Centroid = newCt;
-    this->record[annotationIndex].Front    = newFt;
+    // filling the frames vector if needed with empty grids
+    while ((int)this->framesGrids.size()<=frameId)
+        this->framesGrids.push_back(FrameGrid());
 
-    this->updateBoundingBox(annotationIndex, Rect2i(newCt, newFt));
-}
+    FrameGrid& grid = this->framesGrids[frameId];
 
+    int firstCellX = this->toCell(area.x), lastCellX = this->toCell(area.x+QtCvUtils::getMax(area.width,1)-1);
+    int firstCellY = this->toCell(area.y), lastCellY = this->toCell(area.y+QtCvUtils::getMax(area.height,1)-1);
 
+    // big objects (typically uniform classes like the road) would cost more to store into each cell than to simply test them
+    if ((int64_t)(lastCellX-firstCellX+1)*(lastCellY-firstCellY+1) > _AnnotsSpatialIndex_default_maxCellsPerObject)
+    {
+        grid.largeObjects.push_back(annotationId);
+        return;
+    }
 
+    for (int cy=firstCellY; cy<=lastCellY; cy++)
+        for (int cx=firstCellX; cx<=lastCellX; cx++)
+            grid.cells[cellKey(cx, cy)].push_back(annotationId);
+}
 
 
-void AnnotationsRecord::removeAnnotation(int annotationIndex)
+void AnnotationsSpatialIndex::remove(int frameId, int annotationId, const cv::Rect2i& area)
 {
-    // remove an annotation given its id in the record vector
-
-    // perform the usual checks
-    if (annotationIndex<0 || annotationIndex>=(int)this->record.size())
+    if (frameId<0 || frameId>=(int)this->framesGrids.size())
         return;
 
-    // we do have something that we can remove
-    AnnotationObject oldAnnot = this->record[annotationIndex];
+    FrameGrid& grid = this->framesGrids[frameId];
 
-    // remove the data
-    this->record.erase(this->record.begin() + annotationIndex);
+    int firstCellX = this->toCell(area.x), lastCellX = this->toCell(area.x+QtCvUtils::getMax(area.width,1)-1);
+    int firstCellY = this->toCell(area.y), lastCellY = this->toCell(area.y+QtCvUtils::getMax(area.height,1)-1);
 
-    // remove the references...
-    // ... into the frames index first
-    for (size_t k=0; k<this->framesIndex[oldAnnot.FrameNumber].size(); k++)
+    // same logic as when inserting
+    if ((int64_t)(lastCellX-firstCellX+1)*(lastCellY-firstCellY+1) > _AnnotsSpatialIndex_default_maxCellsPerObject)
     {
-        if (this->framesIndex[oldAnnot.FrameNumber][k] == annotationIndex)
-        {
-            this->framesIndex[oldAnnot.FrameNumber].erase(this->framesIndex[oldAnnot.FrameNumber].begin()+k);
-            break;
-        }
+        vector<int>::iterator it = find(grid.largeObjects.begin(), grid.largeObjects.end(), annotationId);
+        if (it != grid.largeObjects.end())
+            grid.largeObjects.erase(it);
+        return;
     }
 
-    // ... then into the objects index
-    for (size_t k=0; k<this->objectsIndex[oldAnnot.ClassId-1][oldAnnot.ObjectId].size(); k++)
+    for (int cy=firstCellY; cy<=lastCellY; cy++)
     {
-        if (this->objectsIndex[oldAnnot.ClassId-1][oldAnnot.ObjectId][k] == annotationIndex)
+        for (int cx=firstCellX; cx<=lastCellX; cx++)
         {
-            this->objectsIndex[oldAnnot.ClassId-1][oldAnnot.ObjectId].erase(this->objectsIndex[oldAnnot.ClassId-1][oldAnnot.ObjectId].begin()+k);
-            break;
+            unordered_map<int64_t, vector<int> >::iterator cellIt = grid.cells.find(cellKey(cx, cy));
+            if (cellIt == grid.cells.end())
+                continue;
+
+            vector<int>::iterator it = find(cellIt->second.begin(), cellIt->second.end(), annotationId);
+            if (it != cellIt->second.end())
+                cellIt->second.erase(it);
+
+            // don't keep empty cells, queries running through the whole grid would go through them
+            if (cellIt->second.empty())
+                grid.cells.erase(cellIt);
         }
     }
+}
 
-    // finally correct the reference IDs
 
-    // we run through the record object starting from the point where we removed the annot,
-    // then decrement all of the references pointing to the previous annotations positions
-    for (int i=annotationIndex; i<(int)this->record.size(); i++)
-    {
-        AnnotationObject currObject = this->record[i];
+vector<int> AnnotationsSpatialIndex::query(int frameId, const cv::Rect2i& area) const
+{
+    vector<int> candidates;
+
+    if (frameId<0 || frameId>=(int)this->framesGrids.size() || area.width<=0 || area.height<=0)
+        return candidates;
 
-        for (size_t k=0; k<this->framesIndex[currObject.FrameNumber].size(); k++)
+    const FrameGrid& grid = this->framesGrids[frameId];
+
+    candidates = grid.largeObjects;
+
+    int firstCellX = this->toCell(area.x), lastCellX = this->toCell(area.x+area.width-1);
+    int firstCellY = this->toCell(area.y), lastCellY = this->toCell(area.y+area.height-1);
+
+    if ((int64_t)(lastCellX-firstCellX+1)*(lastCellY-firstCellY+1) > (int64_t)grid.cells.size())
+    {
+        // the area is large compared to what's been stored - it's faster to run through the occupied cells directly
+        for (unordered_map<int64_t, vector<int> >::const_iterator cellIt=grid.cells.begin(); cellIt!=grid.cells.end(); ++cellIt)
         {
-            if (this->framesIndex[currObject.FrameNumber][k] == i+1)
-            {
-                this->framesIndex[currObject.FrameNumber][k] = i;
-                break;
-            }
-        }
+            int cx = (int)(int32_t)(cellIt->first & 0xFFFFFFFF);
+            int cy = (int)(cellIt->first >> 32);
 
-        // ... then into the objects index
-        for (size_t k=0; k<this->objectsIndex[currObject.ClassId-1][currObject.ObjectId].size(); k++)
+            if (cx>=firstCellX && cx<=lastCellX && cy>=firstCellY && cy<=lastCellY)
+                candidates.insert(candidates.end(), cellIt->second.begin(), cellIt->second.end());
+        }
+    }
+    else
+    {
+        for (int cy=firstCellY; cy<=lastCellY; cy++)
         {
-            if (this->objectsIndex[currObject.ClassId-1][currObject.ObjectId][k] == i+1)
+            for (int cx=firstCellX; cx<=lastCellX; cx++)
             {
-                this->objectsIndex[currObject.ClassId-1][currObject.ObjectId][k] = i;
-                break;
+                unordered_map<int64_t, vector<int> >::const_iterator cellIt = grid.cells.find(cellKey(cx, cy));
+                if (cellIt != grid.cells.end())
+                    candidates.insert(candidates.end(), cellIt->second.begin(), cellIt->second.end());
             }
         }
     }
 
-    // that's it, we're done :)
+    // an object covering several cells is found several times
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+    return candidates;
 }
 
 
+AnnotationsRecord::AnnotationsRecord()
+{
+    // nothing to be done there, all of the vectors will be created without any help
+    this->removedAnnotationsNumber = 0;
+    this->batchDepth = 0;
+    this->indicesOutdated = false;
+}
 
-void AnnotationsRecord::clearFrame(int frameId)
+AnnotationsRecord::~AnnotationsRecord()
 {
-    // remove all of the objects included in a given frame
+    // same as for the constructor
+}
 
-    // copy-store the indexes since the remaining of this method will impact the original vector
-    vector<int> objectsToRemove = this->getFrameContentIds(frameId);
+AnnotationIdsRange AnnotationsRecord::getAnnotationIds(int classId, int objectId) const
+{
+    // retrieve the index of an object
 
-    // sort the indexes, so that we can start from the end
-    // this way, we ensure that the remaining indices that will be left won't be affected by any other removal
-    sort(objectsToRemove.begin(), objectsToRemove.end());
+    // don't forget that the classId index starts from 1...
+    this->refreshIndices();
 
-    // do the job
-    for (int k=(int)objectsToRemove.size()-1; k>=0; k--)
-        this->removeAnnotation(objectsToRemove[k]);
+    if (classId<1 || classId>(int)this->objectsIndex.size())
+        return AnnotationIdsRange();
 
-    // that's it, we're done
+    return this->objectsIndex[classId-1].getRow(objectId);
 }
 
+AnnotationIdsRange AnnotationsRecord::getTrackBetween(int classId, int objectId, int firstFrame, int lastFrame) const
+{
+    // the track is sorted by frame number : both ends are found through binary searches
+    AnnotationIdsRange track = this->getAnnotationIds(classId, objectId);
 
+    const int* first = lower_bound(track.begin(), track.end(), firstFrame, [this](int id, int frame) -> bool { return this->frameNumbers[id] < frame; });
+    const int* last = upper_bound(first, track.end(), lastFrame, [this](int frame, int id) -> bool { return frame < this->frameNumbers[id]; });
 
+    return AnnotationIdsRange(first, last);
+}
 
-void AnnotationsRecord::mergeIntraFrameAnnotationsTo(const std::vector<int>& annotsList, int newClassId, int newObjectId)
+int AnnotationsRecord::searchTrackAtOrBefore(int classId, int objectId, int frameId) const
 {
-    // set newClassId and newObjectId to the first element in annotsList
-    // update its bounding box so that it includes all of the bounding box of the annotsList objects
-    // this function doesn't delete
+    AnnotationIdsRange track = this->getTrackBetween(classId, objectId, 0, frameId);
 
-    if (annotsList.size()<1)
-        return;
+    if (track.empty())
+        return -1;
 
-    if (newClassId<0)   // this case doesn't make any sense, discard it as well
-        return;
+    return track[track.size()-1];
+}
 
-    int firstAnnotId = annotsList[0];
+int AnnotationsRecord::searchTrackAtOrAfter(int classId, int objectId, int frameId) const
+{
+    AnnotationIdsRange track = this->getAnnotationIds(classId, objectId);
 
-    if (firstAnnotId<0 || firstAnnotId>=(int)this->record.size())
-        return;
+    const int* found = lower_bound(track.begin(), track.end(), frameId, [this](int id, int frame) -> bool { return this->frameNumbers[id] < frame; });
+
+    if (found == track.end())
+        return -1;
 
+    return *found;
+}
 
-    // storing currAnnot as a reference - this way we shall(?) access directly to the object and modify it straight away
-    AnnotationObject& currAnnot = this->record[firstAnnotId];
+vector<Point2i> AnnotationsRecord::getTrackGaps(int classId, int objectId) const
+{
+    // successive annotations of the track which frames are not contiguous
+    AnnotationIdsRange track = this->getAnnotationIds(classId, objectId);
 
-    // if the new class and/or object id are different, we need tu update the indexing accordingly
-    if ((newClassId != currAnnot.ClassId) || (newObjectId != currAnnot.ObjectId))
+    vector<Point2i> gaps;
+    for (size_t k=1; k<track.size(); k++)
     {
-        // we also need to modify the indexation
-        // for now, we suppose that it's ok and that there's no incoherence in the indexation
-        for (size_t k=0; k<this->objectsIndex[currAnnot.ClassId-1][currAnnot.ObjectId].size(); k++)
-        {
-            // find the reference position and remove it
-            if (this->objectsIndex[currAnnot.ClassId-1][currAnnot.ObjectId][k] == firstAnnotId)
-            {
-                this->objectsIndex[currAnnot.ClassId-1][currAnnot.ObjectId].erase(this->objectsIndex[currAnnot.ClassId-1][currAnnot.ObjectId].begin()+k);
-                break;
-            }
-        }
+        if (this->frameNumbers[track[k]] > this->frameNumbers[track[k-1]]+1)
+            gaps.push_back(Point2i(this->frameNumbers[track[k-1]], this->frameNumbers[track[k]]));
+    }
 
-        // store the new reference index at the right place
-        // filling the class matrix with empty vectors if needed
-        while((int)this->objectsIndex.size()<newClassId)
-            this->objectsIndex.push_back(vector< vector<int> >());
+    return gaps;
+}
 
-        // now the corresponding objects index...
-        while((int)this->objectsIndex[newClassId-1].size()<=newObjectId)
-            this->objectsIndex[newClassId-1].push_back(vector<int>());
+AnnotationIdsRange AnnotationsRecord::getFrameContentIds(int id) const
+{
+    // get all the IDs inside a frame
+    this->refreshIndices();
 
-        // finally, storing the index into the objects record...
-        this->objectsIndex[newClassId-1][newObjectId].push_back(firstAnnotId);
+    return this->framesIndex.getRow(id);
+}
 
-        // updating the reference
-        currAnnot.ClassId = newClassId;
-        currAnnot.ObjectId = newObjectId;
-    }
+vector<int> AnnotationsRecord::getFrameContentIdsWithin(int id, const cv::Rect2i& area) const
+{
+    // get the candidates from the spatial index, then perform the exact test
+    this->refreshIndices();
 
-    // running through the list to update the bounding box
-    for (size_t k=1; k<annotsList.size(); k++)
-    {
-        // in theory, such check is unnecessary?
-        if (annotsList[k]<0 || annotsList[k]>=(int)this->record.size())
-            continue;
+    vector<int> candidates = this->spatialIndex.query(id, area);
 
-        if (this->record[annotsList[k]].FrameNumber != currAnnot.FrameNumber)
-            // the operation that we want to perform is relevant only if we're working on the same frame
-            continue;
+    vector<int> frameContent;
+    frameContent.reserve(candidates.size());
 
-        // we will just use the bounding boxes - the objects are to be erased later
-        currAnnot.BoundingBox |= this->record[annotsList[k]].BoundingBox;
+    for (size_t k=0; k<candidates.size(); k++)
+    {
+        if ((getIndexedArea(this->boundingBoxes[candidates[k]]) & area).area() > 0)
+            frameContent.push_back(candidates[k]);
     }
-}
 
+    return frameContent;
+}
 
-void AnnotationsRecord::deleteAnnotationsGroup(const std::vector<int>& deleteList)
+AnnotationObject AnnotationsRecord::getAnnotationById(int id) const
 {
-    vector<int> deleteListCopy = deleteList;
+    // retrieve a specific object by his ID - the object is assembled from the columns
 
-    sort(deleteListCopy.begin(), deleteListCopy.end());
+    // an empty object is returned when no answer is possible
+    // its classId shall be 0 (by default), which should allow us to know whether there's data or not
+    AnnotationObject annot;
 
-    for (int k=(int)deleteListCopy.size()-1; k>=0; k--)
-    {
-        this->removeAnnotation(deleteListCopy[k]);
-    }
-}
+    if (!this->isAnnotationValid(id))
+        return annot;
 
+    annot.ClassId = this->classIds[id];
+    annot.ObjectId = this->objectIds[id];
+    annot.FrameNumber = this->frameNumbers[id];
+    annot.BoundingBox = this->boundingBoxes[id];
+    annot.Centroid = this->centroids[id];
+    annot.Front = this->fronts[id];
+    annot.Moments = this->moments[id];
+    annot.locked = (this->locks[id] != 0);
 
+    return annot;
+}
 
+void AnnotationsRecord::pushAnnotation(const AnnotationObject& annot)
+{
+    // append the object at the end of each column
+    this->classIds.push_back(annot.ClassId);
+    this->objectIds.push_back(annot.ObjectId);
+    this->frameNumbers.push_back(annot.FrameNumber);
+    this->boundingBoxes.push_back(annot.BoundingBox);
+    this->centroids.push_back(annot.Centroid);
+    this->fronts.push_back(annot.Front);
+    this->locks.push_back(annot.locked ? 1 : 0);
+    this->moments.push_back(annot.Moments);
+}
 
-vector<int> AnnotationsRecord::separateAnnotations(const std::vector<int>& separateList)
+int AnnotationsRecord::addNewAnnotation(const AnnotationObject& annot)
 {
-    // first step : find objects with similar class and object id - those are the objects that we will need to separate
-    vector<Point2i> listObjects;
-    vector<int> separateListCopy;
+    // push a new annotation object, at the end of the main vector - returns the new annotation index... if it is not an update!!
 
-    vector<int> idsReturn;
+    // verify that this object is possible
+    if ((annot.ClassId<1) || (annot.ObjectId<0) || (annot.FrameNumber<0))
+        return -1;
 
-    for (int k=0; k<(int)separateList.size(); k++)
+    // first, we must verify whether this is actually an update, or a brand new annotation
+    int searchRes = this->searchAnnotation(annot.FrameNumber, annot.ClassId, annot.ObjectId);
+    if (searchRes != -1)
     {
-        // some safety check
-        if (separateList[k]<0 || separateList[k]>=(int)this->record.size())
-            continue;
+        // this addition is actually an update, we update the bounding box using the | operator
+        this->updateBoundingBox(searchRes, (this->boundingBoxes[searchRes] | annot.BoundingBox) );
 
-        listObjects.push_back( Point2i(this->getAnnotationById(separateList[k]).ClassId, this->getAnnotationById(separateList[k]).ObjectId) );
-        separateListCopy.push_back(separateList[k]);
-    }
+        // the moments of the added pixels simply add up
+        if (!annot.Moments.isEmpty())
+        {
+            this->moments[searchRes] += annot.Moments;
+            this->logJournalOp(_AJO_UpdateMoments, searchRes);
+        }
 
-    // sort the objects
-    vector<size_t> orderedObjects = AnnotationUtilities::sortP2iIndexes(listObjects);
+        // that's it, we're done
+        return searchRes;
+    }
 
-    Point2i currObjIds(0,0); // setting an impossible set of object ids as a starting point
+    // otherwise... creation of a new annotation
 
-    for (size_t k=0; k<orderedObjects.size(); k++)
-    {
-        if (listObjects[orderedObjects[k]] != currObjIds)
-        {
-            // new object found - we just store the current object Ids - it is the other case that'll be interesting
-            currObjIds = listObjects[orderedObjects[k]];
-        }
-        else
-        {
-            // same object as before - we need to provide it a new object id given its class
-            int newObjId = this->getFirstAvailableObjectId(currObjIds.x);
 
-            int oldObjId = listObjects[orderedObjects[k]].y;
-            int recordId = separateListCopy[orderedObjects[k]];
-            // fortunately this id won't have to change - it also means that we won't have to touch the frames record
+    // storing the new record index
+    int newInd = this->getRecordSize();
+    this->rememberBatchOriginal(newInd);
 
-            // record the new object id
-            this->record[recordId].ObjectId = newObjId;
+    // recording the annotation
+    this->pushAnnotation(annot);
+    this->logJournalOp(_AJO_Add, newInd);
 
-            // removing the old object reference
-            // for once, we don't need to check that there's already a corresponding vector entry
-            for (size_t l=0; l<this->objectsIndex[currObjIds.x-1][oldObjId].size(); l++)
-            {
-                if (this->objectsIndex[currObjIds.x-1][oldObjId][l] == recordId)
-                {
-                    this->objectsIndex[currObjIds.x-1][oldObjId].erase(this->objectsIndex[currObjIds.x-1][oldObjId].begin() + l);
-                    break;
-                }
-            }
+    // the objects index...
+    this->indexObject(newInd, annot.ClassId, annot.ObjectId);
 
-            // now adding the new one
-            while ((int)this->objectsIndex[currObjIds.x-1].size()<=newObjId)
-                this->objectsIndex[currObjIds.x-1].push_back(vector<int>());
+    // and the (frame, class, object) key
+    this->keysIndex[AnnotationKey(annot)] = newInd;
 
-            this->objectsIndex[currObjIds.x-1][newObjId].push_back(recordId);
+    // recording the index into the frames record... and its location (postponed within a batch)
+    if (this->batchDepth == 0)
+    {
+        this->framesIndex.append(annot.FrameNumber, newInd);
+        this->spatialIndex.insert(annot.FrameNumber, newInd, getIndexedArea(annot.BoundingBox));
+    }
+
+    return newInd;
+}
+
+
+
+int AnnotationsRecord::getFirstAvailableObjectId(int classId) const
+{
+    // returns the first available object Id given a class id
+
+    // perform some tests first
+    if (classId < 1)
+        return -1;  // such value is not supposed to exist...
+
+    // is there anything recorded for this class yet?
+    if ((int)this->objectsOccurrences.size() < classId)
+        return 0; // answer : no -> we set the object Id to 0
+
+    // the right one is the lowest id which has no occurrence - those are kept sorted in freeObjectIds
+    // if there is none, the right answer is just the number of object ids known for this class
+    if (!this->freeObjectIds[classId-1].empty())
+        return *(this->freeObjectIds[classId-1].begin());
+
+    return (int)this->objectsOccurrences[classId-1].size();
+}
+
+
+int AnnotationsRecord::searchAnnotation(int frameId, int classId, int objectId) const
+{
+    /*
+     * previous versions of this function scanned either the objectsIndex or the framesIndex vectors,
+     * which becomes really slow on crowded frames since this function is called on a per-pixel basis.
+     * We now directly look at the keys index, which is maintained alongside the other indices
+     */
+    unordered_map<AnnotationKey, int, AnnotationKeyHash>::const_iterator it = this->keysIndex.find(AnnotationKey(frameId, classId, objectId));
+
+    if (it == this->keysIndex.end())
+        return -1;
+
+    return it->second;
+}
+
+
+void AnnotationsRecord::indexObject(int annotationIndex, int classId, int objectId)
+{
+    // store the annotation index into the objects index, and keep the available object ids up to date
+
+    // filling the class vectors if needed
+    while((int)this->objectsOccurrences.size()<classId)
+    {
+        this->objectsOccurrences.push_back(vector<int>());
+        this->freeObjectIds.push_back(set<int>());
+    }
+
+    vector<int>& classOccurrences = this->objectsOccurrences[classId-1];
+    set<int>& classFreeIds = this->freeObjectIds[classId-1];
+
+    // the ids that we skip on the way are available
+    for (int o=(int)classOccurrences.size(); o<objectId; o++)
+        classFreeIds.insert(o);
+
+    if ((int)classOccurrences.size() <= objectId)
+        classOccurrences.resize(objectId+1, 0);
+
+    // this object id is now used
+    if (classOccurrences[objectId]++ == 0)
+        classFreeIds.erase(objectId);
+
+    // finally, storing the index into the objects record... (postponed within a batch)
+    if (this->batchDepth > 0)
+        return;
+
+    while((int)this->objectsIndex.size()<classId)
+        this->objectsIndex.push_back(AnnotationsFlatIndex());
+
+    // the tracks are kept sorted by frame number
+    this->objectsIndex[classId-1].insertSorted(objectId, annotationIndex, this->frameNumbers);
+}
+
+
+void AnnotationsRecord::unindexObject(int annotationIndex, int classId, int objectId)
+{
+    // remove the annotation index from the objects index - the object id becomes available if it was its last occurrence
+    if (classId<1 || classId>(int)this->objectsOccurrences.size())
+        return;
+
+    vector<int>& classOccurrences = this->objectsOccurrences[classId-1];
+
+    if (objectId<0 || objectId>=(int)classOccurrences.size() || classOccurrences[objectId]==0)
+        return;
+
+    if (--classOccurrences[objectId] == 0)
+        this->freeObjectIds[classId-1].insert(objectId);
+
+    // (postponed within a batch)
+    if (this->batchDepth == 0)
+        this->objectsIndex[classId-1].erase(objectId, annotationIndex);
+}
+
+
+void AnnotationsRecord::unindexKey(const AnnotationKey& key, int annotationIndex)
+{
+    // remove the key from the keys index... only if it actually points to the given annotation
+    // (merge procedures may temporarily lead to several annotations sharing the same key)
+    unordered_map<AnnotationKey, int, AnnotationKeyHash>::iterator it = this->keysIndex.find(key);
+
+    if (it != this->keysIndex.end() && it->second == annotationIndex)
+        this->keysIndex.erase(it);
+}
+
+
+void AnnotationsRecord::updateBoundingBox(int annotationIndex, const cv::Rect2i newBB)
+{
+    // edit a bounding box given the object ID in the record vector
+
+    // this is the most straightforward thing that we can hope for
+    if (!this->isAnnotationValid(annotationIndex))
+        return;
+
+    // the frames which are loaded again confirm the bounding boxes most of the time : nothing to journal then
+    bool changed = (this->boundingBoxes[annotationIndex] != newBB);
+
+    // the object moves within the spatial index as well
+    if (this->batchDepth > 0)
+    {
+        this->rememberBatchOriginal(annotationIndex);
+        this->boundingBoxes[annotationIndex] = newBB;
+        if (changed)
+            this->logJournalOp(_AJO_UpdateBox, annotationIndex);
+        return;
+    }
+
+    this->spatialIndex.remove(this->frameNumbers[annotationIndex], annotationIndex, getIndexedArea(this->boundingBoxes[annotationIndex]));
+
+    this->boundingBoxes[annotationIndex] = newBB;
+
+    this->spatialIndex.insert(this->frameNumbers[annotationIndex], annotationIndex, getIndexedArea(newBB));
+
+    if (changed)
+        this->logJournalOp(_AJO_UpdateBox, annotationIndex);
+}
+
+
+
+
+void AnnotationsRecord::updateCentroidFront(int annotationIndex, const cv::Point2i newCt, const cv::Point2i newFt)
+{
+    // edit a bounding box given the object ID in the record vector
+
+    // this is the most straightforward thing that we can hope for
+    if (!this->isAnnotationValid(annotationIndex))
+        return;
+
+    this->centroids[annotationIndex] = newCt;
+    this->fronts[annotationIndex]    = newFt;
+    this->logJournalOp(_AJO_UpdateCentroidFront, annotationIndex);
+
+    this->updateBoundingBox(annotationIndex, Rect2i(newCt, newFt));
+}
+
+
+
+
+
+void AnnotationsRecord::updateMoments(int annotationIndex, const AnnotationMoments& newMoments)
+{
+    // the moments aren't indexed : no need to bother with the batches
+    if (!this->isAnnotationValid(annotationIndex) || (this->moments[annotationIndex] == newMoments))
+        return;
+
+    this->moments[annotationIndex] = newMoments;
+    this->logJournalOp(_AJO_UpdateMoments, annotationIndex);
+}
+
+
+void AnnotationsRecord::subtractMoments(int annotationIndex, const AnnotationMoments& removedPixels)
+{
+    if (!this->isAnnotationValid(annotationIndex) || removedPixels.isEmpty())
+        return;
+
+    this->moments[annotationIndex] -= removedPixels;
+    this->logJournalOp(_AJO_UpdateMoments, annotationIndex);
+}
+
+
+void AnnotationsRecord::removeAnnotation(int annotationIndex)
+{
+    // remove an annotation given its id in the record vector
+
+    // perform the usual checks
+    if (!this->isAnnotationValid(annotationIndex))
+        return;
+
+    // we do have something that we can remove
+    this->rememberBatchOriginal(annotationIndex);
+    this->logJournalOp(_AJO_Remove, annotationIndex);
+
+    int frameNumber = this->frameNumbers[annotationIndex];
+    int classId = this->classIds[annotationIndex];
+    int objectId = this->objectIds[annotationIndex];
+
+    // remove the references...
+    // ... into the objects index first
+    this->unindexObject(annotationIndex, classId, objectId);
+
+    // ... into the keys index
+    this->unindexKey(AnnotationKey(frameNumber, classId, objectId), annotationIndex);
+
+    // ... and finally into the frames and spatial indices (postponed within a batch)
+    if (this->batchDepth == 0)
+    {
+        this->framesIndex.erase(frameNumber, annotationIndex);
+        this->spatialIndex.remove(frameNumber, annotationIndex, getIndexedArea(this->boundingBoxes[annotationIndex]));
+    }
+
+    // we don't erase the data, otherwise we would have to shift all of the following indices
+    // instead we leave a tombstone behind - it will be removed by the next compaction
+    this->classIds[annotationIndex] = 0;
+    this->removedAnnotationsNumber++;
+
+    // that's it, we're done :)
+}
+
+
+
+void AnnotationsRecord::clearFrame(int frameId)
+{
+    // remove all of the objects included in a given frame
+
+    // copy-store the indexes since the remaining of this method will impact the original content
+    vector<int> objectsToRemove = this->getFrameContentIds(frameId).toVector();
+
+    // do the job - removals don't affect the other indices, so the order doesn't matter
+    for (size_t k=0; k<objectsToRemove.size(); k++)
+        this->removeAnnotation(objectsToRemove[k]);
+
+    // that's it, we're done
+}
+
+
+
+
+void AnnotationsRecord::mergeIntraFrameAnnotationsTo(const std::vector<int>& annotsList, int newClassId, int newObjectId)
+{
+    // set newClassId and newObjectId to the first element in annotsList
+    // update its bounding box so that it includes all of the bounding box of the annotsList objects
+    // this function doesn't delete the other elements - except the one which may already hold the new class and object ids
+
+    if (annotsList.size()<1)
+        return;
+
+    if (newClassId<1)   // this case doesn't make any sense, discard it as well (and a null class id would be taken for a removed entry)
+        return;
+
+    int firstAnnotId = annotsList[0];
+
+    if (!this->isAnnotationValid(firstAnnotId))
+        return;
+
+    int frameNumber = this->frameNumbers[firstAnnotId];
+
+    // running through the list to compute the merged bounding box and moments first, since one of them may be removed below
+    // (unlike the bounding boxes, the moments cannot be added twice : doublons are skipped)
+    Rect2i mergedBB = this->boundingBoxes[firstAnnotId];
+    AnnotationMoments mergedMoments = this->moments[firstAnnotId];
+    std::set<int> mergedIds;
+    mergedIds.insert(firstAnnotId);
+
+    for (size_t k=1; k<annotsList.size(); k++)
+    {
+        // in theory, such check is unnecessary?
+        if (!this->isAnnotationValid(annotsList[k]))
+            continue;
+
+        if (this->frameNumbers[annotsList[k]] != frameNumber)
+            // the operation that we want to perform is relevant only if we're working on the same frame
+            continue;
+
+        // we will just use the bounding boxes - the objects are to be erased later
+        mergedBB |= this->boundingBoxes[annotsList[k]];
+
+        if (mergedIds.insert(annotsList[k]).second)
+            mergedMoments += this->moments[annotsList[k]];
+    }
+
+    this->rememberBatchOriginal(firstAnnotId);
+
+    // if the new class and/or object id are different, we need tu update the indexing accordingly
+    if ((newClassId != this->classIds[firstAnnotId]) || (newObjectId != this->objectIds[firstAnnotId]))
+    {
+        // the merged annotation which holds the new key is removed right now : the journal then designates it by its key
+        // before the relabelling, so that replaying the journal removes this very entry and not the relabelled one
+        int keyHolderId = this->searchAnnotation(frameNumber, newClassId, newObjectId);
+        if ((keyHolderId != -1) && (mergedIds.count(keyHolderId) > 0))
+            this->removeAnnotation(keyHolderId);
+
+        this->logJournalOp(_AJO_Relabel, firstAnnotId, newClassId, newObjectId);
+
+        // we also need to modify the indexation
+        // for now, we suppose that it's ok and that there's no incoherence in the indexation
+        this->unindexObject(firstAnnotId, this->classIds[firstAnnotId], this->objectIds[firstAnnotId]);
+
+        // store the new reference index at the right place
+        this->indexObject(firstAnnotId, newClassId, newObjectId);
+
+        // the key changes as well
+        this->unindexKey(AnnotationKey(frameNumber, this->classIds[firstAnnotId], this->objectIds[firstAnnotId]), firstAnnotId);
+        this->keysIndex[AnnotationKey(frameNumber, newClassId, newObjectId)] = firstAnnotId;
+
+        // updating the columns
+        this->classIds[firstAnnotId] = newClassId;
+        this->objectIds[firstAnnotId] = newObjectId;
+    }
+
+    this->moments[firstAnnotId] = mergedMoments;
+
+    // go through the usual update, so that the spatial index follows
+    this->updateBoundingBox(firstAnnotId, mergedBB);
+
+    if (mergedIds.size()>1)
+        this->logJournalOp(_AJO_UpdateMoments, firstAnnotId);
+}
+
+
+void AnnotationsRecord::deleteAnnotationsGroup(const std::vector<int>& deleteList)
+{
+    // removals leave the other ids untouched, we can go through the list as is
+    // (doublons are not an issue either, since an already removed annotation is simply ignored)
+    for (size_t k=0; k<deleteList.size(); k++)
+    {
+        this->removeAnnotation(deleteList[k]);
+    }
+}
+
+
+
+
+vector<int> AnnotationsRecord::separateAnnotations(const std::vector<int>& separateList)
+{
+    // first step : find objects with similar class and object id - those are the objects that we will need to separate
+    vector<Point2i> listObjects;
+    vector<int> separateListCopy;
+
+    vector<int> idsReturn;
+
+    for (int k=0; k<(int)separateList.size(); k++)
+    {
+        // some safety check
+        if (!this->isAnnotationValid(separateList[k]))
+            continue;
+
+        listObjects.push_back( Point2i(this->classIds[separateList[k]], this->objectIds[separateList[k]]) );
+        separateListCopy.push_back(separateList[k]);
+    }
+
+    // sort the objects
+    vector<size_t> orderedObjects = AnnotationUtilities::sortP2iIndexes(listObjects);
+
+    Point2i currObjIds(0,0); // setting an impossible set of object ids as a starting point
+
+    for (size_t k=0; k<orderedObjects.size(); k++)
+    {
+        if (listObjects[orderedObjects[k]] != currObjIds)
+        {
+            // new object found - we just store the current object Ids - it is the other case that'll be interesting
+            currObjIds = listObjects[orderedObjects[k]];
+        }
+        else
+        {
+            // same object as before - we need to provide it a new object id given its class
+            int newObjId = this->getFirstAvailableObjectId(currObjIds.x);
+
+            int oldObjId = listObjects[orderedObjects[k]].y;
+            int recordId = separateListCopy[orderedObjects[k]];
+            // fortunately this id won't have to change - it also means that we won't have to touch the frames record
+
+            // record the new object id - and update the keys index accordingly
+            this->rememberBatchOriginal(recordId);
+            this->logJournalOp(_AJO_Relabel, recordId, currObjIds.x, newObjId);
+            this->unindexKey(AnnotationKey(this->frameNumbers[recordId], currObjIds.x, oldObjId), recordId);
+            this->objectIds[recordId] = newObjId;
+            this->keysIndex[AnnotationKey(this->frameNumbers[recordId], currObjIds.x, newObjId)] = recordId;
+
+            // removing the old object reference
+            this->unindexObject(recordId, currObjIds.x, oldObjId);
+
+            // now adding the new one
+            this->indexObject(recordId, currObjIds.x, newObjId);
 
             // finally we remember that this record entry has been modified
             idsReturn.push_back(recordId);
         }
     }
 
-    return idsReturn;
+    return idsReturn;
+}
+
+
+
+
+
+
+
+void AnnotationsRecord::clear()
+{
+    // simply clean all the vectors
+    this->classIds.clear();
+    this->objectIds.clear();
+    this->frameNumbers.clear();
+    this->boundingBoxes.clear();
+    this->centroids.clear();
+    this->fronts.clear();
+    this->locks.clear();
+    this->moments.clear();
+    this->objectsIndex.clear();
+    this->objectsOccurrences.clear();
+    this->freeObjectIds.clear();
+    this->framesIndex.clear();
+    this->keysIndex.clear();
+    this->spatialIndex.clear();
+    this->removedAnnotationsNumber = 0;
+    this->indicesOutdated = false;
+    this->batchOriginals.clear();
+    this->journal.clear();
+}
+
+
+
+
+void AnnotationsRecord::beginBatch()
+{
+    // the modifications are still applied to the columns right away, only the indices maintenance is postponed
+    this->batchDepth++;
+}
+
+
+void AnnotationsRecord::commitBatch()
+{
+    if (this->batchDepth < 1)
+        return;
+
+    this->batchDepth--;
+
+    // leaving the outermost batch - report what has been left behind, in one go
+    if (this->batchDepth == 0)
+        this->refreshIndices();
+}
+
+
+void AnnotationsRecord::rememberBatchOriginal(int annotationIndex)
+{
+    if (this->batchDepth < 1)
+        return;
+
+    this->indicesOutdated = true;
+
+    // only the first modification matters, the indices still refer to the state preceding it
+    // (an entry which doesn't exist yet is stored as an empty object)
+    if (this->batchOriginals.find(annotationIndex) == this->batchOriginals.end())
+        this->batchOriginals[annotationIndex] = this->getAnnotationById(annotationIndex);
+}
+
+
+void AnnotationsRecord::refreshIndices() const
+{
+    if (!this->indicesOutdated)
+        return;
+
+    // a few modifications are cheaper to report one by one than rebuilding everything
+    if ((int)this->batchOriginals.size()*_AnnotsRecord_default_batchReplayRatio <= this->getRecordSize())
+        this->replayBatchModifications();
+    else
+        this->rebuildDeferredIndices();
+}
+
+
+void AnnotationsRecord::replayBatchModifications() const
+{
+    // process the entries by increasing ids, so that the new ones keep the frames index rows sorted
+    vector<int> modifiedIds;
+    modifiedIds.reserve(this->batchOriginals.size());
+
+    for (unordered_map<int, AnnotationObject>::const_iterator it=this->batchOriginals.begin(); it!=this->batchOriginals.end(); ++it)
+        modifiedIds.push_back(it->first);
+
+    sort(modifiedIds.begin(), modifiedIds.end());
+
+    for (size_t k=0; k<modifiedIds.size(); k++)
+    {
+        int id = modifiedIds[k];
+        const AnnotationObject& orig = this->batchOriginals[id];
+        bool wasIndexed = (orig.ClassId > 0);
+        bool isIndexed = this->isAnnotationValid(id);
+
+        // the frame number of an entry never changes - the frames index only cares about creations and removals
+        if (wasIndexed && !isIndexed)
+            this->framesIndex.erase(orig.FrameNumber, id);
+        else if (!wasIndexed && isIndexed)
+            this->framesIndex.append(this->frameNumbers[id], id);
+
+        // objects index
+        bool sameObject = wasIndexed && isIndexed && (orig.ClassId == this->classIds[id]) && (orig.ObjectId == this->objectIds[id]);
+
+        if (wasIndexed && !sameObject)
+            this->objectsIndex[orig.ClassId-1].erase(orig.ObjectId, id);
+
+        if (isIndexed && !sameObject)
+        {
+            while((int)this->objectsIndex.size()<this->classIds[id])
+                this->objectsIndex.push_back(AnnotationsFlatIndex());
+
+            this->objectsIndex[this->classIds[id]-1].insertSorted(this->objectIds[id], id, this->frameNumbers);
+        }
+
+        // spatial index
+        bool sameArea = wasIndexed && isIndexed && (orig.BoundingBox == this->boundingBoxes[id]);
+
+        if (wasIndexed && !sameArea)
+            this->spatialIndex.remove(orig.FrameNumber, id, getIndexedArea(orig.BoundingBox));
+
+        if (isIndexed && !sameArea)
+            this->spatialIndex.insert(this->frameNumbers[id], id, getIndexedArea(this->boundingBoxes[id]));
+    }
+
+    this->batchOriginals.clear();
+    this->indicesOutdated = false;
+}
+
+
+
+
+template <typename T> static void compactColumn(std::vector<T>& column, const std::vector<int>& newPositions, int newSize)
+{
+    // move every kept entry to its new position (which is never after the old one), then cut the end
+    for (size_t k=0; k<newPositions.size(); k++)
+        if (newPositions[k] >= 0)
+            column[newPositions[k]] = column[k];
+
+    column.resize(newSize);
+}
+
+
+void AnnotationsRecord::compact()
+{
+    // get rid of the tombstones left by the removals, and renumber the remaining entries accordingly
+    if (this->removedAnnotationsNumber == 0)
+        return;
+
+    // compute the new position of each of the entries - the removed ones are given -1
+    vector<int> newPositions(this->classIds.size(), -1);
+    int newSize = 0;
+
+    for (size_t k=0; k<this->classIds.size(); k++)
+    {
+        if (this->classIds[k] == 0)
+            continue;
+
+        newPositions[k] = newSize++;
+    }
+
+    compactColumn(this->classIds, newPositions, newSize);
+    compactColumn(this->objectIds, newPositions, newSize);
+    compactColumn(this->frameNumbers, newPositions, newSize);
+    compactColumn(this->boundingBoxes, newPositions, newSize);
+    compactColumn(this->centroids, newPositions, newSize);
+    compactColumn(this->fronts, newPositions, newSize);
+    compactColumn(this->locks, newPositions, newSize);
+    compactColumn(this->moments, newPositions, newSize);
+
+    this->removedAnnotationsNumber = 0;
+
+    // now renumber the indices - that's just a matter of building them again
+    this->rebuildIndices();
+}
+
+
+
+
+void AnnotationsRecord::rebuildIndices()
+{
+    // rebuild all of the indices from the record content
+    this->rebuildKeysIndex();
+    this->rebuildDeferredIndices();
+}
+
+
+void AnnotationsRecord::rebuildKeysIndex()
+{
+    // the number of object ids of each class is kept, even if the last ones happen to be unused
+    int recordSize = this->getRecordSize();
+
+    int classesNumber = (int)this->objectsOccurrences.size();
+    for (int k=0; k<recordSize; k++)
+        classesNumber = QtCvUtils::getMax(classesNumber, this->classIds[k]);
+
+    this->objectsOccurrences.resize(classesNumber);
+    for (int c=0; c<classesNumber; c++)
+        this->objectsOccurrences[c].assign(this->objectsOccurrences[c].size(), 0);
+
+    // the keys index and the objects occurrences
+    this->keysIndex.clear();
+
+    for (int k=0; k<recordSize; k++)
+    {
+        if (this->classIds[k] == 0)   // removed entry
+            continue;
+
+        vector<int>& classOccurrences = this->objectsOccurrences[this->classIds[k]-1];
+        if ((int)classOccurrences.size() <= this->objectIds[k])
+            classOccurrences.resize(this->objectIds[k]+1, 0);
+        classOccurrences[this->objectIds[k]]++;
+
+        this->keysIndex[AnnotationKey(this->frameNumbers[k], this->classIds[k], this->objectIds[k])] = k;
+    }
+
+    // the available object ids are the ones without any occurrence
+    this->freeObjectIds.assign(classesNumber, set<int>());
+
+    for (int c=0; c<classesNumber; c++)
+        for (int o=0; o<(int)this->objectsOccurrences[c].size(); o++)
+            if (this->objectsOccurrences[c][o] == 0)
+                this->freeObjectIds[c].insert(o);
+}
+
+
+
+
+void AnnotationsRecord::rebuildDeferredIndices() const
+{
+    // rebuild the frames, objects and spatial indices from the record content. The flat indices are built in one go instead of key by key
+    // the number of keys of the frames and objects indices is kept, even if the last ones happen to be empty
+    int recordSize = this->getRecordSize();
+    vector<int> keys(recordSize, -1);
+
+    // frames index
+    for (int k=0; k<recordSize; k++)
+        keys[k] = (this->classIds[k]>0) ? this->frameNumbers[k] : -1;
+
+    this->framesIndex.assign(keys, this->framesIndex.getRowsNumber());
+
+    // objects index, class by class
+    int classesNumber = (int)this->objectsOccurrences.size();
+    this->objectsIndex.resize(classesNumber);
+
+    for (int c=0; c<classesNumber; c++)
+    {
+        for (int k=0; k<recordSize; k++)
+            keys[k] = (this->classIds[k]==c+1) ? this->objectIds[k] : -1;
+
+        this->objectsIndex[c].assign(keys, QtCvUtils::getMax(this->objectsIndex[c].getRowsNumber(), (int)this->objectsOccurrences[c].size()));
+        this->objectsIndex[c].sortRows(this->frameNumbers);    // the tracks are sorted by frame number
+    }
+
+    this->rebuildSpatialIndex();
+
+    this->batchOriginals.clear();
+    this->indicesOutdated = false;
+}
+
+
+void AnnotationsRecord::rebuildSpatialIndex() const
+{
+    this->spatialIndex.clear();
+
+    for (int k=0; k<this->getRecordSize(); k++)
+    {
+        if (this->classIds[k] == 0)   // removed entry
+            continue;
+
+        this->spatialIndex.insert(this->frameNumbers[k], k, getIndexedArea(this->boundingBoxes[k]));
+    }
+}
+
+
+
+
+
+
+
+void AnnotationsRecord::writeContentToYaml(cv::FileStorage& fs) const
+{
+    writeAnnotationsToYaml(fs, this->getAnnotationsSnapshot());
+}
+
+void AnnotationsRecord::writeContentToCsv(std::ostream &fs) const
+{
+    writeAnnotationsToCsv(fs, this->getAnnotationsSnapshot());
+}
+
+
+std::vector<AnnotationObject> AnnotationsRecord::getAnnotationsSnapshot() const
+{
+    std::vector<AnnotationObject> snapshot;
+    snapshot.reserve(this->getRecordSize() - this->removedAnnotationsNumber);
+
+    for (int k=0; k<this->getRecordSize(); k++)
+    {
+        if (this->classIds[k] == 0)   // removed entry
+            continue;
+
+        snapshot.push_back(this->getAnnotationById(k));
+    }
+
+    return snapshot;
+}
+
+
+void AnnotationsRecord::writeAnnotationsToYaml(cv::FileStorage& fs, const std::vector<AnnotationObject>& annotations)
+{
+    fs << _AnnotsRecord_YAMLKey_Node << "[";
+    for (const AnnotationObject& annot: annotations)
+        fs << annot;
+    fs << "]";
+}
+
+
+void AnnotationsRecord::writeAnnotationsToCsv(std::ostream& fs, const std::vector<AnnotationObject>& annotations)
+{
+    // we just suppose that the stream is open and use it as is, without any verification
+    AnnotationObject::writeCsvHeader(fs);
+    for (const AnnotationObject& annot: annotations)
+        annot.writeToCsv(fs);
+}
+
+
+
+// streaming writer of the record node : it follows the rules of the FileStorage YAML and JSON emitters (indentation, lines wrapping, numbers format),
+// so that the text is the same, byte for byte. It only knows about what the record node needs
+class AnnotationsTextWriter
+{
+public:
+    AnnotationsTextWriter(std::ostream& fs, bool json) : fs(fs), json(json), lineStart(0), space(0)
+    {
+        // the record node is the last one of the AnnotationsSet node, at the first level of the document
+        this->stack.push_back(TextStruct(json ? 8 : 3, true, false));
+        this->stack.back().empty = false;
+        this->buffer.reserve(2*_AnnotsRecord_textBufferSize);
+    }
+
+    void startStruct(const char* key, bool map, bool flow)
+    {
+        const char* data = (flow || this->json) ? (map ? "{" : "[") : NULL;
+        this->writeScalar(key, data, data ? 1 : 0);
+
+        const TextStruct& parent = this->stack.back();
+        if (this->json)
+            this->stack.push_back(TextStruct(parent.indent + 4, map, flow));
+        else
+            this->stack.push_back(TextStruct(parent.flow ? parent.indent : parent.indent + 3 + (flow ? 1 : 0), map, flow));
+    }
+
+    void endStruct()
+    {
+        TextStruct& current = this->stack.back();
+
+        if (this->json && !current.flow)
+        {
+            // the JSON closing brackets are aligned with the parent node
+            current.indent = this->stack[this->stack.size()-2].indent;
+            if (this->getLineLength() <= this->space)
+                this->newLine();
+            this->flushLine();
+        }
+
+        if (current.flow || this->json)
+        {
+            if ((this->getLineLength() > current.indent) && !current.empty)
+                this->buffer += ' ';
+            this->buffer += current.map ? '}' : ']';
+        }
+        else if (current.empty)
+        {
+            this->flushLine();
+            this->buffer += current.map ? "{}" : "[]";
+        }
+
+        this->stack.pop_back();
+        this->stack.back().empty = false;
+    }
+
+    void writeInt(const char* key, int value)
+    {
+        char data[16];
+        char* dataEnd = std::to_chars(data, data+sizeof(data), value).ptr;
+        this->writeScalar(key, data, dataEnd-data);
+    }
+
+    void writeReal(const char* key, double value)
+    {
+        // the integers are written with a trailing dot (JSON adds a 0), the other values with 17 significant digits
+        char data[32];
+        char* dataEnd;
+        if ((value >= INT_MIN) && (value <= INT_MAX) && (value == (double)(int)value))
+        {
+            dataEnd = std::to_chars(data, data+sizeof(data), (int)value).ptr;
+            *dataEnd++ = '.';
+            if (this->json)
+                *dataEnd++ = '0';
+        }
+        else
+            dataEnd = std::to_chars(data, data+sizeof(data), value, std::chars_format::scientific, 16).ptr;
+
+        this->writeScalar(key, data, dataEnd-data);
+    }
+
+    void finish()
+    {
+        // the last line, then whatever is left into the buffer
+        if (this->getLineLength() > this->space)
+            this->newLine();
+        this->buffer.resize(this->lineStart);
+
+        this->fs.write(this->buffer.data(), this->buffer.size());
+        this->buffer.clear();
+        this->lineStart = 0;
+    }
+
+private:
+    struct TextStruct
+    {
+        TextStruct(int indent, bool map, bool flow) : indent(indent), map(map), flow(flow), empty(true) {}
+        int indent;
+        bool map, flow, empty;
+    };
+
+    int getLineLength() const { return (int)(this->buffer.size() - this->lineStart); }
+
+    void newLine()
+    {
+        this->buffer += '\n';
+        this->lineStart = this->buffer.size();
+        this->space = 0;
+
+        if (this->lineStart >= _AnnotsRecord_textBufferSize)
+        {
+            this->fs.write(this->buffer.data(), this->lineStart);
+            this->buffer.clear();
+            this->lineStart = 0;
+        }
+    }
+
+    void flushLine()
+    {
+        // the current line is ended when there's something on it, the next one starts with the indentation of the current node
+        if (this->getLineLength() > this->space)
+            this->newLine();
+        else
+            this->buffer.resize(this->lineStart);
+
+        this->space = this->stack.back().indent;
+        this->buffer.append(this->space, ' ');
+    }
+
+    void writeScalar(const char* key, const char* data, size_t dataLength)
+    {
+        TextStruct& current = this->stack.back();
+        size_t keyLength = key ? strlen(key) : 0;
+
+        if (current.flow)
+        {
+            if (!current.empty)
+                this->buffer += ',';
+
+            int newOffset = this->getLineLength() + (int)(keyLength + dataLength);
+            if ((newOffset > _AnnotsRecord_textWrapMargin) && (newOffset - current.indent > 10))
+                this->flushLine();
+            else
+                this->buffer += ' ';
+        }
+        else
+        {
+            if (this->json && !current.empty)
+            {
+                this->buffer += ',';
+                this->newLine();
+            }
+
+            this->flushLine();
+
+            if (!this->json && !current.map)
+            {
+                this->buffer += '-';
+                if (data)
+                    this->buffer += ' ';
+            }
+        }
+
+        if (key)
+        {
+            if (this->json)
+                this->buffer.append("\"").append(key, keyLength).append("\": ");
+            else
+            {
+                this->buffer.append(key, keyLength).append(":");
+                if (!current.flow && data)
+                    this->buffer += ' ';
+            }
+        }
+
+        if (data)
+            this->buffer.append(data, dataLength);
+
+        current.empty = false;
+    }
+
+    std::ostream& fs;
+    bool json;
+    std::string buffer;         // text not yet handed over to the stream
+    size_t lineStart;           // where the current line starts within the buffer
+    int space;                  // indentation of the current line
+    std::vector<TextStruct> stack;
+};
+
+
+
+// streaming parser of the record node : one pass over the text, the entries are pushed as soon as they're read
+// only the syntax the record node is written with is understood (flow maps of numbers and lists of numbers)
+class AnnotationsTextReader
+{
+public:
+    AnnotationsTextReader(const char* data, size_t size) : start(data), ptr(data), end(data+size) {}
+
+    size_t getPosition() const { return (size_t)(this->ptr - this->start); }
+
+    void skipSpaces()
+    {
+        while ((this->ptr < this->end) && ((*this->ptr == ' ') || (*this->ptr == '\n') || (*this->ptr == '\r') || (*this->ptr == '\t')))
+            this->ptr++;
+    }
+
+    bool accept(char c)     // skips the spaces, then the character if it's the next one
+    {
+        this->skipSpaces();
+        if ((this->ptr < this->end) && (*this->ptr == c))
+        {
+            this->ptr++;
+            return true;
+        }
+        return false;
+    }
+
+    bool readKey(std::string& key)
+    {
+        this->skipSpaces();
+        bool quoted = this->accept('"');
+
+        const char* keyStart = this->ptr;
+        while ((this->ptr < this->end) && (isalnum((unsigned char)*this->ptr) || (*this->ptr == '_')))
+            this->ptr++;
+
+        key.assign(keyStart, this->ptr);
+        return !key.empty() && (!quoted || this->accept('"')) && this->accept(':');
+    }
+
+    bool readNumber(double& value)
+    {
+        this->skipSpaces();
+        std::from_chars_result res = std::from_chars(this->ptr, this->end, value);
+        if ((res.ec != std::errc()) || (res.ptr == this->ptr))
+            return false;
+
+        this->ptr = res.ptr;
+        return true;
+    }
+
+    bool readValues(double* values, int& valuesNumber, int maxValuesNumber)   // a single number, or a list of numbers
+    {
+        valuesNumber = 0;
+        if (!this->accept('['))
+            return this->readNumber(values[valuesNumber++]);
+
+        if (this->accept(']'))
+            return true;
+
+        do
+        {
+            double value;
+            if (!this->readNumber(value))
+                return false;
+            if (valuesNumber < maxValuesNumber)
+                values[valuesNumber] = value;
+            valuesNumber++;
+        }
+        while (this->accept(','));
+
+        return this->accept(']');
+    }
+
+private:
+    const char* start;
+    const char* ptr;
+    const char* end;
+};
+
+
+
+void AnnotationsRecord::writeAnnotationsToText(std::ostream& fs, const std::vector<AnnotationObject>& annotations, bool json)
+{
+    // the same nodes as the ones written by AnnotationObject::write
+    AnnotationsTextWriter writer(fs, json);
+
+    writer.startStruct(_AnnotsRecord_YAMLKey_Node.c_str(), false, false);
+    for (const AnnotationObject& annot: annotations)
+    {
+        writer.startStruct(NULL, true, true);
+
+        writer.writeInt(_AnnotObj_YAMLKey_Class.c_str(), annot.ClassId);
+        writer.writeInt(_AnnotObj_YAMLKey_ObjId.c_str(), annot.ObjectId);
+        writer.writeInt(_AnnotObj_YAMLKey_Frame.c_str(), annot.FrameNumber);
+
+        writer.startStruct(_AnnotObj_YAMLKey_BBox.c_str(), false, true);
+        writer.writeInt(NULL, annot.BoundingBox.x);
+        writer.writeInt(NULL, annot.BoundingBox.y);
+        writer.writeInt(NULL, annot.BoundingBox.width);
+        writer.writeInt(NULL, annot.BoundingBox.height);
+        writer.endStruct();
+
+        writer.startStruct(_AnnotObj_YAMLKey_Cntrd.c_str(), false, true);
+        writer.writeInt(NULL, annot.Centroid.x);
+        writer.writeInt(NULL, annot.Centroid.y);
+        writer.endStruct();
+
+        writer.startStruct(_AnnotObj_YAMLKey_Front.c_str(), false, true);
+        writer.writeInt(NULL, annot.Front.x);
+        writer.writeInt(NULL, annot.Front.y);
+        writer.endStruct();
+
+        if (!annot.Moments.isEmpty())
+        {
+            writer.startStruct(_AnnotObj_YAMLKey_Moments.c_str(), false, true);
+            writer.writeReal(NULL, (double)annot.Moments.m00);
+            writer.writeReal(NULL, (double)annot.Moments.m10);
+            writer.writeReal(NULL, (double)annot.Moments.m01);
+            writer.writeReal(NULL, (double)annot.Moments.m20);
+            writer.writeReal(NULL, (double)annot.Moments.m11);
+            writer.writeReal(NULL, (double)annot.Moments.m02);
+            writer.endStruct();
+        }
+
+        if (annot.locked)
+            writer.writeInt(_AnnotObj_YAMLKey_Locked.c_str(), 1);
+
+        writer.endStruct();
+    }
+    writer.endStruct();
+
+    writer.finish();
+}
+
+
+bool AnnotationsRecord::readContentFromText(const char* data, size_t size, bool json, size_t& endPosition)
+{
+    // remove all data
+    this->clear();
+
+    // a text which doesn't follow the expected syntax leaves nothing behind : it's up to FileStorage to parse it
+    auto rejectText = [this]() { this->clear(); return false; };
+
+    AnnotationsTextReader reader(data, size);
+    std::string key;
+
+    if (!reader.readKey(key) || (key != _AnnotsRecord_YAMLKey_Node))
+        return rejectText();
+
+    // YAML : a block sequence of "- { ... }" entries (or an empty flow sequence) - JSON : a list of "{ ... }" entries
+    bool flowList = reader.accept('[');
+    if (json && !flowList)
+        return rejectText();
+
+    bool emptyList = flowList && reader.accept(']');
+
+    while (!emptyList)
+    {
+        if (!flowList && !reader.accept('-'))
+            break;
+
+        if (!reader.accept('{'))
+            return rejectText();
+
+        AnnotationObject annot;
+        double values[6];
+        int valuesNumber = 0;
+
+        if (!reader.accept('}'))
+        {
+            do
+            {
+                if (!reader.readKey(key) || !reader.readValues(values, valuesNumber, 6))
+                    return rejectText();
+
+                // FileStorage rounds the real values read as integers
+                if ((key == _AnnotObj_YAMLKey_Class) && (valuesNumber == 1))
+                    annot.ClassId = cvRound(values[0]);
+                else if ((key == _AnnotObj_YAMLKey_ObjId) && (valuesNumber == 1))
+                    annot.ObjectId = cvRound(values[0]);
+                else if ((key == _AnnotObj_YAMLKey_Frame) && (valuesNumber == 1))
+                    annot.FrameNumber = cvRound(values[0]);
+                else if ((key == _AnnotObj_YAMLKey_BBox) && (valuesNumber == 4))
+                    annot.BoundingBox = cv::Rect2i(cvRound(values[0]), cvRound(values[1]), cvRound(values[2]), cvRound(values[3]));
+                else if ((key == _AnnotObj_YAMLKey_Cntrd) && (valuesNumber == 2))
+                    annot.Centroid = cv::Point2i(cvRound(values[0]), cvRound(values[1]));
+                else if ((key == _AnnotObj_YAMLKey_Front) && (valuesNumber == 2))
+                    annot.Front = cv::Point2i(cvRound(values[0]), cvRound(values[1]));
+                else if ((key == _AnnotObj_YAMLKey_Moments) && (valuesNumber == 6))
+                {
+                    annot.Moments.m00 = (int64_t)values[0];
+                    annot.Moments.m10 = (int64_t)values[1];
+                    annot.Moments.m01 = (int64_t)values[2];
+                    annot.Moments.m20 = (int64_t)values[3];
+                    annot.Moments.m11 = (int64_t)values[4];
+                    annot.Moments.m02 = (int64_t)values[5];
+                }
+                else if ((key == _AnnotObj_YAMLKey_Locked) && (valuesNumber == 1))
+                    annot.locked = (cvRound(values[0]) != 0);
+                else if (key != _AnnotObj_YAMLKey_Moments)     // the moments lists of another size are ignored, as FileStorage does
+                    return rejectText();
+            }
+            while (reader.accept(','));
+
+            if (!reader.accept('}'))
+                return rejectText();
+        }
+
+        if ((annot.ClassId>=1) && (annot.ObjectId>=0) && (annot.FrameNumber>=0))   // same filter as readContentFromYaml
+            this->pushAnnotation(annot);
+
+        if (flowList && !reader.accept(','))
+        {
+            if (!reader.accept(']'))
+                return rejectText();
+            break;
+        }
+    }
+
+    endPosition = reader.getPosition();
+
+    // build all of the indices at once, rather than entry by entry
+    this->rebuildIndices();
+
+    return true;
+}
+
+
+
+// the snapshot is read straight from memory : every read is bounds checked, so that a truncated file is simply rejected
+static bool readSnapshotBytes(const char* data, size_t size, size_t& position, void* dest, size_t bytes)
+{
+    if (bytes > size-position)
+        return false;
+
+    memcpy(dest, data+position, bytes);
+    position += bytes;
+    return true;
+}
+
+static bool readSnapshotFlatIndex(const char* data, size_t size, size_t& position, vector<int>& offsets, vector<int>& ids)
+{
+    uint32_t keysNumber = 0;
+    if (!readSnapshotBytes(data, size, position, &keysNumber, sizeof(keysNumber)) || (keysNumber >= (size-position)/sizeof(int32_t)))
+        return false;
+
+    offsets.resize(keysNumber+1);
+    if (!readSnapshotBytes(data, size, position, offsets.data(), offsets.size()*sizeof(int32_t)) || (offsets[0] != 0))
+        return false;
+
+    for (uint32_t k=0; k<keysNumber; k++)
+        if (offsets[k+1] < offsets[k])
+            return false;
+
+    if ((size_t)offsets[keysNumber] > (size-position)/sizeof(int32_t))
+        return false;
+
+    ids.resize(offsets[keysNumber]);
+    return readSnapshotBytes(data, size, position, ids.data(), ids.size()*sizeof(int32_t));
+}
+
+static void writeSnapshotFlatIndex(std::ostream& fs, AnnotationsFlatIndex& index)
+{
+    vector<int> offsets, ids;
+    index.exportFlat(offsets, ids);
+
+    uint32_t keysNumber = (uint32_t)offsets.size()-1;
+    fs.write((const char*)&keysNumber, sizeof(keysNumber));
+    fs.write((const char*)offsets.data(), offsets.size()*sizeof(int32_t));
+    fs.write((const char*)ids.data(), ids.size()*sizeof(int32_t));
+}
+
+
+void AnnotationsRecord::writeSnapshotToStream(std::ostream& fs, const std::vector<AnnotationObject>& annotations)
+{
+    // rows number, classes number - then the rows, the frames index and the objects index of every class
+    // the entries are the valid ones only, hence the record ids of the snapshot are the ones of the compacted record
+    int classesNumber = 0;
+    vector<AnnotationsSnapshotRow> rows(annotations.size());
+
+    for (size_t k=0; k<annotations.size(); k++)
+    {
+        const AnnotationObject& annot = annotations[k];
+        AnnotationsSnapshotRow& row = rows[k];
+
+        row.classId = annot.ClassId;
+        row.objectId = annot.ObjectId;
+        row.frameNumber = annot.FrameNumber;
+        row.locked = annot.locked ? 1 : 0;
+        row.boundingBox[0] = annot.BoundingBox.x;
+        row.boundingBox[1] = annot.BoundingBox.y;
+        row.boundingBox[2] = annot.BoundingBox.width;
+        row.boundingBox[3] = annot.BoundingBox.height;
+        row.centroid[0] = annot.Centroid.x;
+        row.centroid[1] = annot.Centroid.y;
+        row.front[0] = annot.Front.x;
+        row.front[1] = annot.Front.y;
+
+        // the summary file only holds the moments which aren't empty
+        AnnotationMoments m = annot.Moments.isEmpty() ? AnnotationMoments() : annot.Moments;
+        row.moments[0] = m.m00;
+        row.moments[1] = m.m10;
+        row.moments[2] = m.m01;
+        row.moments[3] = m.m20;
+        row.moments[4] = m.m11;
+        row.moments[5] = m.m02;
+
+        classesNumber = QtCvUtils::getMax(classesNumber, annot.ClassId);
+    }
+
+    uint32_t counts[2] = { (uint32_t)rows.size(), (uint32_t)classesNumber };
+    fs.write((const char*)counts, sizeof(counts));
+    fs.write((const char*)rows.data(), rows.size()*sizeof(AnnotationsSnapshotRow));
+
+    // the indices are built exactly as rebuildDeferredIndices does it
+    vector<int> keys(annotations.size()), frameNumbers(annotations.size());
+    AnnotationsFlatIndex index;
+
+    for (size_t k=0; k<annotations.size(); k++)
+        keys[k] = frameNumbers[k] = annotations[k].FrameNumber;
+
+    index.assign(keys);
+    writeSnapshotFlatIndex(fs, index);
+
+    for (int c=0; c<classesNumber; c++)
+    {
+        for (size_t k=0; k<annotations.size(); k++)
+            keys[k] = (annotations[k].ClassId==c+1) ? annotations[k].ObjectId : -1;
+
+        index.assign(keys);
+        index.sortRows(frameNumbers);
+        writeSnapshotFlatIndex(fs, index);
+    }
+}
+
+
+bool AnnotationsRecord::readSnapshot(const char* data, size_t size)
+{
+    // remove all data
+    this->clear();
+
+    auto rejectSnapshot = [this]() { this->clear(); return false; };
+
+    size_t position = 0;
+    uint32_t counts[2];
+    if (!readSnapshotBytes(data, size, position, counts, sizeof(counts)) || (counts[0] > (size-position)/sizeof(AnnotationsSnapshotRow)))
+        return false;
+
+    int recordSize = (int)counts[0], classesNumber = (int)counts[1];
+
+    // the rows are spread into the columns
+    this->classIds.resize(recordSize);
+    this->objectIds.resize(recordSize);
+    this->frameNumbers.resize(recordSize);
+    this->boundingBoxes.resize(recordSize);
+    this->centroids.resize(recordSize);
+    this->fronts.resize(recordSize);
+    this->locks.resize(recordSize);
+    this->moments.resize(recordSize);
+
+    // the rows number was checked against the size of the data already
+    int maxClassId = 0;
+    AnnotationsSnapshotRow row;
+    for (int k=0; k<recordSize; k++)
+    {
+        readSnapshotBytes(data, size, position, &row, sizeof(row));
+        maxClassId = QtCvUtils::getMax(maxClassId, (int)row.classId);
+
+        if ((row.classId<1) || (row.classId>classesNumber) || (row.objectId<0) || (row.frameNumber<0))
+            return rejectSnapshot();
+
+        this->classIds[k] = row.classId;
+        this->objectIds[k] = row.objectId;
+        this->frameNumbers[k] = row.frameNumber;
+        this->locks[k] = (row.locked != 0) ? 1 : 0;
+        this->boundingBoxes[k] = cv::Rect2i(row.boundingBox[0], row.boundingBox[1], row.boundingBox[2], row.boundingBox[3]);
+        this->centroids[k] = cv::Point2i(row.centroid[0], row.centroid[1]);
+        this->fronts[k] = cv::Point2i(row.front[0], row.front[1]);
+
+        AnnotationMoments& m = this->moments[k];
+        m.m00 = row.moments[0];
+        m.m10 = row.moments[1];
+        m.m01 = row.moments[2];
+        m.m20 = row.moments[3];
+        m.m11 = row.moments[4];
+        m.m02 = row.moments[5];
+    }
+
+    if (maxClassId != classesNumber)
+        return rejectSnapshot();
+
+    // the indices are taken as they are, once verified : every id has to lie within the row of its own key, each row being strictly sorted
+    // then, as long as the indices hold as many ids as the record, none of them is missing or indexed twice
+    auto isIndexValid = [this](const vector<int>& offsets, const vector<int>& ids, int classId) -> bool {
+        for (size_t r=0; r+1<offsets.size(); r++)
+            for (int i=offsets[r]; i<offsets[r+1]; i++)
+            {
+                int id = ids[i];
+                if ((id<0) || (id>=this->getRecordSize()))
+                    return false;
+
+                if ((classId == 0) ? (this->frameNumbers[id] != (int)r) : ((this->classIds[id] != classId) || (this->objectIds[id] != (int)r)))
+                    return false;
+
+                // the frames content is sorted by id, the tracks by frame number (then by id)
+                int prevId = (i>offsets[r]) ? ids[i-1] : -1;
+                if ((prevId >= 0) && ((classId == 0) ? (prevId >= id) : ((this->frameNumbers[prevId] > this->frameNumbers[id]) || ((this->frameNumbers[prevId] == this->frameNumbers[id]) && (prevId >= id)))))
+                    return false;
+            }
+        return true; };
+
+    vector<int> offsets, ids;
+    if (!readSnapshotFlatIndex(data, size, position, offsets, ids) || ((int)ids.size() != recordSize) || !isIndexValid(offsets, ids, 0))
+        return rejectSnapshot();
+
+    this->framesIndex.importFlat(offsets, ids);
+
+    int objectsIndexSize = 0;
+    this->objectsIndex.resize(classesNumber);
+
+    for (int c=0; c<classesNumber; c++)
+    {
+        if (!readSnapshotFlatIndex(data, size, position, offsets, ids) || !isIndexValid(offsets, ids, c+1))
+            return rejectSnapshot();
+
+        objectsIndexSize += (int)ids.size();
+        this->objectsIndex[c].importFlat(offsets, ids);
+    }
+
+    if ((objectsIndexSize != recordSize) || (position != size))
+        return rejectSnapshot();
+
+    // the other indices can't be stored as they are : they're built again, which doesn't involve any sort
+    this->rebuildKeysIndex();
+    this->rebuildSpatialIndex();
+
+    return true;
+}
+
+
+
+bool AnnotationsRecord::applyJournalOp(const AnnotationsJournalOp& op)
+{
+    int annotationIndex = this->searchAnnotation(op.annot.FrameNumber, op.annot.ClassId, op.annot.ObjectId);
+
+    if (op.type == _AJO_Add)
+    {
+        if (annotationIndex == -1)
+            return (this->addNewAnnotation(op.annot) != -1);
+
+        // the entry is already there : it takes the journaled content
+        this->centroids[annotationIndex] = op.annot.Centroid;
+        this->fronts[annotationIndex] = op.annot.Front;
+        this->updateBoundingBox(annotationIndex, op.annot.BoundingBox);
+        this->updateMoments(annotationIndex, op.annot.Moments);
+        this->setObjectLock(annotationIndex, op.annot.locked);
+        return true;
+    }
+
+    if (annotationIndex == -1)
+        return false;
+
+    switch (op.type)
+    {
+    case _AJO_UpdateBox:
+        this->updateBoundingBox(annotationIndex, op.annot.BoundingBox);
+        break;
+    case _AJO_UpdateCentroidFront:
+        this->updateCentroidFront(annotationIndex, op.annot.Centroid, op.annot.Front);
+        break;
+    case _AJO_UpdateMoments:
+        this->updateMoments(annotationIndex, op.annot.Moments);
+        break;
+    case _AJO_Lock:
+        this->setObjectLock(annotationIndex, op.annot.locked);
+        break;
+    case _AJO_Remove:
+        this->removeAnnotation(annotationIndex);
+        break;
+    case _AJO_Relabel:
+        this->mergeIntraFrameAnnotationsTo(std::vector<int>(1, annotationIndex), op.newClassId, op.newObjectId);
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+
+
+void AnnotationsJournalOp::writeToStream(std::ostream& fs) const
+{
+    fs << _AnnotsJournal_OpCodes[this->type] << ' ' << this->annot.FrameNumber << ' ' << this->annot.ClassId << ' ' << this->annot.ObjectId;
+
+    const AnnotationMoments& m = this->annot.Moments;
+
+    switch (this->type)
+    {
+    case _AJO_Add:
+        fs << ' ' << this->annot.BoundingBox.x << ' ' << this->annot.BoundingBox.y << ' ' << this->annot.BoundingBox.width << ' ' << this->annot.BoundingBox.height
+           << ' ' << this->annot.Centroid.x << ' ' << this->annot.Centroid.y << ' ' << this->annot.Front.x << ' ' << this->annot.Front.y
+           << ' ' << (this->annot.locked ? 1 : 0)
+           << ' ' << m.m00 << ' ' << m.m10 << ' ' << m.m01 << ' ' << m.m20 << ' ' << m.m11 << ' ' << m.m02;
+        break;
+    case _AJO_UpdateBox:
+        fs << ' ' << this->annot.BoundingBox.x << ' ' << this->annot.BoundingBox.y << ' ' << this->annot.BoundingBox.width << ' ' << this->annot.BoundingBox.height;
+        break;
+    case _AJO_UpdateCentroidFront:
+        fs << ' ' << this->annot.Centroid.x << ' ' << this->annot.Centroid.y << ' ' << this->annot.Front.x << ' ' << this->annot.Front.y;
+        break;
+    case _AJO_UpdateMoments:
+        fs << ' ' << m.m00 << ' ' << m.m10 << ' ' << m.m01 << ' ' << m.m20 << ' ' << m.m11 << ' ' << m.m02;
+        break;
+    case _AJO_Lock:
+        fs << ' ' << (this->annot.locked ? 1 : 0);
+        break;
+    case _AJO_Relabel:
+        fs << ' ' << this->newClassId << ' ' << this->newObjectId;
+        break;
+    default:
+        break;
+    }
+
+    fs << '\n';
+}
+
+
+bool AnnotationsJournalOp::readFromString(const std::string& line)
+{
+    if (line.length()<1)
+        return false;
+
+    std::string::size_type typePos = _AnnotsJournal_OpCodes.find(line[0]);
+    if (typePos == std::string::npos)
+        return false;
+
+    *this = AnnotationsJournalOp();
+    this->type = (AnnotationsJournalOpType)typePos;
+
+    std::istringstream fs(line.substr(1));
+    fs >> this->annot.FrameNumber >> this->annot.ClassId >> this->annot.ObjectId;
+
+    AnnotationMoments& m = this->annot.Moments;
+    int locked = 0;
+
+    switch (this->type)
+    {
+    case _AJO_Add:
+        fs >> this->annot.BoundingBox.x >> this->annot.BoundingBox.y >> this->annot.BoundingBox.width >> this->annot.BoundingBox.height
+           >> this->annot.Centroid.x >> this->annot.Centroid.y >> this->annot.Front.x >> this->annot.Front.y
+           >> locked
+           >> m.m00 >> m.m10 >> m.m01 >> m.m20 >> m.m11 >> m.m02;
+        break;
+    case _AJO_UpdateBox:
+        fs >> this->annot.BoundingBox.x >> this->annot.BoundingBox.y >> this->annot.BoundingBox.width >> this->annot.BoundingBox.height;
+        break;
+    case _AJO_UpdateCentroidFront:
+        fs >> this->annot.Centroid.x >> this->annot.Centroid.y >> this->annot.Front.x >> this->annot.Front.y;
+        break;
+    case _AJO_UpdateMoments:
+        fs >> m.m00 >> m.m10 >> m.m01 >> m.m20 >> m.m11 >> m.m02;
+        break;
+    case _AJO_Lock:
+        fs >> locked;
+        break;
+    case _AJO_Relabel:
+        fs >> this->newClassId >> this->newObjectId;
+        break;
+    default:
+        break;
+    }
+
+    this->annot.locked = (locked != 0);
+
+    // a line cut by a crash misses its last values
+    return !fs.fail();
+}
+
+
+
+void AnnotationsRecord::readContentFromYaml(const cv::FileNode& fnd)
+{
+    // verify that there's a corresponding node into the file
+    if (fnd[_AnnotsRecord_YAMLKey_Node].empty())
+        return;
+
+    // remove all data
+    this->clear();
+
+    // grab the right filenode
+    FileNode nodeIt = fnd[_AnnotsRecord_YAMLKey_Node];
+
+    // start the iterator
+    FileNodeIterator it = nodeIt.begin(), it_end = nodeIt.end();
+
+    // read the data
+    for (; it != it_end; ++it)
+    {
+        AnnotationObject annot;
+        (*it) >> annot;
+
+        if (annot.ClassId<1 || annot.ObjectId<0 || annot.FrameNumber<0)   // that should be impossible?
+            continue;
+
+        this->pushAnnotation(annot);
+    }
+
+    // build all of the indices at once, rather than entry by entry
+    this->rebuildIndices();
+}
+
+
+/*
+void AnnotationsRecord::lockObject(int id)
+{
+    if (id<0 || id>=(int)this->record.size())
+        return;
+
+    this->record[id].locked = true;
+}
+
+
+
+void AnnotationsRecord::unlockObject(int id)
+{
+    if (id<0 || id>=(int)this->record.size())
+        return;
+
+    this->record[id].locked = false;
+}
+*/
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+// raw streams and keyframe flags appeared with OpenCV 4.5.2
+#if (CV_VERSION_MAJOR > 4) || ((CV_VERSION_MAJOR == 4) && ((CV_VERSION_MINOR > 5) || ((CV_VERSION_MINOR == 5) && (CV_VERSION_REVISION >= 2))))
+#define _VideoKeyframesIndex_RawStreamsAvailable
+#endif
+
+
+void VideoKeyframesIndex::clear()
+{
+    this->keyframes.clear();
+    this->timestamps.clear();
+    this->videoFileName = "";
+    this->videoFileSize = -1;
+}
+
+
+bool VideoKeyframesIndex::scanVideo(const std::string& videoFileName)
+{
+    this->clear();
+
+#ifndef _VideoKeyframesIndex_RawStreamsAvailable
+    // nothing to read the packets with
+    (void)videoFileName;
+    return false;
+#else
+    VideoCapture rawCap;
+    if (!rawCap.open(videoFileName, CAP_FFMPEG))
+        return false;
+
+    // from now on, grab() only reads the next packet - nothing is decoded
+    if (!rawCap.set(CAP_PROP_FORMAT, -1))
+        return false;
+
+    vector<double> packetsTimestamps, keyPacketsTimestamps;
+    while (rawCap.grab())
+    {
+        double timestamp = rawCap.get(CAP_PROP_POS_MSEC);
+        packetsTimestamps.push_back(timestamp);
+
+        if (rawCap.get(CAP_PROP_LRF_HAS_KEY_FRAME) != 0)
+            keyPacketsTimestamps.push_back(timestamp);
+    }
+
+    // the packets come in decoding order : the display position of a frame is the rank of its timestamp
+    std::sort(packetsTimestamps.begin(), packetsTimestamps.end());
+    std::sort(keyPacketsTimestamps.begin(), keyPacketsTimestamps.end());
+
+    // without distinct timestamps, we can't tell the frames apart
+    if (std::adjacent_find(packetsTimestamps.begin(), packetsTimestamps.end()) != packetsTimestamps.end())
+        return false;
+
+    for (size_t k=0; k<keyPacketsTimestamps.size(); k++)
+    {
+        this->keyframes.push_back( (int)(std::lower_bound(packetsTimestamps.begin(), packetsTimestamps.end(), keyPacketsTimestamps[k]) - packetsTimestamps.begin()) );
+        this->timestamps.push_back(keyPacketsTimestamps[k]);
+    }
+
+    this->videoFileName = videoFileName.substr(videoFileName.find_last_of('/')+1);
+    this->videoFileSize = getFileSize(videoFileName);
+
+    return !this->isEmpty();
+#endif
+}
+
+
+bool VideoKeyframesIndex::writeToFile(const std::string& fileName) const
+{
+    if (this->isEmpty())
+        return false;
+
+    QtCvUtils::generatePath(fileName);
+
+    FileStorage fs(fileName, FileStorage::WRITE);
+    if (!fs.isOpened())
+        return false;
+
+    fs << _VideoKeyframesIndex_YAMLKey_Node << "{";
+    fs << _VideoKeyframesIndex_YAMLKey_VideoFileName << this->videoFileName;
+    fs << _VideoKeyframesIndex_YAMLKey_VideoFileSize << std::to_string(this->videoFileSize);    // FileStorage doesn't handle 64 bits integers
+    fs << _VideoKeyframesIndex_YAMLKey_Keyframes << this->keyframes;
+    fs << _VideoKeyframesIndex_YAMLKey_Timestamps << this->timestamps;
+    fs << "}";
+
+    fs.release();
+
+    return true;
+}
+
+
+bool VideoKeyframesIndex::readFromFile(const std::string& fileName, const std::string& videoFileName)
+{
+    this->clear();
+
+    FileStorage fs(fileName, FileStorage::READ);
+    if (!fs.isOpened())
+        return false;
+
+    FileNode fnd = fs[_VideoKeyframesIndex_YAMLKey_Node];
+    if (fnd.empty())
+        return false;
+
+    // the index has to be the one of this very video
+    string storedFileName, storedFileSize;
+    fnd[_VideoKeyframesIndex_YAMLKey_VideoFileName] >> storedFileName;
+    fnd[_VideoKeyframesIndex_YAMLKey_VideoFileSize] >> storedFileSize;
+
+    long long fileSize = getFileSize(videoFileName);
+    if ((storedFileName != videoFileName.substr(videoFileName.find_last_of('/')+1)) || (storedFileSize != std::to_string(fileSize)))
+        return false;
+
+    fnd[_VideoKeyframesIndex_YAMLKey_Keyframes] >> this->keyframes;
+    fnd[_VideoKeyframesIndex_YAMLKey_Timestamps] >> this->timestamps;
+
+    if (this->isEmpty() || this->keyframes.size() != this->timestamps.size())
+    {
+        this->clear();
+        return false;
+    }
+
+    this->videoFileName = storedFileName;
+    this->videoFileSize = fileSize;
+
+    return true;
+}
+
+
+int VideoKeyframesIndex::searchPrecedingKeyframe(int frameId) const
+{
+    // the keyframes are sorted
+    return (int)(std::upper_bound(this->keyframes.begin(), this->keyframes.end(), frameId) - this->keyframes.begin()) - 1;
+}
+
+
+long long VideoKeyframesIndex::getFileSize(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return -1;
+
+    return (long long)file.tellg();
+}
+
+
+
+
+
+
+
+
+
+
+
+AnnotationsSet::AnnotationsSet()
+{
+    this->saveBehindFailures = 0;
+    this->saveBehindStopRequested = false;
+
+    this->setDefaultConfig();
+
+    this->initParamsHandler();
+}
+
+AnnotationsSet::~AnnotationsSet()
+{
+    this->stopDecodeAhead();
+    this->stopSaveBehind();
+}
+
+
+void AnnotationsSet::setDefaultConfig()
+{
+    // setting up the usual stuff...
+    this->currentImgIndex = 0;
+    this->maxImgReached = 0;
+    this->nextVideoFrame = 0;
+    this->reachedTheEndOfVideo = false;
+    this->changesPerformedUponCurrentAnnot = false;
+    this->lockTableFrame = -1;
+    this->forgetJournal();
+
+    // initialization of the frames cache
+    this->framesCacheBudgetMB = _AnnotationsSet_default_framesCacheBudgetMB;
+    this->seekPreloadedFrames = _AnnotationsSet_default_seekPreloadedFrames;
+    this->clearFramesCache();
+
+    this->decodeAheadLength = _AnnotationsSet_default_decodeAheadLength;
+    this->decodeAheadCapacity = 0;
+    this->decodeAheadNextFrame = 0;
+    this->decodeAheadPackedLabels = false;
+    this->decodeAheadStopRequested = false;
+    this->decodeAheadRunning = false;
+    this->packedLabelsEnabled = _AnnotationsSet_default_usePackedLabels;
+}
+
+
+void AnnotationsSet::initParamsHandler()
+{
+    this->parametersSectionName = "Video Frames Cache Configuration";
+
+    this->pushParam<int>("Memory Budget (MB)", &(this->framesCacheBudgetMB), "Memory used by the decoded frames and their annotations before the least recently used ones are dropped");
+    this->pushParam<int>("Preloaded Frames", &(this->seekPreloadedFrames), "Number of frames also decoded before the required one when it has to be read from the video");
+    this->pushParam<int>("Decoded Ahead Frames", &(this->decodeAheadLength), "Number of next frames prepared in the background while annotating (0 to disable)");
+}
+
+
+void AnnotationsSet::setValueCalled(const std::string& paramName)
+{
+    // a smaller budget is applied right away
+    if (paramName == "Memory Budget (MB)")
+        this->enforceFramesCacheBudget();
+
+    // the thread is started again with its new queue length on the next frame
+    if (paramName == "Decoded Ahead Frames")
+        this->stopDecodeAhead();
 }
 
 
 
+/*
+void AnnotationsSet::addClassProperty(const AnnotationsProperties& ap)
+{
+    // ad the class property - pretty simple
+    this->config.addProperty(ap);
+}
+*/
 
 
 
+const cv::Mat& AnnotationsSet::getCurrentOriginalImg() const
+{
+    return this->getOriginalImg(this->currentImgIndex);
+}
 
-void AnnotationsRecord::clear()
+const cv::Mat& AnnotationsSet::getCurrentAnnotationsClasses() const
 {
-    // simply clean all the vectors
-    this->record.clear();
-    this->objectsIndex.clear();
-    this->framesIndex.clear();
+    return this->getAnnotationsClasses(this->currentImgIndex);
 }
 
+const cv::Mat& AnnotationsSet::getCurrentAnnotationsIds() const
+{
+    return this->getAnnotationsIds(this->currentImgIndex);
+}
 
+const cv::Mat& AnnotationsSet::getCurrentContours() const
+{
+    return this->getContours(this->currentImgIndex);
+}
 
+const cv::Mat& AnnotationsSet::getCurrentContours(const cv::Rect2i& area) const
+{
+    return this->getContours(this->currentImgIndex, area);
+}
 
 
 
 
-void AnnotationsRecord::writeContentToYaml(cv::FileStorage& fs) const
+const cv::Mat& AnnotationsSet::getOriginalImg(int id) const
 {
-    fs << _AnnotsRecord_YAMLKey_Node << "[";
-    for (size_t k=0; k<this->record.size(); k++)
-    {
-        fs << this->record[k];
-    }
-    fs << "]";
+    static const Mat notCached;
+    const AnnotationsFrame* frame = this->findCachedFrame(id);
+    return (frame ? frame->originalImage : notCached);
 }
 
-void AnnotationsRecord::writeContentToCsv(std::ostream &fs) const
+const cv::Mat& AnnotationsSet::getAnnotationsClasses(int id) const
 {
-    // we just suppose that the stream is open and use it as is, without any verification
-    AnnotationObject::writeCsvHeader(fs);
-    for (size_t k=0; k<this->record.size(); k++)
-    {
-        this->record[k].writeToCsv(fs);
-    }
+    static const Mat notCached;
+    const AnnotationsFrame* frame = this->findCachedFrame(id);
+    if (!frame)
+        return notCached;
+
+    frame->unpackLabels();
+    return frame->classes;
 }
 
+const cv::Mat& AnnotationsSet::getAnnotationsIds(int id) const
+{
+    static const Mat notCached;
+    const AnnotationsFrame* frame = this->findCachedFrame(id);
+    if (!frame)
+        return notCached;
 
+    frame->unpackLabels();
+    return frame->ids;
+}
 
-void AnnotationsRecord::readContentFromYaml(const cv::FileNode& fnd)
+const cv::Mat& AnnotationsSet::getContours(int id) const
 {
-    // verify that there's a corresponding node into the file
-    if (fnd[_AnnotsRecord_YAMLKey_Node].empty())
-        return;
+    return this->getContours(id, Rect2i(0, 0, INT_MAX, INT_MAX));
+}
 
-    // remove all data
-    this->clear();
+const cv::Mat& AnnotationsSet::getContours(int id, const cv::Rect2i& area) const
+{
+    static const Mat notCached;
+    const AnnotationsFrame* frame = this->findCachedFrame(id);
+    if (!frame)
+        return notCached;
 
-    // grab the right filenode
-    FileNode nodeIt = fnd[_AnnotsRecord_YAMLKey_Node];
+    // the dirty tiles are computed when they're needed
+    refreshContours(*frame, area);
 
-    // start the iterator
-    FileNodeIterator it = nodeIt.begin(), it_end = nodeIt.end();
+    return frame->contours;
+}
 
-    // read the data
-    int idx = 0;
-    for (; it != it_end; ++it, idx++)
-    {
-        AnnotationObject annot;
-        (*it) >> annot;
+const cv::Mat& AnnotationsSet::getCurrentAnnotationsLabels() const
+{
+    return this->getAnnotationsLabels(this->currentImgIndex);
+}
+
+const cv::Mat& AnnotationsSet::getAnnotationsLabels(int id) const
+{
+    static const Mat notCached;
+    const AnnotationsFrame* frame = this->findCachedFrame(id);
+    return (frame ? frame->labels : notCached);
+}
 
-        if (annot.ClassId==0)   // that should be impossible?
-            continue;
 
-        this->record.push_back(annot);
 
-        // filling the framesIndex matrix if needed with empty vectors
-        while((int)this->framesIndex.size()<=annot.FrameNumber)
-            this->framesIndex.push_back(vector<int>());
 
-        // recording the index into the frames record
-        this->framesIndex[annot.FrameNumber].push_back(idx);
 
-        // filling the class matrix with empty vectors if needed
-        while((int)this->objectsIndex.size()<annot.ClassId)
-            this->objectsIndex.push_back(vector< vector<int> >());
+size_t AnnotationsFrame::getBytesNumber() const
+{
+    const Mat* planes[] = {&this->originalImage, &this->classes, &this->ids, &this->contours, &this->labels};
 
-        // now the corresponding objects index...
-        while((int)this->objectsIndex[annot.ClassId-1].size()<=annot.ObjectId)
-            this->objectsIndex[annot.ClassId-1].push_back(vector<int>());
+    size_t bytesNumber = 0;
+    for (const Mat* plane: planes)
+        bytesNumber += plane->total() * plane->elemSize();
 
-        // finally, storing the index into the objects record...
-        this->objectsIndex[annot.ClassId-1][annot.ObjectId].push_back(idx);
-    }
+    for (const auto& objectOccupancy: this->occupancy)
+        bytesNumber += (objectOccupancy.second.rowsCount.size() + objectOccupancy.second.colsCount.size()) * sizeof(int);
+
+    return bytesNumber;
 }
 
 
-/*
-void AnnotationsRecord::lockObject(int id)
+void AnnotationsFrame::release()
 {
-    if (id<0 || id>=(int)this->record.size())
-        return;
-
-    this->record[id].locked = true;
+    this->originalImage.release();
+    this->classes.release();
+    this->ids.release();
+    this->contours.release();
+    this->labels.release();
+    this->dirtyContoursTiles.clear();
+    this->contoursDirty = false;
+    this->occupancy.clear();
+    this->dirty = false;
 }
 
 
-
-void AnnotationsRecord::unlockObject(int id)
+void AnnotationsFrame::resetAnnotationsPlanes(bool packed)
 {
-    if (id<0 || id>=(int)this->record.size())
-        return;
+    // create() doesn't reallocate anything when the size and type are already right
+    if (packed)
+    {
+        this->labels.create(this->getSize(), CV_32SC1);
+        this->labels.setTo(0);
+        this->classes.release();
+        this->ids.release();
+    }
+    else
+    {
+        this->classes.create(this->getSize(), CV_16SC1);
+        this->classes.setTo(0);
+        this->ids.create(this->getSize(), CV_32SC1);
+        this->ids.setTo(0);
+        this->labels.release();
+    }
 
-    this->record[id].locked = false;
+    this->occupancy.clear();
 }
-*/
 
 
+bool AnnotationsFrame::storeAnnotationsPlanes(const cv::Mat& classesMat, const cv::Mat& objIdsMat, bool packed)
+{
+    // the planes have been rewritten as a whole
+    this->occupancy.clear();
+
+    if (!packed)
+    {
+        classesMat.copyTo(this->classes);
+        objIdsMat.copyTo(this->ids);
+        this->labels.release();
+        return true;
+    }
 
+    if (!joinLabels(classesMat, objIdsMat, this->labels))
+        return false;
 
+    this->classes.release();
+    this->ids.release();
+    return true;
+}
 
 
+void AnnotationsFrame::unpackLabels() const
+{
+    if (this->isPacked() && !this->classes.data)
+        splitLabels(this->labels, this->classes, this->ids);
+}
 
 
+void AnnotationsFrame::copyAnnotationsPlanesTo(cv::Mat& classesMat, cv::Mat& objIdsMat) const
+{
+    if (this->isPacked())
+        splitLabels(this->labels, classesMat, objIdsMat);
+    else
+    {
+        this->classes.copyTo(classesMat);
+        this->ids.copyTo(objIdsMat);
+    }
+}
 
 
+void AnnotationsFrame::getPixelAnnotation(int i, int j, int& classId, int& objectId) const
+{
+    if (this->isPacked())
+    {
+        int32_t label = this->labels.at<int32_t>(i,j);
+        classId = AnnotationsSet::unpackLabelClass(label);
+        objectId = AnnotationsSet::unpackLabelObject(label);
+    }
+    else
+    {
+        classId = this->classes.at<int16_t>(i,j);
+        objectId = this->ids.at<int32_t>(i,j);
+    }
+}
 
 
+bool AnnotationsFrame::joinLabels(const cv::Mat& classesMat, const cv::Mat& objIdsMat, cv::Mat& labelsMat)
+{
+    // verify that every value fits into the packed labels
+    double minClass, maxClass, minObjId, maxObjId;
+    minMaxLoc(classesMat, &minClass, &maxClass);
+    minMaxLoc(objIdsMat, &minObjId, &maxObjId);
 
+    if (minClass<0 || maxClass>_AnnotationsSet_labelsMaxClassId || minObjId<0 || maxObjId>_AnnotationsSet_labelsMaxObjectId)
+        return false;
 
+    // the bits don't overlap : (class << shift) | id is the same as class * 2^shift + id
+    classesMat.convertTo(labelsMat, CV_32S, (double)(1 << _AnnotationsSet_labelsClassShift));
+    labelsMat += objIdsMat;
 
-AnnotationsSet::AnnotationsSet()
-{
-    this->setDefaultConfig();
+    return true;
 }
 
-AnnotationsSet::~AnnotationsSet()
+
+void AnnotationsFrame::splitLabels(const cv::Mat& labelsMat, cv::Mat& classesMat, cv::Mat& objIdsMat)
 {
+    classesMat.create(labelsMat.size(), CV_16SC1);
+    objIdsMat.create(labelsMat.size(), CV_32SC1);
+
+    for (int i=0; i<labelsMat.rows; i++)
+    {
+        const int32_t* labelsRow = labelsMat.ptr<int32_t>(i);
+        int16_t* classesRow = classesMat.ptr<int16_t>(i);
+        int32_t* idsRow = objIdsMat.ptr<int32_t>(i);
 
+        for (int j=0; j<labelsMat.cols; j++)
+        {
+            classesRow[j] = (int16_t)AnnotationsSet::unpackLabelClass(labelsRow[j]);
+            idsRow[j] = AnnotationsSet::unpackLabelObject(labelsRow[j]);
+        }
+    }
 }
 
 
-void AnnotationsSet::setDefaultConfig()
-{
-    // setting up the usual stuff...
-    this->currentImgIndex = 0;
-    this->bufferLength = _AnnotationsSet_default_bufferLength;
-    this->changesPerformedUponCurrentAnnot = false;
 
-    // initialization of the buffer
-    this->originalImagesBuffer = vector<Mat>(this->bufferLength, Mat());
-    this->annotationsClassesBuffer = vector<Mat>(this->bufferLength, Mat());
-    this->annotationsIdsBuffer = vector<Mat>(this->bufferLength, Mat());
-    this->annotationsContoursBuffer = vector<Mat>(this->bufferLength, Mat());
-}
 
 
-/*
-void AnnotationsSet::addClassProperty(const AnnotationsProperties& ap)
+const AnnotationsFrame* AnnotationsSet::findCachedFrame(int frameId) const
 {
-    // ad the class property - pretty simple
-    this->config.addProperty(ap);
-}
-*/
+    if (this->lastFoundFrame && this->lastFoundFrameId == frameId)
+        return this->lastFoundFrame;
 
+    auto search = this->framesCache.find(frameId);
+    if (search == this->framesCache.end())
+        return NULL;
 
+    // the cache is node based : the pointer stays valid until this very frame is evicted
+    this->lastFoundFrameId = frameId;
+    this->lastFoundFrame = &(search->second);
 
-const cv::Mat& AnnotationsSet::getCurrentOriginalImg() const
-{
-    return this->getOriginalImg(this->currentImgIndex);
+    return this->lastFoundFrame;
 }
 
-const cv::Mat& AnnotationsSet::getCurrentAnnotationsClasses() const
+
+AnnotationsFrame& AnnotationsSet::storeFrameIntoCache(int frameId, const cv::Mat& im)
 {
-    return this->getAnnotationsClasses(this->currentImgIndex);
+    AnnotationsFrame* frame = this->accessCachedFrame(frameId);
+
+    if (frame)
+        this->touchCachedFrame(frameId);
+    else
+    {
+        // take back the allocations of an evicted frame if there's one
+        AnnotationsFrame newFrame;
+        if (this->recycledFrames.size()>0)
+        {
+            newFrame = this->recycledFrames.back();
+            this->recycledFrames.pop_back();
+        }
+
+        this->framesUseOrder.push_front(frameId);
+        newFrame.usePosition = this->framesUseOrder.begin();
+        frame = &(this->framesCache[frameId] = newFrame);
+    }
+
+    // create() and copyTo() don't reallocate anything when the size and type are already right
+    im.copyTo(frame->originalImage);
+    frame->resetAnnotationsPlanes(this->packedLabelsEnabled);
+    frame->contours.create(im.size(), CV_8UC1);
+    frame->contours.setTo(0);
+    frame->dirtyContoursTiles.assign(frame->dirtyContoursTiles.size(), 0);
+    frame->contoursDirty = false;
+    frame->dirty = false;
+
+    this->enforceFramesCacheBudget();
+
+    return *frame;
 }
 
-const cv::Mat& AnnotationsSet::getCurrentAnnotationsIds() const
+
+void AnnotationsSet::touchCachedFrame(int frameId)
 {
-    return this->getAnnotationsIds(this->currentImgIndex);
+    AnnotationsFrame* frame = this->accessCachedFrame(frameId);
+    if (frame)
+        this->framesUseOrder.splice(this->framesUseOrder.begin(), this->framesUseOrder, frame->usePosition);
 }
 
-const cv::Mat& AnnotationsSet::getCurrentContours() const
+
+void AnnotationsSet::evictCachedFrame(int frameId)
 {
-    return this->getContours(this->currentImgIndex);
-}
+    auto search = this->framesCache.find(frameId);
+    if (search == this->framesCache.end())
+        return;
 
+    AnnotationsFrame& frame = search->second;
 
+    // never lose any annotation
+    if (frame.dirty)
+        this->saveAnnotationImage(frameId);
 
+    this->framesUseOrder.erase(frame.usePosition);
 
-const cv::Mat& AnnotationsSet::getOriginalImg(int id) const
-{
-    return this->originalImagesBuffer[id % this->bufferLength];
-}
+    // keep the allocations aside for the next decoded frames
+    if (this->recycledFrames.size()<_AnnotationsSet_default_recycledFramesNumber)
+        this->recycledFrames.push_back(frame);
 
-const cv::Mat& AnnotationsSet::getAnnotationsClasses(int id) const
-{
-    return this->annotationsClassesBuffer[id % this->bufferLength];
+    this->framesCache.erase(search);
+
+    if (this->lastFoundFrameId == frameId)
+        this->lastFoundFrame = NULL;
 }
 
-const cv::Mat& AnnotationsSet::getAnnotationsIds(int id) const
+
+void AnnotationsSet::enforceFramesCacheBudget()
 {
-    return this->annotationsIdsBuffer[id % this->bufferLength];
+    size_t budget = (size_t)std::max(this->framesCacheBudgetMB, 0) * 1024 * 1024;
+    size_t usedBytes = this->getFramesCacheBytes();
+
+    // start from the least recently used frame. The most recently used one always stays, as well as the current one
+    std::list<int>::iterator candidate = this->framesUseOrder.end();
+    while (usedBytes>budget && candidate != this->framesUseOrder.begin())
+    {
+        candidate--;
+
+        int frameId = *candidate;
+        if (frameId == this->currentImgIndex || candidate == this->framesUseOrder.begin())
+            continue;
+
+        // the iterator is about to be invalidated
+        std::list<int>::iterator next = candidate;
+        next++;
+
+        usedBytes -= this->findCachedFrame(frameId)->getBytesNumber();
+        this->evictCachedFrame(frameId);
+
+        candidate = next;
+    }
 }
 
-const cv::Mat& AnnotationsSet::getContours(int id) const
+
+void AnnotationsSet::clearFramesCache()
 {
-    return this->annotationsContoursBuffer[id % this->bufferLength];
+    this->framesCache.clear();
+    this->framesUseOrder.clear();
+    this->recycledFrames.clear();
+    this->lastFoundFrameId = -1;
+    this->lastFoundFrame = NULL;
 }
 
 
+size_t AnnotationsSet::getFramesCacheBytes() const
+{
+    size_t bytesNumber = 0;
+    for (auto it = this->framesCache.begin(); it != this->framesCache.end(); it++)
+        bytesNumber += it->second.getBytesNumber();
+
+    return bytesNumber;
+}
 
 
 
 int AnnotationsSet::getObjectIdAtPosition(int x, int y) const
 {
-    if (AnnotationUtilities::isThisPointWithinImageBoundaries(cv::Point2i(x,y), this->getCurrentOriginalImg()))
+    const AnnotationsFrame* frame = this->findCachedFrame(this->currentImgIndex);
+    if (frame && AnnotationUtilities::isThisPointWithinImageBoundaries(cv::Point2i(x,y), frame->originalImage))
     {
-        int classId = this->getCurrentAnnotationsClasses().at<int16_t>(y,x);
-        int objectId = this->getCurrentAnnotationsIds().at<int32_t>(y,x);
+        int classId, objectId;
+        frame->getPixelAnnotation(y, x, classId, objectId);
 
         return this->annotsRecord.searchAnnotation(this->currentImgIndex, classId, objectId);
     }
@@ -867,20 +2892,24 @@ int AnnotationsSet::getClosestBBFromPosition(int x, int y, int searchingWindowRa
 {
     // find the closest Bounding Box from the Bounding Box Only objects
 
-    const vector<int>& listObjects = this->annotsRecord.getFrameContentIds(this->currentImgIndex);
-    // look for the current frame objects
+    const vector<int> listObjects = this->annotsRecord.getFrameContentIdsWithin(this->currentImgIndex, Rect2i(x-searchingWindowRadius, y-searchingWindowRadius, 2*searchingWindowRadius+1, 2*searchingWindowRadius+1));
+    // look for the current frame objects which bounding box may be within the searching window
+
+    // only the class ids and the bounding boxes are needed here, read them from their columns
+    const vector<int>& classIds = this->annotsRecord.getClassIdsColumn();
+    const vector<Rect2i>& boundingBoxes = this->annotsRecord.getBoundingBoxesColumn();
 
     int minDist = searchingWindowRadius + 1;
     int foundId = -1;
 
     for (size_t k=0; k<listObjects.size(); k++)
     {
-        if (this->config.getProperty(this->annotsRecord.getAnnotationById(listObjects[k]).ClassId).classType != _ACT_BoundingBoxOnly)
+        if (this->config.getProperty(classIds[listObjects[k]]).classType != _ACT_BoundingBoxOnly)
             // we care only about BB only classes in this situation
             continue;
 
         // find the distance between the bounding box and the object
-        const Rect2i& currBB = this->annotsRecord.getAnnotationById(listObjects[k]).BoundingBox;
+        const Rect2i& currBB = boundingBoxes[listObjects[k]];
 
         // min distance to a vertical and a horizontal line
         int minDistH = (abs(currBB.tl().x-x) < abs(currBB.br().x-1-x)) ? abs(currBB.tl().x-x) : abs(currBB.br().x-1-x);
@@ -918,21 +2947,26 @@ int AnnotationsSet::getClosestCFFromPosition(int x, int y, int searchingWindowRa
 {
     // find the closest Centroid-Front object from the CF Only objects
 
-    const vector<int>& listObjects = this->annotsRecord.getFrameContentIds(this->currentImgIndex);
-    // look for the current frame objects
+    const vector<int> listObjects = this->annotsRecord.getFrameContentIdsWithin(this->currentImgIndex, Rect2i(x-searchingWindowRadius, y-searchingWindowRadius, 2*searchingWindowRadius+1, 2*searchingWindowRadius+1));
+    // look for the current frame objects which centroid or front may be within the searching window
+
+    // only the class ids, centroids and fronts are needed here, read them from their columns
+    const vector<int>& classIds = this->annotsRecord.getClassIdsColumn();
+    const vector<Point2i>& centroids = this->annotsRecord.getCentroidsColumn();
+    const vector<Point2i>& fronts = this->annotsRecord.getFrontsColumn();
 
     int minDist = searchingWindowRadius + 1;
     int foundId = -1;
 
     for (size_t k=0; k<listObjects.size(); k++)
     {
-        if (this->config.getProperty(this->annotsRecord.getAnnotationById(listObjects[k]).ClassId).classType != _ACT_CentroidFrontOnly)
+        if (this->config.getProperty(classIds[listObjects[k]]).classType != _ACT_CentroidFrontOnly)
             // we care only about CF only classes in this situation
             continue;
 
         // find the distance between the bounding box and the object
-        const Point2i& currCt = this->annotsRecord.getAnnotationById(listObjects[k]).Centroid;
-        const Point2i& currFt = this->annotsRecord.getAnnotationById(listObjects[k]).Front;
+        const Point2i& currCt = centroids[listObjects[k]];
+        const Point2i& currFt = fronts[listObjects[k]];
 
         // min distance to a vertical and a horizontal line
         int minDistCtX = abs(currCt.x-x);
@@ -949,43 +2983,256 @@ int AnnotationsSet::getClosestCFFromPosition(int x, int y, int searchingWindowRa
         int minDistCt = (minDistCtX<minDistCtY) ? minDistCtX : minDistCtY;
         int minDistFt = (minDistFtX<minDistFtY) ? minDistFtX : minDistFtY;
 
-        // only keep the smallest amongst them
-        int minDistHandV = (minDistCt < minDistFt) ? minDistCt : minDistFt;
+        // only keep the smallest amongst them
+        int minDistHandV = (minDistCt < minDistFt) ? minDistCt : minDistFt;
+
+        // found the closest possible object - update
+        if (minDistHandV < minDist)
+        {
+            foundId = listObjects[k];
+            minDist = minDistHandV;
+        }
+    }
+
+    return foundId;
+}
+
+
+
+
+
+
+
+
+
+
+
+cv::Rect2i AnnotationsSet::applyMaskToCurrentFrame(const cv::Mat& mask, const cv::Point2i& topLeftCorner, int classId, int objectId,
+                                                   std::vector<cv::Point2i>& affectedObjectsList, std::vector<cv::Rect2i>& affectedObjectsBBs,
+                                                   std::vector<AnnotationMoments>& removedPixelsMoments, AnnotationMoments& writtenPixelsMoments)
+{
+    AnnotationsFrame* frame = this->accessCachedFrame(this->currentImgIndex);
+    if (!frame || !frame->originalImage.data || !mask.data)
+        return Rect2i();
+
+    // only the part of the mask which lies within the image is used
+    Rect2i imageArea = Rect2i(topLeftCorner, mask.size()) & Rect2i(Point2i(0,0), frame->getSize());
+    if (imageArea.area() <= 0)
+        return Rect2i();
+
+    Rect2i maskArea = Rect2i(imageArea.tl() - topLeftCorner, imageArea.size());
+
+    // the pixels which are actually written - the locked objects keep theirs
+    Mat writtenMask = mask(maskArea) != 0;
+
+
+    // first pass : a histogram of the overwritten objects, along with their bounding boxes
+    // the locks are looked up once per object. Slots : -2 = locked, -1 = the object we're writing, anything else = index within the affected objects
+    std::unordered_map<int64_t, int> overwrittenObjects;
+    std::vector<Vec4i> overwrittenBounds;   // left, top, right, bottom - all inclusive
+
+    // the occupancy histograms are updated along, for the objects which have some
+    std::vector<AnnotationsOccupancy*> overwrittenOccupancies;
+    AnnotationsOccupancy* writtenOccupancy = NULL;
+    if (classId != _AnnotationsSet_default_classNoneValue)
+    {
+        auto foundOccupancy = frame->occupancy.find(((int64_t)classId << 32) | (uint32_t)objectId);
+        if (foundOccupancy != frame->occupancy.end())
+            writtenOccupancy = &foundOccupancy->second;
+    }
+
+    int64_t lastKey = -1;
+    int lastSlot = -1;
+
+    bool packed = frame->isPacked();
+
+    for (int i=0; i<imageArea.height; i++)
+    {
+        uchar* maskRow = writtenMask.ptr<uchar>(i);
+        const int32_t* labelsRow = packed ? frame->labels.ptr<int32_t>(i+imageArea.y) + imageArea.x : NULL;
+        const int16_t* classesRow = packed ? NULL : frame->classes.ptr<int16_t>(i+imageArea.y) + imageArea.x;
+        const int32_t* idsRow = packed ? NULL : frame->ids.ptr<int32_t>(i+imageArea.y) + imageArea.x;
+
+        for (int j=0; j<imageArea.width; j++)
+        {
+            if (!maskRow[j])
+                continue;
+
+            int pixelClass = packed ? unpackLabelClass(labelsRow[j]) : classesRow[j];
+            int pixelId = packed ? unpackLabelObject(labelsRow[j]) : idsRow[j];
+
+            if (pixelClass == _AnnotationsSet_default_classNoneValue)
+            {
+                writtenPixelsMoments.addPixel(j+imageArea.x, i+imageArea.y);
+
+                if (writtenOccupancy)
+                {
+                    writtenOccupancy->rowsCount[i+imageArea.y]++;
+                    writtenOccupancy->colsCount[j+imageArea.x]++;
+                }
+                continue;
+            }
+
+            // consecutive pixels mostly belong to the same object
+            int64_t key = ((int64_t)pixelClass << 32) | (uint32_t)pixelId;
+            if (key != lastKey)
+            {
+                auto foundObject = overwrittenObjects.find(key);
+                if (foundObject == overwrittenObjects.end())
+                {
+                    int slot;
+                    if (this->isAnnotLockedOnCurrentFrame(pixelClass, pixelId))
+                        // the object or the class is locked - avoid
+                        slot = -2;
+                    else if (pixelClass == classId && pixelId == objectId)
+                        slot = -1;
+                    else
+                    {
+                        slot = (int)affectedObjectsList.size();
+                        affectedObjectsList.push_back(Point2i(pixelClass, pixelId));
+                        overwrittenBounds.push_back(Vec4i(j, i, j, i));
+                        removedPixelsMoments.push_back(AnnotationMoments());
+
+                        auto foundOccupancy = frame->occupancy.find(key);
+                        overwrittenOccupancies.push_back(foundOccupancy != frame->occupancy.end() ? &foundOccupancy->second : NULL);
+                    }
+
+                    foundObject = overwrittenObjects.emplace(key, slot).first;
+                }
+
+                lastKey = key;
+                lastSlot = foundObject->second;
+            }
+
+            if (lastSlot == -2)
+                maskRow[j] = 0;
+            else if (lastSlot >= 0)
+            {
+                Vec4i& bounds = overwrittenBounds[lastSlot];
+                bounds[0] = std::min(bounds[0], j);
+                bounds[2] = std::max(bounds[2], j);
+                bounds[3] = i;  // rows are visited in order
+
+                // the pixel moves from one object to the other
+                removedPixelsMoments[lastSlot].addPixel(j+imageArea.x, i+imageArea.y);
+                writtenPixelsMoments.addPixel(j+imageArea.x, i+imageArea.y);
+
+                if (overwrittenOccupancies[lastSlot])
+                {
+                    overwrittenOccupancies[lastSlot]->rowsCount[i+imageArea.y]--;
+                    overwrittenOccupancies[lastSlot]->colsCount[j+imageArea.x]--;
+                }
+
+                if (writtenOccupancy)
+                {
+                    writtenOccupancy->rowsCount[i+imageArea.y]++;
+                    writtenOccupancy->colsCount[j+imageArea.x]++;
+                }
+            }
+        }
+    }
+
+    for (const Vec4i& bounds: overwrittenBounds)
+        affectedObjectsBBs.push_back( Rect2i(Point2i(bounds[0], bounds[1]) + imageArea.tl(), Point2i(bounds[2]+1, bounds[3]+1) + imageArea.tl()) );
+
+
+    // second pass : masked copy of the values into the annotations planes - a single one when the labels are packed
+    if (packed && !canPackLabel(classId, objectId))
+        this->disablePackedLabels();
 
-        // found the closest possible object - update
-        if (minDistHandV < minDist)
-        {
-            foundId = listObjects[k];
-            minDist = minDistHandV;
-        }
+    if (frame->isPacked())
+    {
+        frame->labels(imageArea).setTo(packLabel(classId, objectId), writtenMask);
+        frame->dropUnpackedPlanes();
+    }
+    else
+    {
+        frame->classes(imageArea).setTo(classId, writtenMask);
+        frame->ids(imageArea).setTo(objectId, writtenMask);
     }
+    frame->dirty = true;
 
-    return foundId;
-}
 
+    // the bounds of the written pixels, from the row and column projections of the mask
+    Mat rowsProjection, colsProjection;
+    cv::reduce(writtenMask, rowsProjection, 1, REDUCE_MAX);
+    cv::reduce(writtenMask, colsProjection, 0, REDUCE_MAX);
 
+    Rect2i rowsBounds = cv::boundingRect(rowsProjection);
+    Rect2i colsBounds = cv::boundingRect(colsProjection);
+    if (rowsBounds.area() <= 0)
+        return Rect2i();
+
+    return Rect2i(imageArea.x + colsBounds.x, imageArea.y + rowsBounds.y, colsBounds.width, rowsBounds.height);
+}
 
 
 
+bool AnnotationsSet::isAnnotLockedOnCurrentFrame(int classId, int objId) const
+{
+    if (this->lockTableFrame != this->currentImgIndex)
+        this->buildLockTable();
 
+    if (classId>=0 && classId<(int)this->lockedClasses.size() && this->lockedClasses[classId])
+        return true;
 
+    // most of the time, nothing is locked
+    if (this->lockedObjects.empty())
+        return false;
 
+    return (this->lockedObjects.count(((int64_t)classId << 32) | (uint32_t)objId) != 0);
+}
 
 
 
-cv::Mat& AnnotationsSet::accessCurrentAnnotationsClasses()
+void AnnotationsSet::buildLockTable() const
 {
-    return this->annotationsClassesBuffer[this->currentImgIndex % this->bufferLength];
+    // class locks
+    this->lockedClasses.assign(this->config.getPropsNumber()+1, 0);
+    for (int k=1; k<=this->config.getPropsNumber(); k++)
+        this->lockedClasses[k] = this->config.getProperty(k).locked ? 1 : 0;
+
+    // locked objects of the current frame
+    this->lockedObjects.clear();
+    for (int id: this->annotsRecord.getFrameContentIds(this->currentImgIndex))
+    {
+        if (this->annotsRecord.isAnnotationLocked(id))
+            this->lockedObjects.insert(((int64_t)this->annotsRecord.getClassIdsColumn()[id] << 32) | (uint32_t)this->annotsRecord.getObjectIdsColumn()[id]);
+    }
+
+    this->lockTableFrame = this->currentImgIndex;
 }
 
-cv::Mat& AnnotationsSet::accessCurrentAnnotationsIds()
+
+
+void AnnotationsSet::storeFrameAnnotationsPlanes(int frameId, const cv::Mat& classesMat, const cv::Mat& objIdsMat)
 {
-    return this->annotationsIdsBuffer[this->currentImgIndex % this->bufferLength];
+    AnnotationsFrame* frame = this->accessCachedFrame(frameId);
+    if (!frame)
+        return;
+
+    if (!frame->storeAnnotationsPlanes(classesMat, objIdsMat, this->packedLabelsEnabled))
+    {
+        // some value doesn't fit into the packed labels
+        this->disablePackedLabels();
+        frame->storeAnnotationsPlanes(classesMat, objIdsMat, false);
+    }
 }
 
-cv::Mat& AnnotationsSet::accessCurrentContours()
+
+
+void AnnotationsSet::disablePackedLabels()
 {
-    return this->annotationsContoursBuffer[this->currentImgIndex % this->bufferLength];
+    // until the next opened file
+    this->packedLabelsEnabled = false;
+
+    for (auto it = this->framesCache.begin(); it != this->framesCache.end(); it++)
+    {
+        it->second.unpackLabels();
+        it->second.labels.release();
+    }
+    for (size_t k=0; k<this->recycledFrames.size(); k++)
+        this->recycledFrames[k].labels.release();
 }
 
 
@@ -1006,6 +3253,11 @@ bool AnnotationsSet::loadOriginalImage(const std::string& imgFileName)
     // load the file
     Mat im = imread(imgFileName);
 
+    this->stopDecodeAhead();
+
+    // a new file : its whole record is saved first
+    this->forgetJournal();
+
     // couldn't read the file?
     if (!im.data)
         return false;
@@ -1022,24 +3274,20 @@ bool AnnotationsSet::loadOriginalImage(const std::string& imgFileName)
     this->currentImgIndex = 0;
     this->maxImgReached = 0;
 
-    for (size_t k=0; k<this->originalImagesBuffer.size(); k++)
-    {
-        this->originalImagesBuffer[k].release();
-        this->annotationsClassesBuffer[k].release();
-        this->annotationsIdsBuffer[k].release();
-        this->annotationsContoursBuffer[k].release();
-    }
+    this->clearFramesCache();
+    this->keyframesIndex.clear();
+
+    // a new file gives the packed labels a new chance
+    this->packedLabelsEnabled = _AnnotationsSet_default_usePackedLabels;
 
     // then fill the data correctly
-    im.copyTo(this->originalImagesBuffer[0]);
-    this->annotationsClassesBuffer[0] = Mat::zeros(im.size(), CV_16SC1);
-    this->annotationsIdsBuffer[0] = Mat::zeros(im.size(), CV_32SC1);
-    this->annotationsContoursBuffer[0] = Mat::zeros(im.size(), CV_8UC1);
+    this->storeFrameIntoCache(0, im);
 
     // try to load a previously recorded annotation, if it exists
     // if (this->loadCurrentAnnotationImage())
         // cout << "we were able to load a previous annotation" << endl;
     this->loadCurrentAnnotationImage();
+    this->accessCachedFrame(0)->dirty = false;
 
     // we have loaded a new frame - specify that nothing's changed
     this->changesPerformedUponCurrentAnnot = false;
@@ -1051,8 +3299,12 @@ bool AnnotationsSet::loadOriginalImage(const std::string& imgFileName)
 
 bool AnnotationsSet::loadOriginalVideo(const std::string& videoFileName)
 {
+    this->stopDecodeAhead();
     this->vidCap.release();
 
+    // a new file : its whole record is saved first
+    this->forgetJournal();
+
     if (!this->vidCap.open(videoFileName))
         return false;
 
@@ -1071,28 +3323,31 @@ bool AnnotationsSet::loadOriginalVideo(const std::string& videoFileName)
     this->videoFileName = videoFileName.substr(slashPos+1);
     this->imageFileName = "";
 
+    // the keyframes index is scanned only once per video
+    if (!this->keyframesIndex.readFromFile(this->getKeyframesIndexFileName(), videoFileName))
+    {
+        if (this->keyframesIndex.scanVideo(videoFileName))
+            this->keyframesIndex.writeToFile(this->getKeyframesIndexFileName());
+    }
+
     // init (back?) all the buffers
     this->currentImgIndex = 0;
     this->maxImgReached = 0;
+    this->nextVideoFrame = 1;
 
-    for (size_t k=0; k<this->originalImagesBuffer.size(); k++)
-    {
-        this->originalImagesBuffer[k].release();
-        this->annotationsClassesBuffer[k].release();
-        this->annotationsIdsBuffer[k].release();
-        this->annotationsContoursBuffer[k].release();
-    }
+    this->clearFramesCache();
+
+    // a new file gives the packed labels a new chance
+    this->packedLabelsEnabled = _AnnotationsSet_default_usePackedLabels;
 
     // then fill the data correctly
-    im.copyTo(this->originalImagesBuffer[0]);
-    this->annotationsClassesBuffer[0] = Mat::zeros(im.size(), CV_16SC1);
-    this->annotationsIdsBuffer[0] = Mat::zeros(im.size(), CV_32SC1);
-    this->annotationsContoursBuffer[0] = Mat::zeros(im.size(), CV_8UC1);
+    this->storeFrameIntoCache(0, im);
 
     // try to load a previously recorded annotation, if it exists
     //if (this->loadCurrentAnnotationImage())
     //    cout << "we were able to load a previous annotation" << endl;
     this->loadCurrentAnnotationImage();
+    this->accessCachedFrame(0)->dirty = false;
 
     // we have loaded a new frame - specify that nothing's changed
     this->changesPerformedUponCurrentAnnot = false;
@@ -1111,144 +3366,543 @@ bool AnnotationsSet::loadNextFrame()
     // save what we were doing until now
     this->saveCurrentState("", true);
 
+    // the removed entries are not part of the saved record anymore. We get rid of them now since the GUI
+    // searches again the objects it refers to when changing frame - this is the only place where ids may be renumbered
+    this->annotsRecord.compact();
+
+    // verify that we're indeed reading a video
+    if (!this->vidCap.isOpened())
+        return false;
+
+    // verify where we're at regarding the cache
+    DecodedAheadFrame decoded;
+    if (this->isFrameCached(this->currentImgIndex+1))
+    {
+        // the frame is still in memory
+        this->currentImgIndex++;
+        this->touchCachedFrame(this->currentImgIndex);
+    }
+    else if (this->takeDecodedAheadFrame(this->currentImgIndex+1, decoded))
+        this->storeDecodedAheadFrame(decoded);
+    else if (!this->loadVideoFrame(this->currentImgIndex+1))
+        return false;
+
+    // keep preparing the next ones
+    this->startDecodeAhead();
+
+    // we have loaded a new frame - specify that nothing's changed
+    this->changesPerformedUponCurrentAnnot = false;
+
+    return true;
+}
+
+
+
+
+
+bool AnnotationsSet::loadFrame(int fId)
+{
+    // save what we were doing until now
+    this->saveCurrentState("", true);
+
+    // the removed entries are not part of the saved record anymore. We get rid of them now since the GUI
+    // searches again the objects it refers to when changing frame - this is the only place where ids may be renumbered
+    this->annotsRecord.compact();
+
     // verify that we're indeed reading a video
     if (!this->vidCap.isOpened())
         return false;
 
-    // verify where we're at regarding the buffers
-    if (this->currentImgIndex >= this->maxImgReached)
+    if (fId<0)  // shouldn't happen, but we better stay safe
+        return false;
+
+    // is this frame still in memory?
+    if (this->isFrameCached(fId))
+    {
+        // we can load the required frame
+        this->currentImgIndex = fId;
+        this->touchCachedFrame(fId);
+
+        // we have loaded a new frame - specify that nothing's changed
+        this->changesPerformedUponCurrentAnnot = false;
+
+        return true;
+    }
+
+    // we have to decode it. We also decode a few frames before it, so that going back from there is immediate
+    // (those are read in order, so that the capture seeks once at most)
+    for (int frameId=std::max(fId-this->seekPreloadedFrames+1, 0); frameId<=fId; frameId++)
+    {
+        if (this->isFrameCached(frameId))
+            continue;
+
+        if (!this->loadVideoFrame(frameId))
+            return false;
+    }
+
+    this->startDecodeAhead();
+
+    // we have loaded a new frame - specify that nothing's changed
+    this->changesPerformedUponCurrentAnnot = false;
+
+    return true;
+}
+
+
+
+
+bool AnnotationsSet::loadVideoFrame(int frameId)
+{
+    // we need the capture back
+    this->stopDecodeAhead();
+
+    // the capture can only go forward
+    bool reopenVideo = (frameId<this->nextVideoFrame);
+
+    // jump to the closest keyframe before the required frame when it spares some decoding
+    // when this fails, we don't know where the capture stands anymore and we have to start over
+    bool keyframeGrabbed = false;
+    int keyPosition = this->keyframesIndex.searchPrecedingKeyframe(frameId);
+    if ((keyPosition>=0) && (reopenVideo || this->keyframesIndex.getKeyframe(keyPosition)>this->nextVideoFrame))
+    {
+        keyframeGrabbed = this->seekVideoToKeyframe(keyPosition);
+        reopenVideo = !keyframeGrabbed;
+    }
+
+    if (reopenVideo)
     {
-        // the displayed image is the last one that was ever read
+        // i've witnessed a lot of situations where the frames set counter isn't working properly...
+        // so i'm doing it "the hardcore way" : opening the video back and reading all the frames until i reach the required frame
+        this->vidCap.release();
+        if (!this->vidCap.open(this->imageFilePath + this->videoFileName))
+            return false;
+
+        this->nextVideoFrame = 0;
+    }
 
-        // try to load the image
-        Mat im;
-        if (!this->vidCap.read(im))
+    // we only decode the frames we don't keep, there's no need to retrieve them
+    for (; this->nextVideoFrame<frameId; this->nextVideoFrame++)
+    {
+        if (keyframeGrabbed)
+            keyframeGrabbed = false;
+        else if (!this->vidCap.grab())
         {
             this->reachedTheEndOfVideo = true;
             return false;
         }
+    }
 
-        if (!im.data)
-            return false;
+    // try to load the image
+    Mat im;
+    if (!(keyframeGrabbed ? this->vidCap.retrieve(im) : this->vidCap.read(im)))
+    {
+        this->reachedTheEndOfVideo = true;
+        return false;
+    }
 
-        // alright, we could read the frame, now update the indexes and the buffers
+    this->nextVideoFrame++;
 
-        // init (back?) all the buffers
-        this->currentImgIndex++;
-        this->maxImgReached = this->currentImgIndex;
+    if (!im.data)
+        return false;
+
+    // alright, we could read the frame, now update the indexes and the cache
+    this->currentImgIndex = frameId;
+    this->maxImgReached = std::max(this->maxImgReached, frameId);
+
+    this->storeFrameIntoCache(frameId, im);
+
+    // try to load a previously recorded annotation, if it exists
+    this->loadCurrentAnnotationImage();
 
-        int bufferIndex = this->currentImgIndex % this->bufferLength;
+    // what we have just loaded is what's on the disk
+    this->accessCachedFrame(frameId)->dirty = false;
+
+    return true;
+}
+
+
+bool AnnotationsSet::seekVideoToKeyframe(int position)
+{
+    // the backend estimates the frame it lands on : rather than its frame counter, we check the timestamp of what it has decoded
+    double timestamp = this->keyframesIndex.getTimestamp(position);
+    if (!this->vidCap.set(CAP_PROP_POS_MSEC, timestamp) || !this->vidCap.grab())
+        return false;
+
+    double fps = this->vidCap.get(CAP_PROP_FPS);
+    double tolerance = (fps>0 ? 500./fps : 1.);     // half a frame
+    if (std::abs(this->vidCap.get(CAP_PROP_POS_MSEC) - timestamp) > tolerance)
+        return false;
+
+    // the keyframe is grabbed, not retrieved yet
+    this->nextVideoFrame = this->keyframesIndex.getKeyframe(position);
+
+    return true;
+}
+
+
+void AnnotationsSet::startDecodeAhead()
+{
+    // the frames that were already visited may have been edited since their annotation images were written : those are never decoded ahead
+    if (this->decodeAheadThread.joinable() || (this->decodeAheadLength<1) || !this->isVideoOpen() || this->reachedTheEndOfVideo || (this->nextVideoFrame<=this->maxImgReached))
+        return;
+
+    this->decodedAheadFrames.clear();
+    this->decodeAheadCapacity = this->decodeAheadLength;
+    this->decodeAheadNextFrame = this->nextVideoFrame;
+    this->decodeAheadPackedLabels = this->packedLabelsEnabled;
+    this->decodeAheadStopRequested = false;
+    this->decodeAheadRunning = true;
+
+    this->decodeAheadThread = std::thread(&AnnotationsSet::decodeAheadLoop, this);
+}
+
+
+void AnnotationsSet::stopDecodeAhead()
+{
+    if (!this->decodeAheadThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->decodeAheadMutex);
+        this->decodeAheadStopRequested = true;
+    }
+    this->decodeAheadCondition.notify_all();
+
+    this->decodeAheadThread.join();
+
+    // the capture stands after the last frame the thread has decoded
+    this->nextVideoFrame = this->decodeAheadNextFrame;
+    this->decodedAheadFrames.clear();
+}
+
+
+void AnnotationsSet::decodeAheadLoop()
+{
+    std::unique_lock<std::mutex> lock(this->decodeAheadMutex);
+
+    while (!this->decodeAheadStopRequested)
+    {
+        // wait for some room in the queue
+        if ((int)this->decodedAheadFrames.size() >= this->decodeAheadCapacity)
+        {
+            this->decodeAheadCondition.wait(lock);
+            continue;
+        }
+
+        // the decoding itself is done without holding the lock
+        DecodedAheadFrame decoded;
+        decoded.frameId = this->decodeAheadNextFrame;
+
+        lock.unlock();
+        bool frameDecoded = this->decodeFrameAhead(decoded.frameId, decoded);
+        lock.lock();
+
+        // most likely the end of the video : the GUI thread finds it out by itself when it gets there
+        if (!frameDecoded)
+            break;
+
+        this->decodedAheadFrames.push_back(std::move(decoded));
+        this->decodeAheadNextFrame++;
+        this->decodeAheadCondition.notify_all();
+    }
+
+    this->decodeAheadRunning = false;
+    this->decodeAheadCondition.notify_all();
+}
+
+
+bool AnnotationsSet::decodeFrameAhead(int frameId, DecodedAheadFrame& decoded)
+{
+    // this runs on the decode-ahead thread : only vidCap and the configuration are accessed
+    AnnotationsFrame& frame = decoded.frame;
+
+    if (!this->vidCap.read(frame.originalImage) || !frame.originalImage.data)
+        return false;
+
+    frame.contours = Mat::zeros(frame.originalImage.size(), CV_8UC1);
+
+    // the planes are decoded as they're stored into the files, then packed
+    Mat classesMat, objIdsMat;
+    bool annotated = this->decodeAnnotationImage(frameId, frame.getSize(), classesMat, objIdsMat, decoded.observedObjects, decoded.observedBoundingBoxes, decoded.observedMoments);
+
+    // (when some value doesn't fit into the packed labels, the GUI thread finds the frame unpacked)
+    if (!annotated)
+        frame.resetAnnotationsPlanes(this->decodeAheadPackedLabels);
+    else if (!frame.storeAnnotationsPlanes(classesMat, objIdsMat, this->decodeAheadPackedLabels))
+        frame.storeAnnotationsPlanes(classesMat, objIdsMat, false);
+
+    if (annotated && decoded.observedBoundingBoxes.size()>0)
+    {
+        Rect2i contoursROI = decoded.observedBoundingBoxes[0];
+        for (size_t k=1; k<decoded.observedBoundingBoxes.size(); k++)
+            contoursROI |= decoded.observedBoundingBoxes[k];
+
+        // the whole frame is ready to be displayed
+        invalidateContours(frame, contoursROI);
+        refreshContours(frame, Rect2i(Point2i(0, 0), frame.getSize()));
+    }
+
+    return true;
+}
+
+
+bool AnnotationsSet::takeDecodedAheadFrame(int frameId, DecodedAheadFrame& decoded)
+{
+    if (!this->decodeAheadThread.joinable())
+        return false;
+
+    std::unique_lock<std::mutex> lock(this->decodeAheadMutex);
+
+    // the frames we've gone past are useless
+    while (this->decodedAheadFrames.size()>0 && this->decodedAheadFrames.front().frameId<frameId)
+        this->decodedAheadFrames.pop_front();
+
+    // the frame may be on its way
+    this->decodeAheadCondition.wait(lock, [this, frameId]() {
+        return (this->decodedAheadFrames.size()>0 || !this->decodeAheadRunning || this->decodeAheadNextFrame!=frameId); });
+
+    if (this->decodedAheadFrames.size()==0 || this->decodedAheadFrames.front().frameId!=frameId)
+        return false;
+
+    decoded = std::move(this->decodedAheadFrames.front());
+    this->decodedAheadFrames.pop_front();
+
+    // some room for the next one
+    this->decodeAheadCondition.notify_all();
+
+    return true;
+}
+
+
+void AnnotationsSet::storeDecodedAheadFrame(DecodedAheadFrame& decoded)
+{
+    int frameId = decoded.frameId;
+
+    if (!this->isFrameCached(frameId))
+    {
+        // only the matrices headers are copied
+        this->framesUseOrder.push_front(frameId);
+        decoded.frame.usePosition = this->framesUseOrder.begin();
+        decoded.frame.dirty = false;
+        this->framesCache[frameId] = decoded.frame;
+    }
+    else
+        this->touchCachedFrame(frameId);
+
+    this->currentImgIndex = frameId;
+    this->maxImgReached = std::max(this->maxImgReached, frameId);
+
+    // the packed labels may have been disabled in the meantime, or the frame may hold values which don't fit in them
+    AnnotationsFrame* frame = this->accessCachedFrame(frameId);
+    if (!this->packedLabelsEnabled && frame->isPacked())
+    {
+        frame->unpackLabels();
+        frame->labels.release();
+    }
+    else if (this->packedLabelsEnabled && !frame->isPacked() && !frame->packLabels())
+        this->disablePackedLabels();
+
+    this->registerObservedObjects(frameId, decoded.observedObjects, decoded.observedBoundingBoxes, decoded.observedMoments);
+
+    this->enforceFramesCacheBudget();
+}
+
+
+std::string AnnotationsSet::getKeyframesIndexFileName() const
+{
+    // next to the summary file, which is where the annotations of the video are looked for
+    string fileName = this->config.getSummaryFileName(this->imageFilePath, this->videoFileName);
+
+    std::string::size_type dotPos = fileName.find_last_of('.');
+    std::string::size_type slashPos = fileName.find_last_of('/');
+    if (dotPos == std::string::npos || (slashPos != std::string::npos && dotPos<slashPos))
+        return fileName + _VideoKeyframesIndex_FileNameSuffix + ".yaml";
+
+    return fileName.substr(0, dotPos) + _VideoKeyframesIndex_FileNameSuffix + fileName.substr(dotPos);
+}
 
-        im.copyTo(this->originalImagesBuffer[bufferIndex]);
-        this->annotationsClassesBuffer[bufferIndex] = Mat::zeros(im.size(), CV_16SC1);
-        this->annotationsIdsBuffer[bufferIndex] = Mat::zeros(im.size(), CV_32SC1);
-        this->annotationsContoursBuffer[bufferIndex] = Mat::zeros(im.size(), CV_8UC1);
 
-        // try to load a previously recorded annotation, if it exists
-        //if (this->loadCurrentAnnotationImage())
-            //cout << "we were able to load a previous annotation" << endl;
-        this->loadCurrentAnnotationImage();
 
-        // we have loaded a new frame - specify that nothing's changed
-        this->changesPerformedUponCurrentAnnot = false;
 
-        return true;
+void AnnotationsSet::queueSaveBehind(const std::string& fileName, const std::function<bool(const std::string&)>& write, bool atomic) const
+{
+    if (fileName.length()<2)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->saveBehindMutex);
+
+        // the content that was waiting is superseded
+        auto queued = std::find_if(this->saveBehindJobs.begin(), this->saveBehindJobs.end(), [&fileName](const SaveBehindJob& job) { return job.atomic && job.fileName==fileName; });
+        if (atomic && queued != this->saveBehindJobs.end())
+            queued->write = write;
+        else
+        {
+            this->saveBehindJobs.push_back(SaveBehindJob());
+            this->saveBehindJobs.back().fileName = fileName;
+            this->saveBehindJobs.back().write = write;
+            this->saveBehindJobs.back().atomic = atomic;
+        }
+    }
+
+    // the thread runs until it is stopped : it only has to be started once
+    if (!this->saveBehindThread.joinable())
+    {
+        this->saveBehindStopRequested = false;
+        this->saveBehindThread = std::thread(&AnnotationsSet::saveBehindLoop, this);
+    }
+
+    this->saveBehindCondition.notify_all();
+}
+
+
+void AnnotationsSet::queueFramePlanesSave(const std::string& fileName, bool labelsFile, const cv::Mat& classesMat, const cv::Mat& objIdsMat) const
+{
+    // the planes keep being edited : the thread writes its own copy. The color encoding is done there as well
+    Mat classesCopy = classesMat.clone();
+    Mat idsCopy = objIdsMat.clone();
+
+    if (labelsFile)
+    {
+        this->queueSaveBehind(fileName, [classesCopy, idsCopy](const std::string& writtenFileName) {
+            return writeLabelsFile(writtenFileName, classesCopy, idsCopy); });
+    }
+    else
+    {
+        std::vector<AnnotationsClassEncoder> encoders = this->getClassesColorEncoders();
+        this->queueSaveBehind(fileName, [encoders, classesCopy, idsCopy](const std::string& writtenFileName) {
+            Mat encodedIm;
+            encodeAnnotationsImage(encoders, classesCopy, idsCopy, encodedIm);
+            return cv::imwrite(writtenFileName, encodedIm); });
+    }
+}
+
+
+void AnnotationsSet::queueFramePlanesSave(const std::string& fileName, bool labelsFile, const AnnotationsFrame& frame) const
+{
+    if (!frame.isPacked())
+    {
+        this->queueFramePlanesSave(fileName, labelsFile, frame.classes, frame.ids);
+        return;
+    }
+
+    // the files hold classes and ids planes : the copy of the packed labels is split by the thread
+    Mat labelsCopy = frame.labels.clone();
+
+    if (labelsFile)
+    {
+        this->queueSaveBehind(fileName, [labelsCopy](const std::string& writtenFileName) {
+            Mat classesMat, objIdsMat;
+            AnnotationsFrame::splitLabels(labelsCopy, classesMat, objIdsMat);
+            return writeLabelsFile(writtenFileName, classesMat, objIdsMat); });
     }
-    else if (this->maxImgReached-this->currentImgIndex < this->bufferLength)
+    else
     {
-        // we're inside the buffer boundaries
-        this->currentImgIndex++;
+        std::vector<AnnotationsClassEncoder> encoders = this->getClassesColorEncoders();
+        this->queueSaveBehind(fileName, [encoders, labelsCopy](const std::string& writtenFileName) {
+            Mat classesMat, objIdsMat, encodedIm;
+            AnnotationsFrame::splitLabels(labelsCopy, classesMat, objIdsMat);
+            encodeAnnotationsImage(encoders, classesMat, objIdsMat, encodedIm);
+            return cv::imwrite(writtenFileName, encodedIm); });
+    }
+}
 
-        // we have loaded a new frame - specify that nothing's changed
-        this->changesPerformedUponCurrentAnnot = false;
 
-        // it should be all??? quite surprised, actually....
-        return true;
-    }
+void AnnotationsSet::waitForSaveBehind(const std::string& fileName) const
+{
+    std::unique_lock<std::mutex> lock(this->saveBehindMutex);
 
-    // the case when we're outside of the buffer boundaries is not supported yet
-    return false;
+    this->saveBehindCondition.wait(lock, [this, &fileName]() {
+        if (fileName.length()==0)
+            return (this->saveBehindJobs.size()==0 && this->saveBehindWrittenFile.length()==0);
+
+        return (this->saveBehindWrittenFile!=fileName && std::none_of(this->saveBehindJobs.begin(), this->saveBehindJobs.end(),
+                                                                      [&fileName](const SaveBehindJob& job) { return job.fileName==fileName; })); });
 }
 
 
+bool AnnotationsSet::flushSaveBehind() const
+{
+    this->waitForSaveBehind();
+
+    std::lock_guard<std::mutex> lock(this->saveBehindMutex);
+    bool success = (this->saveBehindFailures==0);
+    this->saveBehindFailures = 0;
 
+    return success;
+}
 
 
-bool AnnotationsSet::loadFrame(int fId)
+void AnnotationsSet::stopSaveBehind()
 {
-    // save what we were doing until now
-    this->saveCurrentState("", true);
+    if (!this->saveBehindThread.joinable())
+        return;
 
-    // verify that we're indeed reading a video
-    if (!this->vidCap.isOpened())
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(this->saveBehindMutex);
+        this->saveBehindStopRequested = true;
+    }
+    this->saveBehindCondition.notify_all();
 
-    if (fId<0)  // shouldn't happen, but we better stay safe
-        return false;
+    this->saveBehindThread.join();
+}
 
-    // is this a previous frame?
-    if ((fId<=this->currentImgIndex) && (this->maxImgReached-fId < this->bufferLength))
-    {
-        // we can load the required frame
-        this->currentImgIndex = fId;
 
-        // we have loaded a new frame - specify that nothing's changed
-        this->changesPerformedUponCurrentAnnot = false;
+void AnnotationsSet::saveBehindLoop() const
+{
+    std::unique_lock<std::mutex> lock(this->saveBehindMutex);
 
-        return true;
-    }
-    else if (fId>this->currentImgIndex)
+    while (true)
     {
-        // trying to read forward the video
-        // we only read frames and we don't compute anything if we're out of the buffer boundaries
-        Mat imThrash;
-        for (; this->currentImgIndex<fId-this->bufferLength; this->currentImgIndex++)
-            if (!this->vidCap.read(imThrash))
-                return false;
-
-        while (!this->reachedTheEndOfVideo && fId>this->currentImgIndex)
+        if (this->saveBehindJobs.size()==0)
         {
-            if (!this->loadNextFrame())  // we load every frame normally because we need to update the buffer
-                return false;
+            // nothing queued is ever dropped
+            if (this->saveBehindStopRequested)
+                break;
+
+            this->saveBehindCondition.wait(lock);
+            continue;
         }
 
-        if (fId == this->currentImgIndex)
-        {
-            // we have loaded a new frame - specify that nothing's changed
-            this->changesPerformedUponCurrentAnnot = false;
+        SaveBehindJob job = std::move(this->saveBehindJobs.front());
+        this->saveBehindJobs.pop_front();
+        this->saveBehindWrittenFile = job.fileName;
 
-            return true;
+        // the writing itself is done without holding the lock
+        lock.unlock();
+        bool written = false;
+        if (job.atomic)
+            written = writeFileAtomically(job.fileName, job.write);
+        else
+        {
+            QtCvUtils::generatePath(job.fileName);
+            written = job.write(job.fileName);
         }
-    }
-    else
-    {
-        // last case : we're out of the buffer and it isn't a case where we're supposed to read forward - which means that we want to display a frame before the buffer
+        lock.lock();
 
-        // i've witnessed a lot of situations where the frames set counter isn't working properly...
-        // so i'm doing it "the hardcore way" : loading the video back and reading all the frames until i reach the required frame
-        if (!this->loadOriginalVideo(this->imageFilePath + this->videoFileName))
-            return false;
+        if (!written)
+            this->saveBehindFailures++;
 
-        // read the video until we rich the start of the buffer again
-        Mat imThrash;
-        for (; this->currentImgIndex<fId-this->bufferLength; this->currentImgIndex++)
-            if (!this->vidCap.read(imThrash))
-                return false;
+        this->saveBehindWrittenFile.clear();
+        this->saveBehindCondition.notify_all();
+    }
+}
 
-        // finally read and fill the buffers correctly
-        while (!this->reachedTheEndOfVideo && fId>this->currentImgIndex)
-        {
-            if (!this->loadNextFrame())
-                return false;
-        }
 
-        // we have loaded a new frame - specify that nothing's changed
-        this->changesPerformedUponCurrentAnnot = false;
+bool AnnotationsSet::writeFileAtomically(const std::string& fileName, const std::function<bool(const std::string&)>& write)
+{
+    // verify that we can indeed store the file where we intend to store it
+    QtCvUtils::generatePath(fileName);
 
-        return true;
+    // the content is written next to the file, which is only replaced once the content is complete
+    string temporaryFileName = QtCvUtils::getTemporaryFileName(fileName);
+    if (!write(temporaryFileName) || !QtCvUtils::replaceFile(temporaryFileName, fileName))
+    {
+        std::remove(temporaryFileName.c_str());
+        return false;
     }
 
-    return false;
+    return true;
 }
 
 
@@ -1259,18 +3913,19 @@ void AnnotationsSet::closeFile(bool pleaseSave)
     if (pleaseSave)
         this->saveCurrentState();
 
+    this->stopDecodeAhead();
+
+    // whatever was queued ends up on the disk before the file is closed
+    this->waitForSaveBehind();
+
     if (this->isVideoOpen())
         this->vidCap.release();
 
-    for (int i=0; i<this->bufferLength; i++)
-    {
-        this->originalImagesBuffer[i].release();
-        this->annotationsClassesBuffer[i].release();
-        this->annotationsIdsBuffer[i].release();
-        this->annotationsContoursBuffer[i].release();
-    }
+    this->clearFramesCache();
+    this->keyframesIndex.clear();
 
     this->annotsRecord.clear();
+    this->forgetJournal();
 
     this->currentImgIndex = 0;
 }
@@ -1323,22 +3978,23 @@ string AnnotationsSet::getDefaultCurrentImageSaveFileName() const
 
 bool AnnotationsSet::loadAnnotations(const std::string& annotationsFileName)
 {
-    // qDebug() << "appel loadAnnotations : " << QString::fromStdString(annotationsFileName);
-
-    // open the file
-    FileStorage fsR(annotationsFileName, FileStorage::READ);
-
-    if (!fsR.isOpened())
-        return false;
+    // the frames decoded ahead may not agree with the new record
+    this->stopDecodeAhead();
+    // the locks come with the new record
+    this->invalidateLockTable();
 
-    FileNode globalAnnotsFnd = fsR[_AnnotationsSet_YAMLKey_Node];
+    // qDebug() << "appel loadAnnotations : " << QString::fromStdString(annotationsFileName);
 
-    if (globalAnnotsFnd.empty())
-        return false;
+    // the file may still be waiting to be written
+    this->waitForSaveBehind(annotationsFileName);
 
-    globalAnnotsFnd[_AnnotationsSet_YAMLKey_FilePath] >> this->imageFilePath;
-    globalAnnotsFnd[_AnnotationsSet_YAMLKey_ImageFileName] >> this->imageFileName;
-    globalAnnotsFnd[_AnnotationsSet_YAMLKey_VideoFileName] >> this->videoFileName;
+    // the binary snapshot spares the parsing of the whole summary file - unless the summary file isn't the one it was written along
+    string summaryJournalId;
+    if (!this->readRecordSnapshotFile(getRecordSnapshotFileName(annotationsFileName), annotationsFileName, summaryJournalId))
+    {
+        if (!this->readSummaryFile(annotationsFileName, summaryJournalId))
+            return false;
+    }
 
     // from now on, we prefer to use the absolute path within the application
     if (this->imageFilePath[0] != '/')  // not absolute
@@ -1350,19 +4006,25 @@ bool AnnotationsSet::loadAnnotations(const std::string& annotationsFileName)
         // qDebug() << "deduced imageFilePath : " << QString::fromStdString(this->imageFilePath);
     }
 
-    // load the configuration before anything else
-    this->config.readContentFromYaml(globalAnnotsFnd);
-
-    // then read the record
-    this->annotsRecord.readContentFromYaml(globalAnnotsFnd);
+    // then the modifications journaled since the summary file was written
+    int journalReplayed = this->replayJournal(annotationsFileName, summaryJournalId);
 
     // finally load the video or the image, depending on the case
+    bool loaded = false;
     if (this->imageFileName.length()>1)
-        return this->loadOriginalImage(this->imageFilePath + this->imageFileName);
+        loaded = this->loadOriginalImage(this->imageFilePath + this->imageFileName);
     else if (this->videoFileName.length()>1)
-        return this->loadOriginalVideo(this->imageFilePath + this->videoFileName);
+        loaded = this->loadOriginalVideo(this->imageFilePath + this->videoFileName);
 
-    return false;
+    // the autosaves go on with the journal of this summary file, unless it can't be continued
+    if (loaded && (journalReplayed != 0) && (summaryJournalId.length()>0))
+    {
+        this->journalSummaryFileName = annotationsFileName;
+        this->journalId = summaryJournalId;
+        this->journalStarted = (journalReplayed == 1);
+    }
+
+    return loaded;
 }
 
 
@@ -1372,6 +4034,11 @@ bool AnnotationsSet::loadAnnotations(const std::string& annotationsFileName)
 
 bool AnnotationsSet::loadConfiguration(const std::string& configFileName)
 {
+    // the decode-ahead thread reads the configuration
+    this->stopDecodeAhead();
+    // the class locks come with the new configuration
+    this->invalidateLockTable();
+
     // open the file
     FileStorage fsR(configFileName, FileStorage::READ);
 
@@ -1380,87 +4047,460 @@ bool AnnotationsSet::loadConfiguration(const std::string& configFileName)
 
     FileNode globalConfigFnd = fsR[_AnnotationsSet_YAMLKey_Node];
 
-    if (globalConfigFnd.empty())
+    if (globalConfigFnd.empty())
+        return false;
+
+
+    // load the configuration before anything else
+    this->config.readContentFromYaml(globalConfigFnd);
+
+    return true;
+}
+
+
+
+
+
+
+
+
+bool AnnotationsSet::saveCurrentState(const std::string& forceFileName, bool saveOnlyIfNecessary)
+{
+    if (saveOnlyIfNecessary && !this->changesPerformedUponCurrentAnnot)
+        return true;
+
+    // once the whole record has been saved, the autosaves only append its modifications to the journal
+    if (saveOnlyIfNecessary && (forceFileName.length()<2) && (this->journalId.length()>0))
+        this->queueJournalAppend();
+    else
+    {
+        // the place where we're going to save the current frame annotation file
+        string savingFileName = forceFileName;
+        string csvSaveFileName;
+
+        if (savingFileName.length()<2)
+        {
+            if (this->isImageOpen())
+            {
+                savingFileName = this->config.getSummaryFileName(this->imageFilePath, this->imageFileName);
+                csvSaveFileName = this->config.getCsvFileName(this->imageFilePath, this->imageFileName);
+            }
+            else if (this->isVideoOpen())
+            {
+                savingFileName = this->config.getSummaryFileName(this->imageFilePath, this->videoFileName);
+                csvSaveFileName = this->config.getCsvFileName(this->imageFilePath, this->videoFileName);
+            }
+        }
+
+        string saveFilePath = QtCvUtils::getRelativePath(savingFileName, this->imageFilePath);
+        if ((saveFilePath.length()>1) && (saveFilePath[saveFilePath.length()-1] != '/'))
+            saveFilePath = saveFilePath + '/';
+
+        // the record is copied as it is now : it is serialized by the save-behind thread, the summary and the csv files sharing the same copy
+        std::shared_ptr<const std::vector<AnnotationObject> > annotations = std::make_shared<const std::vector<AnnotationObject> >(this->annotsRecord.getAnnotationsSnapshot());
+
+        AnnotationsConfig configCopy(this->config);
+        string imgFileName = this->imageFileName, vidFileName = this->videoFileName;
+        string recordingTimeDate = QtCvUtils::getDateTimeStr();
+        string summaryJournalId = generateJournalId();
+
+        this->queueSaveBehind(savingFileName, [=](const std::string& writtenFileName) {
+            if (!writeSummaryFile(writtenFileName, saveFilePath, imgFileName, vidFileName, recordingTimeDate, summaryJournalId, configCopy, *annotations))
+                return false;
+
+            // the binary snapshot follows the summary file : it's the one read when loading it again. It's stamped with the summary file just written,
+            // whose size and modification time are kept when it's renamed. If the snapshot can't be written, the former one doesn't match any more
+            writeFileAtomically(getRecordSnapshotFileName(savingFileName), [&](const std::string& snapshotFileName) {
+                return writeRecordSnapshotFile(snapshotFileName, writtenFileName, saveFilePath, imgFileName, vidFileName, summaryJournalId, configCopy, *annotations); });
+            return true; });
+
+        if (csvSaveFileName.length()>2)
+        {
+            this->queueSaveBehind(csvSaveFileName, [annotations](const std::string& writtenFileName) {
+                std::ofstream fsOut(writtenFileName.c_str(), std::ofstream::out);
+                if (!fsOut.is_open())
+                    return false;
+                AnnotationsRecord::writeAnnotationsToCsv(fsOut, *annotations);
+                return fsOut.good(); });
+        }
+
+        // the default summary file (or the one the journal follows up) starts a new journal : the journaled modifications are part of it now
+        // a copy saved elsewhere leaves the journal as it is
+        if ((savingFileName.length()>=2) && ((forceFileName.length()<2) || QtCvUtils::isSameFile(savingFileName, this->journalSummaryFileName)))
+        {
+            this->queueSaveBehind(getJournalFileName(savingFileName), [](const std::string& writtenFileName) {
+                std::remove(writtenFileName.c_str());
+                return true; }, false);
+
+            this->annotsRecord.clearJournal();
+            this->journalSummaryFileName = savingFileName;
+            this->journalId = summaryJournalId;
+            this->journalStarted = false;
+        }
+    }
+
+    // now store the current image
+    if (!this->saveCurrentAnnotationImage())
+        return false;
+
+    if (this->accessCachedFrame(this->currentImgIndex))
+        this->accessCachedFrame(this->currentImgIndex)->dirty = false;
+
+
+    // specify that we've recorded the changes
+    this->changesPerformedUponCurrentAnnot = false;
+
+    // the saves triggered by the frame changes don't wait for the disk, the other ones do
+    if (!saveOnlyIfNecessary)
+        return this->flushSaveBehind();
+
+    return true;
+}
+
+
+
+void AnnotationsSet::queueJournalAppend()
+{
+    // the operations are moved to the save-behind thread, which formats them
+    std::shared_ptr<std::vector<AnnotationsJournalOp> > ops = std::make_shared<std::vector<AnnotationsJournalOp> >();
+    this->annotsRecord.takeJournal(*ops);
+
+    if (ops->size()==0)
+        return;
+
+    // the first append writes the header
+    string header;
+    if (!this->journalStarted)
+        header = _AnnotationsSet_JournalHeader + " " + this->journalId + "\n";
+    this->journalStarted = true;
+
+    this->queueSaveBehind(getJournalFileName(this->journalSummaryFileName), [ops, header](const std::string& writtenFileName) {
+        std::ofstream fsOut(writtenFileName.c_str(), std::ofstream::out | std::ofstream::app);
+        if (!fsOut.is_open())
+            return false;
+
+        fsOut << header;
+        for (const AnnotationsJournalOp& op: *ops)
+            op.writeToStream(fsOut);
+
+        return fsOut.good(); }, false);
+}
+
+
+
+int AnnotationsSet::replayJournal(const std::string& summaryFileName, const std::string& summaryJournalId)
+{
+    string journalFileName = getJournalFileName(summaryFileName);
+    this->waitForSaveBehind(journalFileName);
+
+    std::ifstream fsIn(journalFileName.c_str());
+    if (!fsIn.is_open())
+        return -1;
+
+    // the journal has to follow up this very summary file
+    string line;
+    if ((summaryJournalId.length()==0) || !std::getline(fsIn, line) || (line != _AnnotationsSet_JournalHeader + " " + summaryJournalId))
+        return 0;
+
+    bool complete = true;
+    AnnotationsJournalOp op;
+    while (std::getline(fsIn, line))
+    {
+        // the last line may have been cut by a crash : it has no end of line then
+        if (fsIn.eof() || !op.readFromString(line))
+        {
+            complete = false;
+            break;
+        }
+
+        this->annotsRecord.applyJournalOp(op);
+    }
+
+    // the replayed operations are already in the journal file
+    this->annotsRecord.clearJournal();
+
+    return complete ? 1 : 0;
+}
+
+
+std::string AnnotationsSet::getSummaryCompanionFileName(const std::string& summaryFileName, const std::string& suffix)
+{
+    std::string::size_type dotPos = summaryFileName.find_last_of('.');
+    std::string::size_type slashPos = summaryFileName.find_last_of('/');
+    if (dotPos == std::string::npos || (slashPos != std::string::npos && dotPos<slashPos))
+        return summaryFileName + suffix;
+
+    return summaryFileName.substr(0, dotPos) + suffix;
+}
+
+
+std::string AnnotationsSet::generateJournalId()
+{
+    // a summary file saved again gets another id
+    return std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+
+
+bool AnnotationsSet::isStreamedSummaryFormat(const std::string& fileName, bool& json)
+{
+    // the format is given by the extension, as FileStorage does it
+    std::string::size_type dotPos = fileName.find_last_of('.');
+    std::string::size_type slashPos = fileName.find_last_of('/');
+    if (dotPos == std::string::npos || (slashPos != std::string::npos && dotPos<slashPos))
+        return false;
+
+    std::string extension = fileName.substr(dotPos+1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    json = (extension == "json");
+    return (json || (extension == "yml") || (extension == "yaml"));
+}
+
+
+
+bool AnnotationsSet::readSummaryFile(const std::string& fileName, std::string& summaryJournalId)
+{
+    // the record node of the YAML and JSON files is parsed on the fly : FileStorage only parses the text around it
+    FileStorage fsR;
+    bool recordRead = false;
+
+    bool json = false;
+    QFile file(QString::fromStdString(fileName));
+    if (isStreamedSummaryFormat(fileName, json) && file.open(QIODevice::ReadOnly) && (file.size() > 0))
+    {
+        size_t size = (size_t)file.size();
+        const char* data = (const char*)file.map(0, file.size());
+
+        // the record node is the last one written : its key is the last occurrence
+        std::string key = json ? ("\"" + _AnnotsRecord_YAMLKey_Node + "\"") : (_AnnotsRecord_YAMLKey_Node + ":");
+        const char* keyPos = data ? std::find_end(data, data+size, key.begin(), key.end()) : NULL;
+
+        size_t recordStart = keyPos ? (size_t)(keyPos-data) : size, recordEnd = 0;
+        if ((recordStart < size) && this->annotsRecord.readContentFromText(keyPos, size-recordStart, json, recordEnd))
+        {
+            recordEnd += recordStart;
+
+            // JSON : the comma separating the record node from the previous one goes away with it
+            size_t headerEnd = recordStart;
+            if (json)
+            {
+                while ((headerEnd > 0) && isspace((unsigned char)data[headerEnd-1]))
+                    headerEnd--;
+                if ((headerEnd > 0) && (data[headerEnd-1] == ','))
+                    headerEnd--;
+            }
+
+            std::string header = std::string(data, headerEnd) + std::string(data+recordEnd, size-recordEnd);
+            recordRead = fsR.open(header, FileStorage::READ | FileStorage::MEMORY);
+        }
+
+        if (data)
+            file.unmap((uchar*)data);
+    }
+
+    // any other file is entirely parsed by FileStorage
+    if (!recordRead && !fsR.open(fileName, FileStorage::READ))
+        return false;
+
+    FileNode globalAnnotsFnd = fsR[_AnnotationsSet_YAMLKey_Node];
+
+    if (globalAnnotsFnd.empty())
+        return false;
+
+    globalAnnotsFnd[_AnnotationsSet_YAMLKey_FilePath] >> this->imageFilePath;
+    globalAnnotsFnd[_AnnotationsSet_YAMLKey_ImageFileName] >> this->imageFileName;
+    globalAnnotsFnd[_AnnotationsSet_YAMLKey_VideoFileName] >> this->videoFileName;
+
+    // load the configuration before anything else
+    this->config.readContentFromYaml(globalAnnotsFnd);
+
+    // then read the record, when it wasn't already
+    if (!recordRead)
+        this->annotsRecord.readContentFromYaml(globalAnnotsFnd);
+
+    if (!globalAnnotsFnd[_AnnotationsSet_YAMLKey_JournalId].empty())
+        globalAnnotsFnd[_AnnotationsSet_YAMLKey_JournalId] >> summaryJournalId;
+
+    return true;
+}
+
+
+
+bool AnnotationsSet::writeSummaryFile(const std::string& fileName, const std::string& filePath, const std::string& imageFileName, const std::string& videoFileName,
+                                      const std::string& recordingTimeDate, const std::string& journalId, const AnnotationsConfig& config, const std::vector<AnnotationObject>& annotations)
+{
+    // the record node of the YAML and JSON files is streamed : FileStorage writes the other nodes in memory, along with an empty record node,
+    // which is then replaced with the actual one
+    bool json = false;
+    bool streamed = isStreamedSummaryFormat(fileName, json);
+
+    auto writeNodes = [&](FileStorage& fs, const std::vector<AnnotationObject>& recordContent) {
+        // add a node, since loading is way more complicated when we don't add a base node
+        fs << _AnnotationsSet_YAMLKey_Node << "{";
+
+        fs << _AnnotationsSet_YAMLKey_FilePath << filePath;
+        fs << _AnnotationsSet_YAMLKey_ImageFileName << imageFileName;
+        fs << _AnnotationsSet_YAMLKey_VideoFileName << videoFileName;
+
+        fs << _AnnotationsSet_YAMLKey_RecordingTimeDate << recordingTimeDate;
+        fs << _AnnotationsSet_YAMLKey_JournalId << journalId;
+
+
+        // save the configuration
+        config.writeContentToYaml(fs);
+
+        // do the actual record
+        AnnotationsRecord::writeAnnotationsToYaml(fs, recordContent);
+
+        // close the AnnotationsSet node
+        fs << "}"; };
+
+    if (streamed)
+    {
+        FileStorage fs(json ? ".json" : ".yml", FileStorage::WRITE | FileStorage::MEMORY);
+        writeNodes(fs, std::vector<AnnotationObject>());
+        std::string content = fs.releaseAndGetString();
+
+        std::ostringstream emptyRecord;
+        AnnotationsRecord::writeAnnotationsToText(emptyRecord, std::vector<AnnotationObject>(), json);
+        size_t recordPosition = content.rfind(emptyRecord.str());
+
+        // when the empty record node can't be found, the whole document is written by FileStorage
+        if (recordPosition != std::string::npos)
+        {
+            std::ofstream fsOut(fileName, std::ios::binary | std::ios::trunc);
+            if (!fsOut.is_open())
+                return false;
+
+            size_t tailPosition = recordPosition + emptyRecord.str().length();
+            fsOut.write(content.data(), recordPosition);
+            AnnotationsRecord::writeAnnotationsToText(fsOut, annotations, json);
+            fsOut.write(content.data()+tailPosition, content.length()-tailPosition);
+
+            return fsOut.good();
+        }
+    }
+
+    // open the file
+    FileStorage fs(fileName, FileStorage::WRITE);
+    if (!fs.isOpened())
         return false;
 
-
-    // load the configuration before anything else
-    this->config.readContentFromYaml(globalConfigFnd);
+    writeNodes(fs, annotations);
+    fs.release();
 
     return true;
 }
 
 
 
+bool AnnotationsSet::writeRecordSnapshotFile(const std::string& fileName, const std::string& summaryFileName, const std::string& filePath, const std::string& imageFileName,
+                                             const std::string& videoFileName, const std::string& journalId, const AnnotationsConfig& config, const std::vector<AnnotationObject>& annotations)
+{
+    // the snapshot is only valid along with the summary file it comes from
+    int64_t summaryStamp[2];
+    if (!QtCvUtils::getFileStamp(summaryFileName, summaryStamp[0], summaryStamp[1]))
+        return false;
 
+    std::ofstream fsOut(fileName, std::ios::binary | std::ios::trunc);
+    if (!fsOut.is_open())
+        return false;
 
+    uint32_t header[2] = { _AnnotationsSet_recordSnapshotMagic, _AnnotationsSet_recordSnapshotVersion };
+    fsOut.write((const char*)header, sizeof(header));
+    fsOut.write((const char*)summaryStamp, sizeof(summaryStamp));
 
+    // the configuration is small : it's simply stored as YAML
+    FileStorage fsConfig(".yml", FileStorage::WRITE | FileStorage::MEMORY);
+    config.writeContentToYaml(fsConfig);
 
+    std::string strings[5] = { filePath, imageFileName, videoFileName, journalId, fsConfig.releaseAndGetString() };
+    for (const std::string& str: strings)
+    {
+        uint32_t length = (uint32_t)str.length();
+        fsOut.write((const char*)&length, sizeof(length));
+        fsOut.write(str.data(), length);
+    }
 
-bool AnnotationsSet::saveCurrentState(const std::string& forceFileName, bool saveOnlyIfNecessary)
-{
-    if (saveOnlyIfNecessary && !this->changesPerformedUponCurrentAnnot)
-        return true;
+    AnnotationsRecord::writeSnapshotToStream(fsOut, annotations);
 
-    // the place where we're going to save the current frame annotation file
-    string savingFileName = forceFileName;
-    string csvSaveFileName;
+    return fsOut.good();
+}
 
-    if (savingFileName.length()<2)
-    {
-        if (this->isImageOpen())
-        {
-            savingFileName = this->config.getSummaryFileName(this->imageFilePath, this->imageFileName);
-            csvSaveFileName = this->config.getCsvFileName(this->imageFilePath, this->imageFileName);
-        }
-        else if (this->isVideoOpen())
-        {
-            savingFileName = this->config.getSummaryFileName(this->imageFilePath, this->videoFileName);
-            csvSaveFileName = this->config.getCsvFileName(this->imageFilePath, this->videoFileName);
-        }
-    }
 
-    // verify that we can indeed store the file where we intend to store it
-    QtCvUtils::generatePath(savingFileName);
+bool AnnotationsSet::readRecordSnapshotFile(const std::string& fileName, const std::string& summaryFileName, std::string& summaryJournalId)
+{
+    int64_t summaryStamp[2];
+    if (!QtCvUtils::getFileStamp(summaryFileName, summaryStamp[0], summaryStamp[1]))
+        return false;
 
-    // open the file
-    FileStorage fs(savingFileName, FileStorage::WRITE);
+    QFile file(QString::fromStdString(fileName));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
 
-    // add a node, since loading is way more complicated when we don't add a base node
-    fs << _AnnotationsSet_YAMLKey_Node << "{";
+    // the file is mapped rather than read : the rows and the indices are copied straight from it
+    size_t size = (size_t)file.size();
+    const char* data = (size > 0) ? (const char*)file.map(0, file.size()) : NULL;
+    if (!data)
+        return false;
 
-    string saveFilePath = QtCvUtils::getRelativePath(savingFileName, this->imageFilePath);
-    if ((saveFilePath.length()>1) && (saveFilePath[saveFilePath.length()-1] != '/'))
-        saveFilePath = saveFilePath + '/';
+    size_t position = 0;
+    bool valid = true;
 
-    // fs << _AnnotationsSet_YAMLKey_FilePath << this->imageFilePath;
-    fs << _AnnotationsSet_YAMLKey_FilePath << saveFilePath;
-    fs << _AnnotationsSet_YAMLKey_ImageFileName << this->imageFileName;
-    fs << _AnnotationsSet_YAMLKey_VideoFileName << this->videoFileName;
+    // reads within the mapped file, bounds checked
+    auto readBytes = [&](void* dest, size_t bytes) {
+        valid = valid && (bytes <= size-position);
+        if (valid)
+        {
+            memcpy(dest, data+position, bytes);
+            position += bytes;
+        }
+        return valid; };
 
-    fs << _AnnotationsSet_YAMLKey_RecordingTimeDate << QtCvUtils::getDateTimeStr();
+    uint32_t header[2];
+    if (!readBytes(header, sizeof(header)) || (header[0] != _AnnotationsSet_recordSnapshotMagic) || (header[1] != _AnnotationsSet_recordSnapshotVersion))
+        valid = false;
 
+    // the summary file must be the very one the snapshot was written along : otherwise it's stale (the summary file was edited, or restored from elsewhere)
+    int64_t snapshotSummaryStamp[2];
+    if (!readBytes(snapshotSummaryStamp, sizeof(snapshotSummaryStamp)) || (snapshotSummaryStamp[0] != summaryStamp[0]) || (snapshotSummaryStamp[1] != summaryStamp[1]))
+        valid = false;
 
-    // save the configuration
-    this->config.writeContentToYaml(fs);
+    std::string strings[5];
+    for (std::string& str: strings)
+    {
+        uint32_t length = 0;
+        if (readBytes(&length, sizeof(length)) && (length <= size-position))
+        {
+            str.assign(data+position, length);
+            position += length;
+        }
+        else
+            valid = false;
+    }
 
-    // do the actual record
-    this->annotsRecord.writeContentToYaml(fs);
+    // the configuration comes before the record, as for the summary file
+    if (valid)
+    {
+        FileStorage fsConfig(strings[4], FileStorage::READ | FileStorage::MEMORY);
+        valid = fsConfig.isOpened() && !fsConfig[_AnnotsConfig_YAMLKey_Node].empty();
+        if (valid)
+            this->config.readContentFromYaml(fsConfig.root());
+    }
 
-    // close the AnnotationsSet node
-    fs << "}";
-    fs.release();
+    // an inconsistent snapshot is dropped : the summary file is parsed instead, which reads the configuration again
+    valid = valid && this->annotsRecord.readSnapshot(data+position, size-position);
 
-    if (csvSaveFileName.length()>2)
-        this->saveToCsv(csvSaveFileName);
+    file.unmap((uchar*)data);
 
-    // now store the current image
-    if (!this->saveCurrentAnnotationImage())
+    if (!valid)
         return false;
 
-
-    // specify that we've recorded the changes
-    this->changesPerformedUponCurrentAnnot = false;
+    this->imageFilePath = strings[0];
+    this->imageFileName = strings[1];
+    this->videoFileName = strings[2];
+    summaryJournalId = strings[3];
 
     return true;
 }
@@ -1484,199 +4524,63 @@ bool AnnotationsSet::saveToCsv(const std::string& fileName) const
 
 
 
-bool AnnotationsSet::saveCurrentAnnotationImage(const std::string& forcedFileName) const
+bool AnnotationsSet::saveAnnotationImage(int frameId, const std::string& forcedFileName) const
 {
     // the place where we're going to save the current frame annotation file
+    // a forced file name is an export : it is always a color image
     string savingFileName = forcedFileName;
-    if (savingFileName.length()<2)
+    bool labelsFile = false;
+    if (savingFileName.length()<2 && (this->isImageOpen() || this->isVideoOpen()))
     {
-        if (this->isImageOpen())
-            savingFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, this->imageFileName, this->currentImgIndex);
-        else if (this->isVideoOpen())
-            savingFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, this->videoFileName, this->currentImgIndex);
+        savingFileName = this->getFrameLabelsFileName(frameId);
+        labelsFile = (savingFileName.length()>0);
+
+        if (!labelsFile)
+            savingFileName = this->getFrameAnnotationImageFileName(frameId);
     }
 
     if (savingFileName.length()<2)
         // this means that the absence of a saving file name is intentional - return true
         return true;
 
-    // find out how to associate a class and a color in the finally recorded annotation image
-    vector<Point2i> colorsIndexSrc;
-    vector<Vec3b> colorsIndexDst;
-    //unordered_map<Point2i, Vec3b> colorsIndex;
-
-    // this is the list of objects present in the image
-    vector<int> presentObjects = this->annotsRecord.getFrameContentIds(this->currentImgIndex);
+    // the pixels of the frame aren't in memory anymore
+    const AnnotationsFrame* frame = this->findCachedFrame(frameId);
+    if (!frame)
+        return false;
 
     // we prevent the app from saving an image if there's no pixel-level annotation
     // emptyImage is there for such situation...
     bool emptyImage = true;
 
-    // compute the associations
-    for (size_t k=0; k<presentObjects.size(); k++)
+    for (int annotId: this->annotsRecord.getFrameContentIds(frameId))
     {
-        AnnotationObject currentAnnotCaracs = this->annotsRecord.getAnnotationById(presentObjects[k]);
-
-
-        // don't bother with this part if the class is Bounding Boxes Only
-        if ( (this->config.getProperty(currentAnnotCaracs.ClassId).classType == _ACT_BoundingBoxOnly) ||
-             (this->config.getProperty(currentAnnotCaracs.ClassId).classType == _ACT_CentroidFrontOnly) )
-            continue;
-
-        emptyImage = false;
-
-        // the way we store each possible occurrence uniquely is with the help of a Point2i
-        Point2i objectRef(currentAnnotCaracs.ClassId, currentAnnotCaracs.ObjectId);
-
-        Vec3b currentAnnotColor;
-
-        // retrieve the annotation properties
-        AnnotationsProperties currentAnnotProps = this->config.getProperty(currentAnnotCaracs.ClassId);
-
-        // easiest case : it's an uniform class
-        if (currentAnnotProps.classType == _ACT_Uniform)
-            currentAnnotColor = currentAnnotProps.minIdBGRRecRange;
-        else if (currentAnnotProps.classType == _ACT_MultipleObjects)
+        AnnotationClassType classType = this->config.getProperty(this->annotsRecord.getClassIdsColumn()[annotId]).classType;
+        if ((classType != _ACT_BoundingBoxOnly) && (classType != _ACT_CentroidFrontOnly))
         {
-            // that's the difficult case now...
-            // for now we will make it simple
-            Vec3b minVal = currentAnnotProps.minIdBGRRecRange;
-            Vec3b maxVal = currentAnnotProps.maxIdBGRRecRange;
-
-            Vec3b availableRange = maxVal - minVal; // every byte should be positive since we assume that max >= min..!
-
-            /*
-            vector< vector<Vec3b> > encodingMultipliers;
-            vector<int> leftMostBit;
-            for (size_t i=0; i<3; i++)
-            {
-                uchar range = availableRange[i];
-                int currBitValue = 1;
-                encodingMultipliers.push_back(vector<Vec3b>());
-                leftMostBit.push_back(0);
-                while (range>=currBitValue)
-                {
-                    leftMostBit[i]++;
-                    Vec3b val(0,0,0);
-                    val[i] = currBitValue;
-                    encodingMultipliers[i].push_back(val);
-                    currBitValue*=2;
-                }
-            }
-
-            // now re-ordering the stuff
-            // int currColorIndex = 0;
-            vector<Vec3b> multipliers;
-            vector<int> components;
-
-            for (int desiredBitPosition=8; desiredBitPosition>0; desiredBitPosition--)
-            {
-                for (int idx=0; idx<3; idx++)
-                {
-                    if (leftMostBit[idx]==desiredBitPosition)
-                    {
-                        components.push_back(idx);
-                        multipliers.push_back(encodingMultipliers[idx][leftMostBit[idx]-1]);
-                        leftMostBit[idx]--;
-                    }
-                }
-            }
-            */
-
-
-            /*
-            std::cout << "multipliers content : " << std::endl;
-            for (size_t i=0; i<multipliers.size(); i++)
-            {
-                std::cout << i << ". " << multipliers[i] << std::endl;
-            }
-            std::cout << "=========" << std::endl;
-            */
-
-            /*
-            // now fill
-            Vec3b bytesContentExperiment(0,0,0);
-            int objIdRemaining = currentAnnotCaracs.ObjectId;
-            int currMultipliersInd = 0;
-            while ((objIdRemaining>0) && (currMultipliersInd<(int)multipliers.size()))
-            {
-                int currComp = components[currMultipliersInd];
-                int bitMult = objIdRemaining % 2;
-                int testVal = (int)bytesContentExperiment[currComp] + (bitMult * multipliers[currMultipliersInd][currComp]);
-                if (testVal<=availableRange[currComp])
-                {
-                    // we can record this bit
-                    bytesContentExperiment += bitMult * multipliers[currMultipliersInd];
-                    objIdRemaining /= 2;
-
-                }
-                currMultipliersInd++;
-            }
-
-            std::cout << "-------" << std::endl;
-            std::cout << "final color value for objectId " << currentAnnotCaracs.ObjectId << " of class " << currentAnnotCaracs.ClassId << " : " << bytesContentExperiment << std::endl;
-            std::cout << "=======" << std::endl;
-            */
-
-            Vec3b bytesContent;
-            int currObjIdRemaining = currentAnnotCaracs.ObjectId;
-            for (size_t i=0; i<3; i++)
-            {
-                // +1 is there because the max value is to be included
-                // anyway, x%1 == 0 and x/1 == x
-                bytesContent[i] = (uchar) currObjIdRemaining % (availableRange[i]+1);
-                currObjIdRemaining /= (availableRange[i]+1);
-            }
-
-            // fill the color
-            for (size_t i=0; i<3; i++)
-            {
-                currentAnnotColor[i] = bytesContent[i] + minVal[i];
-            }
+            emptyImage = false;
+            break;
         }
-
-        // finally store the association
-        colorsIndexSrc.push_back(objectRef);
-        colorsIndexDst.push_back(currentAnnotColor);
-        //colorsIndex[objectRef] = currentAnnotColor;
     }
 
-
     // squeeze the rest of the method in case there's no pixel-level annotation to store
     if (emptyImage)
         return true;
 
 
-    // generate a new image
-    Mat imgToStore = Mat::zeros(this->getCurrentOriginalImg().size(), CV_8UC3);
-
-    for (int i=0; i<imgToStore.rows; i++)
+    // an export is written right away
+    if (forcedFileName.length()>=2)
     {
-        for (int j=0; j<imgToStore.cols; j++)
-        {
-            // is there anything to display?
-            if (this->getCurrentAnnotationsClasses().at<int16_t>(i,j)>0)
-            {
-                // yes : find the right color
-                Point2i pointVals(this->getCurrentAnnotationsClasses().at<int16_t>(i,j), this->getCurrentAnnotationsIds().at<int32_t>(i,j));
-
-                // run through the index...
-                for (size_t k=0; k<colorsIndexSrc.size(); k++)
-                {
-                    // this is sub-optimal, but we will eventually do something better using idunnowhat
-                    if (pointVals == colorsIndexSrc[k])
-                    {
-                        imgToStore.at<Vec3b>(i,j) = colorsIndexDst[k];
-                        break;
-                    }
-                }
+        // generate a new image, the colors being computed class by class
+        Mat classesMat, objIdsMat, imgToStore;
+        frame->copyAnnotationsPlanesTo(classesMat, objIdsMat);
+        encodeAnnotationsImage(this->getClassesColorEncoders(), classesMat, objIdsMat, imgToStore);
 
-                //imgToStore.at<Vec3b>(i,j) = colorsIndex[pointVals];
-            }
-        }
+        return QtCvUtils::imwrite(savingFileName, imgToStore);
     }
 
-    return QtCvUtils::imwrite(savingFileName, imgToStore);
+    this->queueFramePlanesSave(savingFileName, labelsFile, *frame);
+
+    return true;
 }
 
 
@@ -1687,152 +4591,133 @@ bool AnnotationsSet::saveCurrentAnnotationImage(const std::string& forcedFileNam
 bool AnnotationsSet::loadCurrentAnnotationImage()
 {
     // loads an already annotated image. Starts with the idea that both the class and the objectId matrices were already filled with 0s
+    if (!this->isImageOpen() && !this->isVideoOpen())
+        return false;
 
-    // the place where we're going to save the current frame annotation file
-    string loadingFileName;
-
-    if (this->isImageOpen())
-        loadingFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, this->imageFileName, this->currentImgIndex);
-    else if (this->isVideoOpen())
-        loadingFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, this->videoFileName, this->currentImgIndex);
-
-
-
-    // try to load the image, the color format is mandatory
-    Mat imLoad = imread(loadingFileName, IMREAD_COLOR );
-
-    if (!imLoad.data)
+    AnnotationsFrame* frame = this->accessCachedFrame(this->currentImgIndex);
+    if (!frame)
         return false;
 
-    // verify that the dimensions are compliant with our data format
-    if (imLoad.size() != this->getCurrentAnnotationsClasses().size())
+    Mat classesMat, objIdsMat;
+    vector<Point2i> observedObjectsList;
+    vector<Rect2i> observedObjectsBBs;
+    vector<AnnotationMoments> observedObjectsMoments;
+    if (!this->decodeAnnotationImage(this->currentImgIndex, frame->getSize(), classesMat, objIdsMat, observedObjectsList, observedObjectsBBs, observedObjectsMoments))
         return false;
 
-    // record the minColorIndex and the maxColorIndex, it is faster
-    vector<Vec3b> minColorIndex, maxColorIndex;
-    vector<Vec3i> multipliersIndex;
-    vector<bool> classUniform;
 
-    for (int i=0; i<this->config.getPropsNumber(); i++)
+    // the packed labels are computed at once, rather than pixel by pixel
+    this->storeFrameAnnotationsPlanes(this->currentImgIndex, classesMat, objIdsMat);
+
+    // update the contours image
+    if (observedObjectsBBs.size()>0)
     {
-        classUniform.push_back(this->config.getProperty(i+1).classType==_ACT_Uniform);
+        // updating it is only useful if there is at least one object!
+        Rect2i contoursROI = observedObjectsBBs[0];
+        for (size_t k=1; k<observedObjectsBBs.size(); k++)
+            contoursROI |= observedObjectsBBs[k];
 
-        if (this->config.getProperty(i+1).classType == _ACT_BoundingBoxOnly)
-        {
-            // give an impossible color so that it is not taken into account
-            minColorIndex.push_back(Vec3b(0,0,0));
-            maxColorIndex.push_back(Vec3b(0,0,0));
-            multipliersIndex.push_back(Vec3i(1,1,1));
-            continue;
-        }
+        this->invalidateFrameContours(this->currentImgIndex, contoursROI);
+    }
 
-        minColorIndex.push_back(this->config.getProperty(i+1).minIdBGRRecRange);
+    this->registerObservedObjects(this->currentImgIndex, observedObjectsList, observedObjectsBBs, observedObjectsMoments);
 
-        // warning : there's an exception when the class is uniform
-        if (classUniform[i])
-            maxColorIndex.push_back(minColorIndex[i]);
-        else
-            maxColorIndex.push_back(this->config.getProperty(i+1).maxIdBGRRecRange);
+    return true;
+}
 
-        // already calculate the multipliers
-        multipliersIndex.push_back( Vec3i(1, (maxColorIndex[i][0]-minColorIndex[i][0]+1), (maxColorIndex[i][0]-minColorIndex[i][0]+1)*(maxColorIndex[i][1]-minColorIndex[i][1]+1)) );
-    }
 
 
+bool AnnotationsSet::decodeAnnotationImage(int frameId, const cv::Size& frameSize, cv::Mat& classesMat, cv::Mat& objIdsMat, std::vector<cv::Point2i>& observedObjectsList,
+                                           std::vector<cv::Rect2i>& observedObjectsBBs, std::vector<AnnotationMoments>& observedObjectsMoments) const
+{
+    // only reads the configuration : this is also run by the decode-ahead thread
 
-    // we also want to feed the record data, in case it's not compliant with what's recorded
+    // the labels file holds the planes as they are : nothing to decode then
+    string labelsFileName = this->getFrameLabelsFileName(frameId);
+    string annotationImageFileName = this->getFrameAnnotationImageFileName(frameId);
 
-    // so we're recording what we're observing
-    vector<Point2i> observedObjectsList;
-    vector<Rect2i> observedObjectsBBs;
+    // the frame may have been evicted or modified while still on its way to the disk
+    if (labelsFileName.length()>0)
+        this->waitForSaveBehind(labelsFileName);
+    this->waitForSaveBehind(annotationImageFileName);
 
+    bool labelsLoaded = (labelsFileName.length()>0) && readLabelsFile(labelsFileName, classesMat, objIdsMat, frameSize);
 
-    // read the image content...
-    for (int i=0; i<imLoad.rows; i++)
+    if (!labelsLoaded)
     {
-        for (int j=0; j<imLoad.cols; j++)
-        {
-            Vec3b pxValue = imLoad.at<Vec3b>(i,j);
-
-            if (pxValue != Vec3b(0,0,0))    // there is something there..
-            {
-                Point2i currPointIds(0,0);
-
-                for (int k=0; k<(int)minColorIndex.size(); k++)
-                {
-                    if ( (pxValue[0]>=minColorIndex[k][0]) && (pxValue[1]>=minColorIndex[k][1]) && (pxValue[2]>=minColorIndex[k][2])
-                         && (pxValue[0]<=maxColorIndex[k][0]) && (pxValue[1]<=maxColorIndex[k][1]) && (pxValue[2]<=maxColorIndex[k][2]) )
-                    {
-                        // we belong to this class
-                        this->accessCurrentAnnotationsClasses().at<int16_t>(i,j) = k+1;
+        // try to load the image, the color format is mandatory
+        Mat imLoad = imread(annotationImageFileName, IMREAD_COLOR );
 
-                        currPointIds.x = k+1;
+        if (!imLoad.data)
+            return false;
 
-                        // if the class uniform, we don't need to do anything else
-                        // if not, however, we need to decode the pixels information
-                        if (!classUniform[k])
-                        {
-                            // this is just a matter of multiplication, nothing fancy here
-                            int objInd = (multipliersIndex[k][0] * (pxValue[0]-minColorIndex[k][0]))
-                                       + (multipliersIndex[k][1] * (pxValue[1]-minColorIndex[k][1]))
-                                       + (multipliersIndex[k][2] * (pxValue[2]-minColorIndex[k][2]));
+        // verify that the dimensions are compliant with our data format
+        if (imLoad.size() != frameSize)
+            return false;
 
-                            this->accessCurrentAnnotationsIds().at<int32_t>(i,j) = objInd;
-                            currPointIds.y = objInd;
-                        }
+        // decode the classes and object ids planes - every pixel is written
+        classesMat.create(frameSize, CV_16SC1);
+        objIdsMat.create(frameSize, CV_32SC1);
+        if (decodeAnnotationsImage(this->getColorDecoder(), imLoad, classesMat, objIdsMat) > 0)
+            std::cout << "something fishy happened there" << std::endl;
+    }
 
-                        // there's no need to go any further, we know already the right class and object id
-                        break;
-                    }
-                }
 
+    // we also want to feed the record data, in case it's not compliant with what's recorded
+    // so we're recording what we're observing : the objects, their bounding box and their moments
+    std::unordered_map<int64_t, size_t> observedIndex;
+    vector<Vec4i> observedBounds;   // left, top, right, bottom - all inclusive
 
-                if (currPointIds == Point2i(0,0))
-                    std::cout << "something fishy happened there" << std::endl;
+    int64_t lastKey = -1;
+    size_t lastObserved = 0;
 
+    for (int i=0; i<classesMat.rows; i++)
+    {
+        const int16_t* classesRow = classesMat.ptr<int16_t>(i);
+        const int32_t* idsRow = objIdsMat.ptr<int32_t>(i);
 
-                // storing the object and/or updating the bounding box
-                size_t k = 0;
-                for (k=0; k<observedObjectsList.size(); k++)
-                {
-                    if (observedObjectsList[k] == currPointIds)
-                    {
-                        // we've already recorded this point, we just update the bounding box
-                        observedObjectsBBs[k] |= Rect2i(Point2i(j,i), Size2i(1,1));
-                        break;
-                    }
-                }
+        for (int j=0; j<classesMat.cols; j++)
+        {
+            if (classesRow[j] == _AnnotationsSet_default_classNoneValue)
+                continue;
 
-                // if the object hasn't been observed yet...
-                if (k==observedObjectsList.size())
+            // consecutive pixels mostly belong to the same object
+            int64_t key = ((int64_t)classesRow[j] << 32) | (uint32_t)idsRow[j];
+            if (key != lastKey)
+            {
+                auto foundObject = observedIndex.find(key);
+                if (foundObject == observedIndex.end())
                 {
                     // we add the new object
-                    observedObjectsList.push_back(currPointIds);
-                    observedObjectsBBs.push_back( Rect2i(Point2i(j,i), Size2i(1,1)) );
+                    foundObject = observedIndex.emplace(key, observedObjectsList.size()).first;
+                    observedObjectsList.push_back(Point2i(classesRow[j], idsRow[j]));
+                    observedBounds.push_back(Vec4i(j, i, j, i));
+                    observedObjectsMoments.push_back(AnnotationMoments());
                 }
 
+                lastKey = key;
+                lastObserved = foundObject->second;
             }
-        }
-    }
-
-
-    // update the contours image
-    if (observedObjectsBBs.size()>0)
-    {
-        // updating it is only useful if there is at least one object!
-        Rect2i contoursROI = observedObjectsBBs[0];
-        for (size_t k=1; k<observedObjectsBBs.size(); k++)
-            contoursROI |= observedObjectsBBs[k];
 
-        this->computeFrameContours(this->currentImgIndex, contoursROI);
+            Vec4i& bounds = observedBounds[lastObserved];
+            bounds[0] = std::min(bounds[0], j);
+            bounds[2] = std::max(bounds[2], j);
+            bounds[3] = i;  // rows are visited in order
+            observedObjectsMoments[lastObserved].addPixel(j, i);
+        }
     }
 
+    for (const Vec4i& bounds: observedBounds)
+        observedObjectsBBs.push_back( Rect2i(Point2i(bounds[0], bounds[1]), Point2i(bounds[2]+1, bounds[3]+1)) );
 
+    return true;
+}
 
 
 
-
-
+void AnnotationsSet::registerObservedObjects(int frameId, const std::vector<cv::Point2i>& observedObjectsList, const std::vector<cv::Rect2i>& observedObjectsBBs,
+                                             const std::vector<AnnotationMoments>& observedObjectsMoments)
+{
     // now checking and/or updating the compliance with the annotations record
 
     // first, perform some sorting... it's better to view the data in a slightly better arrangement
@@ -1844,27 +4729,28 @@ bool AnnotationsSet::loadCurrentAnnotationImage()
         size_t k = orderedObsOvjList[kOrd];
 
         // search the object within the record
-        int recordedInd = this->annotsRecord.searchAnnotation(this->currentImgIndex, observedObjectsList[k].x, observedObjectsList[k].y);
+        int recordedInd = this->annotsRecord.searchAnnotation(frameId, observedObjectsList[k].x, observedObjectsList[k].y);
 
         if (recordedInd == -1)
         {
             // couldn't find it - create it, then
             AnnotationObject annObj;
-            annObj.FrameNumber = this->currentImgIndex;
+            annObj.FrameNumber = frameId;
             annObj.ClassId = observedObjectsList[k].x;
             annObj.ObjectId = observedObjectsList[k].y;
             annObj.BoundingBox = observedObjectsBBs[k];
+            annObj.Moments = observedObjectsMoments[k];
             this->annotsRecord.addNewAnnotation(annObj);
         }
         else
         {
             // update the bounding boxes - probably useless, but sin'ce we've gone this far anyway...
             this->annotsRecord.updateBoundingBox(recordedInd, observedObjectsBBs[k]);
+
+            // the same goes for the moments, which the older files don't have
+            this->annotsRecord.updateMoments(recordedInd, observedObjectsMoments[k]);
         }
     }
-
-
-    return true;
 }
 
 
@@ -1931,38 +4817,40 @@ void AnnotationsSet::interpolateLastBoundingBoxes(int interpolateRecordLength)
     if (actualInterpLength<2)   // doesn't make any sense to continue, we won't have anything to interpolate
         return;
 
-    //const vector<int>& startingFrameObjects = this->annotsRecord.getFrameContentIds(startingFrame);
-    //const vector<int>& endingFrameObjects = this->annotsRecord.getFrameContentIds(this->currentImgIndex);
+    // the interpolated objects are the ones present on both the starting and the ending (current) frame
+    // each of them is then interpolated along its track, which is sorted by frame
+    AnnotationIdsRange endingFrameObjs = this->annotsRecord.getFrameContentIds(this->currentImgIndex);
 
-    // now going through the middle frames
-    for (int i=startingFrame+1; i<this->currentImgIndex; i++)
+    for (size_t k=0; k<endingFrameObjs.size(); k++)
     {
-        float interpFactorEnd = (float)(i-startingFrame) / (float)actualInterpLength;
-        float interpFactorStart = 1. - interpFactorEnd;
+        int endingObjId = endingFrameObjs[k];
 
-        // now looking at all the BB Only objects within the frame
-        const vector<int>& currFrameObjs = this->annotsRecord.getFrameContentIds(i);
+        // storing the current object properties
+        int objClassId = this->annotsRecord.getClassIdsColumn()[endingObjId];
+        int objObjectId = this->annotsRecord.getObjectIdsColumn()[endingObjId];
 
-        for (size_t k=0; k<currFrameObjs.size(); k++)
-        {
-            // storing the current object properties
-            const AnnotationObject& objCharacs = this->annotsRecord.getAnnotationById(currFrameObjs[k]);
+        // we care only about the bounding box only objects
+        if (this->config.getProperty(objClassId).classType != _ACT_BoundingBoxOnly)
+            continue;
 
-            // we care only about the bounding box only objects
-            if (this->config.getProperty(objCharacs.ClassId).classType != _ACT_BoundingBoxOnly)
-                continue;
+        // verify if this particular object has a counterpart on the starting frame - if not, discard
+        int startingObjId = this->annotsRecord.searchAnnotation(startingFrame, objClassId, objObjectId);
+        if (startingObjId==-1)
+            continue;
 
-            // verify if this particular object has both a counterpart on the starting frame and the ending frame
-            int startingObjId = this->annotsRecord.searchAnnotation(startingFrame, objCharacs.ClassId, objCharacs.ObjectId);
-            int endingObjId = this->annotsRecord.searchAnnotation(this->currentImgIndex, objCharacs.ClassId, objCharacs.ObjectId);
+        // storing the starting and ending BBs
+        const Rect2i startingBB = this->annotsRecord.getBoundingBoxesColumn()[startingObjId];
+        const Rect2i endingBB = this->annotsRecord.getBoundingBoxesColumn()[endingObjId];
 
-            // if not, discard
-            if (startingObjId==-1 || endingObjId==-1)
-                continue;
+        // now going through the middle frames where this object is present
+        AnnotationIdsRange middleObjs = this->annotsRecord.getTrackBetween(objClassId, objObjectId, startingFrame+1, this->currentImgIndex-1);
 
-            // storing the starting and ending BBs
-            const Rect2i& startingBB = this->annotsRecord.getAnnotationById(startingObjId).BoundingBox;
-            const Rect2i& endingBB = this->annotsRecord.getAnnotationById(endingObjId).BoundingBox;
+        for (size_t m=0; m<middleObjs.size(); m++)
+        {
+            int i = this->annotsRecord.getFrameNumbersColumn()[middleObjs[m]];
+
+            float interpFactorEnd = (float)(i-startingFrame) / (float)actualInterpLength;
+            float interpFactorStart = 1. - interpFactorEnd;
 
             // perform the actual interpolation
             Rect2i newBB = Rect2i( Point2i( round( (float)startingBB.tl().x * interpFactorStart + (float)endingBB.tl().x * interpFactorEnd),
@@ -1971,7 +4859,7 @@ void AnnotationsSet::interpolateLastBoundingBoxes(int interpolateRecordLength)
                                             round( (float)startingBB.br().y * interpFactorStart + (float)endingBB.br().y * interpFactorEnd) ) );
 
             // store the modification
-            this->annotsRecord.updateBoundingBox(currFrameObjs[k], newBB);
+            this->annotsRecord.updateBoundingBox(middleObjs[m], newBB);
         }
     }
 }
@@ -2082,13 +4970,16 @@ int AnnotationsSet::addAnnotation(const cv::Mat& mask, const cv::Point2i& topLef
         // is it already part of an object of the same class?
 
         // first the safety check
-        if (AnnotationUtilities::isThisPointWithinImageBoundaries(annotStartingPoint, this->getCurrentOriginalImg()))
+        const AnnotationsFrame* frame = this->findCachedFrame(this->currentImgIndex);
+        if (frame && AnnotationUtilities::isThisPointWithinImageBoundaries(annotStartingPoint, frame->originalImage))
         {
             // is it the same class?
-            if (this->getCurrentAnnotationsClasses().at<int16_t>(annotStartingPoint.y, annotStartingPoint.x) == whichClass)
+            int startingClassId, startingObjectId;
+            frame->getPixelAnnotation(annotStartingPoint.y, annotStartingPoint.x, startingClassId, startingObjectId);
+            if (startingClassId == whichClass)
             {
                 // it is : we use the same id, this annotation is an increment to a previous one
-                objectId = this->getCurrentAnnotationsIds().at<int32_t>(annotStartingPoint.y, annotStartingPoint.x);
+                objectId = startingObjectId;
                 usedDefaultObjectId = false;
             }
         }
@@ -2101,116 +4992,42 @@ int AnnotationsSet::addAnnotation(const cv::Mat& mask, const cv::Point2i& topLef
     }
 
 
-    // finding the exact bounding box is yet another task we need to perform there.
+    // find out if we modified some previous annotation by replacing some pixels values,
+    // and finding the exact bounding box is yet another task we need to perform there.
     // What I have implemented using the Qt interface doesn't always return something at pixel precision,
     // so we take the time to compute this again with accuracy
-    int leftMostCoord, rightMostCoord, topMostCoord, bottomMostCoord;
-
-    // giving some "absurd values" to ensure that the min / max things will work well
-    leftMostCoord = topLeftCorner.x + mask.cols;
-    rightMostCoord = topLeftCorner.x;
-    topMostCoord = topLeftCorner.y + mask.rows;
-    bottomMostCoord = topLeftCorner.y;
-
-
-
-    // also, find out if we modified some previous annotation by replacing some pixels values
     vector<Point2i> affectedObjectsList;
     vector<Rect2i> affectedObjectsBBs;
+    vector<AnnotationMoments> removedPixelsMoments;
+    AnnotationMoments writtenPixelsMoments;
 
-    Point2i currClassValues(whichClass, objectId);
-
-    // now filling the matrices, and probing the exact boundary coordinates
-    for (int i=0; i<mask.rows; i++)
-    {
-        for (int j=0; j<mask.cols; j++)
-        {
-            if (mask.at<uchar>(i,j)>0)
-            {
-                // this pixel was annotated
-
-                // perform some safety check, it shouldn't be necessary but ?!
-                if (!AnnotationUtilities::isThisPointWithinImageBoundaries(Point2i(j+topLeftCorner.x, i+topLeftCorner.y), this->getCurrentAnnotationsClasses()))
-                    continue;
-
-
-                // store the pixel into the list of affected objects in case it was a pixel with something on it
-                if (this->accessCurrentAnnotationsClasses().at<int16_t>(i+topLeftCorner.y, j+topLeftCorner.x) != _AnnotationsSet_default_classNoneValue)
-                {
-                    // this Point2i object stores the class and the object id
-                    Point2i currObjectIds = Point2i( this->accessCurrentAnnotationsClasses().at<int16_t>(i+topLeftCorner.y, j+topLeftCorner.x),
-                                                     this->accessCurrentAnnotationsIds().at<int32_t>(i+topLeftCorner.y, j+topLeftCorner.x) );
-
-
-                    if ( this->config.getProperty(currObjectIds.x).locked ||
-                         this->annotsRecord.getAnnotationById(this->annotsRecord.searchAnnotation(this->currentImgIndex, currObjectIds.x, currObjectIds.y)).locked )
-                        // the object or the class is locked - avoid
-                        continue;
-
-
-                    // is it different from the one we're annotating right now?
-                    if (currObjectIds != currClassValues)
-                    {
-                        // check whether it's already in our list of modified objects
-                        bool noPreviousExample = true;
-                        for (size_t k=0; k<affectedObjectsList.size(); k++)
-                        {
-                            if (affectedObjectsList[k] == currObjectIds)
-                            {
-                                // yes - update the bounding box
-                                noPreviousExample = false;
-                                affectedObjectsBBs[k] |= Rect2i(Point2i(j+topLeftCorner.x, i+topLeftCorner.y), Size2i(1,1));
-                                break;
-                            }
-                        }
-
-                        // no - record that this object was affected by the delete pixels procedure and give it a one-pixel wide BB
-                        if (noPreviousExample)
-                        {
-                            affectedObjectsList.push_back(currObjectIds);
-                            affectedObjectsBBs.push_back( Rect2i(Point2i(j+topLeftCorner.x, i+topLeftCorner.y), Size2i(1,1)) );
-                        }
-                    }
-                }
+    Rect2i writtenBB = this->applyMaskToCurrentFrame(mask, topLeftCorner, whichClass, objectId, affectedObjectsList, affectedObjectsBBs,
+                                                     removedPixelsMoments, writtenPixelsMoments);
 
-
-                // update the current object bounding box
-                if (j+topLeftCorner.x < leftMostCoord)
-                    leftMostCoord = j+topLeftCorner.x;
-                if (j+topLeftCorner.x > rightMostCoord)
-                    rightMostCoord = j+topLeftCorner.x;
-                if (i+topLeftCorner.y < topMostCoord)
-                    topMostCoord = i+topLeftCorner.y;
-                if (i+topLeftCorner.y > bottomMostCoord)
-                    bottomMostCoord = i+topLeftCorner.y;
-
-
-                // finally filling the pixels with the right values
-                this->accessCurrentAnnotationsClasses().at<int16_t>(i+topLeftCorner.y, j+topLeftCorner.x) = whichClass;
-                this->accessCurrentAnnotationsIds().at<int32_t>(i+topLeftCorner.y, j+topLeftCorner.x) = objectId;
-            }
-        }
-    }
+    if (writtenBB.area() <= 0)
+        // every pixel was either outside of the image or locked
+        return -1;
 
 
     // store everything correctly
     AnnotationObject newAnnot;
-    newAnnot.BoundingBox = cv::Rect2i(Point2i(leftMostCoord, topMostCoord), Point2i(rightMostCoord+1, bottomMostCoord+1));  // we set +1 to the BR corner because this corner is not inclusive
+    newAnnot.BoundingBox = writtenBB;
+    newAnnot.Moments = writtenPixelsMoments;    // only the pixels which didn't belong to the object yet, in case this is an update
     newAnnot.ClassId = whichClass;
     newAnnot.ObjectId = objectId;
     newAnnot.FrameNumber = this->currentImgIndex;
 
 
-    // we're going to compute the contours
+    // the contours are computed again when they're read
     // since the new annot may have affected surrounding objects, we grow the area by 1 pixel in every direction
-    Rect2i contoursBB = Rect2i(Point2i(leftMostCoord-1, topMostCoord-1), Point2i(rightMostCoord+2, bottomMostCoord+2));
-    this->computeFrameContours(this->currentImgIndex, contoursBB);
+    Rect2i contoursBB = Rect2i(writtenBB.x-1, writtenBB.y-1, writtenBB.width+2, writtenBB.height+2);
+    this->invalidateFrameContours(this->currentImgIndex, contoursBB);
 
 
 
     // handle the cases where we have modified previously recorded objects first
     // (since it may modify the main record indexes, we want to do it before assigning an index to the new object)
-    this->handleAnnotationsModifications(affectedObjectsList, affectedObjectsBBs);
+    this->handleAnnotationsModifications(affectedObjectsList, affectedObjectsBBs, removedPixelsMoments);
 
 
     // specify that we have changed something to the image
@@ -2246,66 +5063,24 @@ void AnnotationsSet::removePixelsFromAnnotations(const cv::Mat& mask, const cv::
 
 
     // first removing the pixels within the images... this is pretty straightforward...
-    for (int i=0; i<mask.rows; i++)
-    {
-        for (int j=0; j<mask.cols; j++)
-        {
-            if (mask.at<uchar>(i,j)>0)
-            {
-                // this pixel was stored as "to erase"
-
-                // perform some safety check, it shouldn't be necessary but ?!
-                if (!AnnotationUtilities::isThisPointWithinImageBoundaries(Point2i(j+topLeftCorner.x, i+topLeftCorner.y), this->getCurrentAnnotationsClasses()))
-                    continue;
-
-                // store the pixel into the list of affected objects in case it was a pixel with something on it
-                if (this->accessCurrentAnnotationsClasses().at<int16_t>(i+topLeftCorner.y, j+topLeftCorner.x) != _AnnotationsSet_default_classNoneValue)
-                {
-                    Point2i currObjectIds = Point2i( this->accessCurrentAnnotationsClasses().at<int16_t>(i+topLeftCorner.y, j+topLeftCorner.x),
-                                                     this->accessCurrentAnnotationsIds().at<int32_t>(i+topLeftCorner.y, j+topLeftCorner.x) );
-
-                    if ( this->config.getProperty(currObjectIds.x).locked ||
-                         this->annotsRecord.getAnnotationById(this->annotsRecord.searchAnnotation(this->currentImgIndex, currObjectIds.x, currObjectIds.y)).locked )
-                        // the object or the class is locked - avoid
-                        continue;
-
-                    bool noPreviousExample = true;
-                    for (size_t k=0; k<affectedObjectsList.size(); k++)
-                    {
-                        if (affectedObjectsList[k] == currObjectIds)
-                        {
-                            noPreviousExample = false;
-                            affectedObjectsBBs[k] |= Rect2i(Point2i(j+topLeftCorner.x, i+topLeftCorner.y), Size2i(1,1));
-                            break;
-                        }
-                    }
-
-                    // record that this object was affected by the delete pixels procedure
-                    if (noPreviousExample)
-                    {
-                        affectedObjectsList.push_back(currObjectIds);
-                        affectedObjectsBBs.push_back( Rect2i(Point2i(j+topLeftCorner.x, i+topLeftCorner.y), Size2i(1,1)) );
-                    }
-                }
-
-                this->accessCurrentAnnotationsClasses().at<int16_t>(i+topLeftCorner.y, j+topLeftCorner.x) = _AnnotationsSet_default_classNoneValue;
-                this->accessCurrentAnnotationsIds().at<int32_t>(i+topLeftCorner.y, j+topLeftCorner.x) = _AnnotationsSet_default_classNoneValue; // set this one to 0 as well, not very useful but anyway..
-            }
-        }
-    }
+    // (the object id is set to 0 as well, so that the packed label is 0)
+    vector<AnnotationMoments> removedPixelsMoments;
+    AnnotationMoments writtenPixelsMoments;
+    this->applyMaskToCurrentFrame(mask, topLeftCorner, _AnnotationsSet_default_classNoneValue, _AnnotationsSet_default_classNoneValue,
+                                  affectedObjectsList, affectedObjectsBBs, removedPixelsMoments, writtenPixelsMoments);
 
 
     // specify that we have changed something to the image
     this->changesPerformedUponCurrentAnnot = true;
 
     // now we should spend some time updating the record - we need to find the new bounding boxes, as well as the cases when an object was completely erased
-    this->handleAnnotationsModifications(affectedObjectsList, affectedObjectsBBs);
+    this->handleAnnotationsModifications(affectedObjectsList, affectedObjectsBBs, removedPixelsMoments);
 
 
-    // also compute again the contours thing
+    // also the contours thing, computed again when they're read
     // since the new annot may have affected surrounding objects, we grow the area by 1 pixel in every direction
     Rect2i contoursBB = Rect2i(topLeftCorner.x-1, topLeftCorner.y-1, mask.cols+2, mask.rows+2);
-    this->computeFrameContours(this->currentImgIndex, contoursBB);
+    this->invalidateFrameContours(this->currentImgIndex, contoursBB);
 }
 
 
@@ -2317,6 +5092,9 @@ void AnnotationsSet::removePixelsFromAnnotations(const cv::Mat& mask, const cv::
 
 void AnnotationsSet::mergeAnnotations(const std::vector<int>& annotationsList)
 {
+    // objects are about to disappear, their ids may be given to new ones
+    this->invalidateLockTable();
+
     // determine which classes and which objects we are supposed to merge
     vector<Point2i> listObjects;
     // vector<int> listFrames;
@@ -2327,7 +5105,7 @@ void AnnotationsSet::mergeAnnotations(const std::vector<int>& annotationsList)
     // first run through the annotations that we're supposed to merge
     for (size_t k=0; k<annotationsList.size(); k++)
     {
-        if (annotationsList[k]<0 || annotationsList[k]>=(int)this->annotsRecord.getRecord().size())
+        if (!this->annotsRecord.isAnnotationValid(annotationsList[k]))
             continue;
 
         annotationsListCopy.push_back(annotationsList[k]);
@@ -2339,6 +5117,9 @@ void AnnotationsSet::mergeAnnotations(const std::vector<int>& annotationsList)
         // nothing to do here
         return;
 
+    // the record indices are rebuilt once, at the very end of the procedure
+    this->annotsRecord.beginBatch();
+
     // get to know which objects are different and which are not
     vector<size_t> orderedInds = AnnotationUtilities::sortP2iIndexes(listObjects);
 
@@ -2472,6 +5253,8 @@ void AnnotationsSet::mergeAnnotations(const std::vector<int>& annotationsList)
     // finally erase all of the unnecessary objects
     this->deleteAnnotations(objectsToRemove, true);
 
+    this->annotsRecord.commitBatch();
+
     // don't forget to state that changes were performed!
     this->changesPerformedUponCurrentAnnot = true;
 }
@@ -2483,6 +5266,9 @@ void AnnotationsSet::mergeAnnotations(const std::vector<int>& annotationsList)
 
 void AnnotationsSet::deleteAnnotations(const std::vector<int>& annotationsList, bool onlyFromRecord)
 {
+    // objects are about to disappear, their ids may be given to new ones
+    this->invalidateLockTable();
+
     if (!onlyFromRecord)
     {
         // also remove the annotations from the images
@@ -2533,13 +5319,20 @@ void AnnotationsSet::deleteAnnotations(const std::vector<int>& annotationsList,
 
 void AnnotationsSet::clearCurrentFrame()
 {
+    // objects are about to disappear, their ids may be given to new ones
+    this->invalidateLockTable();
+
     // nullify everything
-    this->accessCurrentAnnotationsClasses() *= 0;
-    this->accessCurrentAnnotationsIds() *= 0;
-    this->accessCurrentContours() *= 0;
+    AnnotationsFrame* frame = this->accessCachedFrame(this->currentImgIndex);
+    if (frame)
+    {
+        frame->resetAnnotationsPlanes(frame->isPacked());
+        frame->contours.setTo(0);
+        frame->dirty = true;
+    }
 
     //store a copy of the list of annotations
-    vector<int> deleteIds = this->annotsRecord.getFrameContentIds(this->currentImgIndex);
+    vector<int> deleteIds = this->annotsRecord.getFrameContentIds(this->currentImgIndex).toVector();
     this->annotsRecord.deleteAnnotationsGroup(deleteIds);
 
     // don't forget to state that changes were performed!
@@ -2554,14 +5347,21 @@ void AnnotationsSet::clearCurrentFrame()
 
 void AnnotationsSet::separateAnnotations(const std::vector<int>& separateList)
 {
+    // the annotation images of other frames are about to be modified : what was decoded ahead may become outdated
+    this->stopDecodeAhead();
+    // objects are given new ids
+    this->invalidateLockTable();
+
     // we store the old object ids
     vector<int> separateListPrevObjIds;
     for (size_t k=0; k<separateList.size(); k++)
         separateListPrevObjIds.push_back(this->annotsRecord.getAnnotationById(separateList[k]).ObjectId);
 
 
-    // for once, we start with the record modification
+    // for once, we start with the record modification - the record indices are rebuilt once, after all of the object ids have been changed
+    this->annotsRecord.beginBatch();
     vector<int> modifiedObjects = this->annotsRecord.separateAnnotations(separateList);
+    this->annotsRecord.commitBatch();
 
     // store the pair formed by prev and new object ids
     vector<Point2i> oldAndNewObjectIds;
@@ -2593,9 +5393,6 @@ void AnnotationsSet::separateAnnotations(const std::vector<int>& separateList)
     int currFrame = -1;
     Mat classesMat, objIdsMat;
 
-    string imgFileName = (this->isVideoOpen() ? this->videoFileName : this->imageFileName);
-    string currannotsFileName;
-
 
     for (size_t k=0; k<orderedByFramesIndexes.size(); k++)
     {
@@ -2604,29 +5401,23 @@ void AnnotationsSet::separateAnnotations(const std::vector<int>& separateList)
             if (classesMat.data)
             {
                 // store the modifications that have been performed before
-                this->saveAnnotationsImageFile(currannotsFileName, classesMat, objIdsMat);
+                this->saveFrameAnnotationsPlanes(currFrame, classesMat, objIdsMat);
 
                 // also updating the buffers
-                if (currFrame>(this->maxImgReached-this->bufferLength) && currFrame<=this->maxImgReached)
-                {
-                    classesMat.copyTo(this->annotationsClassesBuffer[currFrame%this->bufferLength]);
-                    objIdsMat.copyTo(this->annotationsIdsBuffer[currFrame%this->bufferLength]);
-                }
+                this->storeFrameAnnotationsPlanes(currFrame, classesMat, objIdsMat);
             }
 
             // this is the frame we're working on
             currFrame = modifiedFramesAndObjects[orderedByFramesIndexes[k]].x;
-            currannotsFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, imgFileName, currFrame);
 
             // is it in the buffer?
-            if (currFrame>(this->maxImgReached-this->bufferLength) && currFrame<=this->maxImgReached)
+            if (this->isFrameCached(currFrame))
             {
                 // yes - just copy the content of the buffers
-                this->annotationsClassesBuffer[currFrame%this->bufferLength].copyTo(classesMat);
-                this->annotationsIdsBuffer[currFrame%this->bufferLength].copyTo(objIdsMat);
+                this->findCachedFrame(currFrame)->copyAnnotationsPlanesTo(classesMat, objIdsMat);
             }
             else
-                this->loadAnnotationsImageFile(currannotsFileName, classesMat, objIdsMat);
+                this->loadFrameAnnotationsPlanes(currFrame, classesMat, objIdsMat);
         }
 
 
@@ -2644,20 +5435,19 @@ void AnnotationsSet::separateAnnotations(const std::vector<int>& separateList)
                     objIdsMat.at<int32_t>(i,j) = newObjId;
             }
         }
+
+        // the object may touch another one of the same class
+        this->invalidateFrameContours(currFrame, currentAnnotObj.BoundingBox);
     }
 
     // don't forget to store the last result that was not store within the loop in case it's needed
     if (classesMat.data)
     {
         // store the modifications that have been performed before
-        this->saveAnnotationsImageFile(currannotsFileName, classesMat, objIdsMat);
+        this->saveFrameAnnotationsPlanes(currFrame, classesMat, objIdsMat);
 
         // also updating the buffers
-        if (currFrame>(this->maxImgReached-this->bufferLength) && currFrame<=this->maxImgReached)
-        {
-            classesMat.copyTo(this->annotationsClassesBuffer[currFrame%this->bufferLength]);
-            objIdsMat.copyTo(this->annotationsIdsBuffer[currFrame%this->bufferLength]);
-        }
+        this->storeFrameAnnotationsPlanes(currFrame, classesMat, objIdsMat);
     }
 
     // normally, every changes have been recorded already, however it seems more safe to state that changes can have been performed
@@ -2672,6 +5462,11 @@ void AnnotationsSet::separateAnnotations(const std::vector<int>& separateList)
 
 void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList, int classId)
 {
+    // the annotation images of other frames are about to be modified : what was decoded ahead may become outdated
+    this->stopDecodeAhead();
+    // objects are given new ids
+    this->invalidateLockTable();
+
     // well, there are 2 rather different cases for this functionnality
     // 1. the class pointed with classId is uniform : this means that we must merge all of the objects
     // in a single frame to only one object, and perhaps even merge it with an already present one
@@ -2683,7 +5478,7 @@ void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList
 
     for (size_t k=0; k<switchList.size(); k++)
     {
-        if (switchList[k]<0 || switchList[k]>=(int)this->annotsRecord.getRecord().size())
+        if (!this->annotsRecord.isAnnotationValid(switchList[k]))
             continue;
 
         if (this->annotsRecord.getAnnotationById(switchList[k]).ClassId != classId)
@@ -2727,6 +5522,9 @@ void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList
     vector<AnnotationObject> oldObjectsCharacsList;  // oldObjectsCaracs stores the objects characteristics before we modify it into annotsRecord
     vector<int> newObjectIds;
 
+    // the record indices are rebuilt once, at the very end of the procedure
+    this->annotsRecord.beginBatch();
+
     // now handling every frame separately
     for (size_t fr=0; fr<listFrames.size(); fr++)
     {
@@ -2736,19 +5534,14 @@ void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList
         // prepare the image to be modified - we only need to modify the object ids mat
         Mat imToModifyObjIds, imToModifyClasses;
 
-        string imgFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, (this->isVideoOpen() ? this->videoFileName : this->imageFileName), frameNumber);
-
 
         // is it in the buffer?
-        if (frameNumber>(this->maxImgReached-this->bufferLength) && frameNumber<=this->maxImgReached)
-        {
-            this->annotationsClassesBuffer[frameNumber%this->bufferLength].copyTo(imToModifyClasses);
-            this->annotationsIdsBuffer[frameNumber%this->bufferLength].copyTo(imToModifyObjIds);
-        }
+        if (this->isFrameCached(frameNumber))
+            this->findCachedFrame(frameNumber)->copyAnnotationsPlanesTo(imToModifyClasses, imToModifyObjIds);
         else
         {
             // load the images if available
-            this->loadAnnotationsImageFile(imgFileName, imToModifyClasses, imToModifyObjIds);
+            this->loadFrameAnnotationsPlanes(frameNumber, imToModifyClasses, imToModifyObjIds);
         }
 
         // oldObjectsCharacsList is a frame dependent vector
@@ -2850,21 +5643,17 @@ void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList
 
 
         // finally store the result
-        this->saveAnnotationsImageFile(imgFileName, imToModifyClasses, imToModifyObjIds);
+        this->saveFrameAnnotationsPlanes(frameNumber, imToModifyClasses, imToModifyObjIds);
 
         // copy back the data to the buffer in case it was already buffered
-        if (frameNumber>(this->maxImgReached-this->bufferLength) && frameNumber<=this->maxImgReached)
+        if (this->isFrameCached(frameNumber))
         {
-            imToModifyClasses.copyTo(this->annotationsClassesBuffer[frameNumber%this->bufferLength]);
-            imToModifyObjIds.copyTo(this->annotationsIdsBuffer[frameNumber%this->bufferLength]);
+            this->storeFrameAnnotationsPlanes(frameNumber, imToModifyClasses, imToModifyObjIds);
 
             // if we're in the buffer, then we might need to update the contours image
-            if (this->config.getProperty(classId).classType == _ACT_Uniform)
-            {
-                // it is not useful to update contours unless we switch to a uniform class (which would mean that we merge
-                contoursBB = Rect2i(contoursBB.tl().x-1, contoursBB.tl().y-1, contoursBB.size().width+2, contoursBB.size().height+2);
-                this->computeFrameContours(frameNumber, contoursBB);
-            }
+            // (they mostly change when we switch to a uniform class, which means that we merge - marking them is cheap anyway)
+            contoursBB = Rect2i(contoursBB.tl().x-1, contoursBB.tl().y-1, contoursBB.size().width+2, contoursBB.size().height+2);
+            this->invalidateFrameContours(frameNumber, contoursBB);
         }
 
     }
@@ -2873,6 +5662,8 @@ void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList
     // don't forget to remove now useless items
     this->annotsRecord.deleteAnnotationsGroup(deleteIndices);
 
+    this->annotsRecord.commitBatch();
+
     // don't forget to state that changes were performed!
     this->changesPerformedUponCurrentAnnot = true;
 }
@@ -2888,6 +5679,11 @@ void AnnotationsSet::switchAnnotationsToClass(const std::vector<int>& switchList
 
 void AnnotationsSet::mergeIntraFrameAnnotations(int newClassId, int newObjectId, const std::vector<int>& listObjects)
 {
+    // the annotation images of other frames are about to be modified : what was decoded ahead may become outdated
+    this->stopDecodeAhead();
+    // objects are given new ids
+    this->invalidateLockTable();
+
     // some safety check
     if (listObjects.size()<1)
         return;
@@ -2905,8 +5701,6 @@ void AnnotationsSet::mergeIntraFrameAnnotations(int newClassId, int newObjectId,
         // prepare the image to be modified - we only need to modify the object ids mat
         Mat imToModifyObjIds, imToModifyClasses;
 
-        string imgFileName = this->config.getAnnotatedImageFileName(this->imageFilePath, (this->isVideoOpen() ? this->videoFileName : this->imageFileName), frameNumber);
-
 
         // storing the bounding boxes so that we know which region within the image was affected
         Rect2i contoursBB = this->annotsRecord.getAnnotationById(listObjects[0]).BoundingBox;
@@ -2914,15 +5708,12 @@ void AnnotationsSet::mergeIntraFrameAnnotations(int newClassId, int newObjectId,
 
 
         // is it in the buffer?
-        if (frameNumber>(this->maxImgReached-this->bufferLength) && frameNumber<=this->maxImgReached)
-        {
-            this->annotationsClassesBuffer[frameNumber%this->bufferLength].copyTo(imToModifyClasses);
-            this->annotationsIdsBuffer[frameNumber%this->bufferLength].copyTo(imToModifyObjIds);
-        }
+        if (this->isFrameCached(frameNumber))
+            this->findCachedFrame(frameNumber)->copyAnnotationsPlanesTo(imToModifyClasses, imToModifyObjIds);
         else
         {
             // load the images if available
-            this->loadAnnotationsImageFile(imgFileName, imToModifyClasses, imToModifyObjIds);
+            this->loadFrameAnnotationsPlanes(frameNumber, imToModifyClasses, imToModifyObjIds);
         }
 
 
@@ -2958,17 +5749,16 @@ void AnnotationsSet::mergeIntraFrameAnnotations(int newClassId, int newObjectId,
             }
 
             // storing the "upgraded" version of this image
-            this->saveAnnotationsImageFile(imgFileName, imToModifyClasses, imToModifyObjIds);
+            this->saveFrameAnnotationsPlanes(frameNumber, imToModifyClasses, imToModifyObjIds);
 
             // copy back the data to the buffer in case it was already buffered
-            if (frameNumber>(this->maxImgReached-this->bufferLength) && frameNumber<=this->maxImgReached)
+            if (this->isFrameCached(frameNumber))
             {
-                imToModifyClasses.copyTo(this->annotationsClassesBuffer[frameNumber%this->bufferLength]);
-                imToModifyObjIds.copyTo(this->annotationsIdsBuffer[frameNumber%this->bufferLength]);
+                this->storeFrameAnnotationsPlanes(frameNumber, imToModifyClasses, imToModifyObjIds);
 
                 // this is where the contoursBB thing appears
                 contoursBB = Rect2i(contoursBB.tl().x-1, contoursBB.tl().y-1, contoursBB.size().width+2, contoursBB.size().height+2);
-                this->computeFrameContours(frameNumber, contoursBB);
+                this->invalidateFrameContours(frameNumber, contoursBB);
             }
         }
     }
@@ -2991,99 +5781,385 @@ void AnnotationsSet::mergeIntraFrameAnnotations(int newClassId, int newObjectId,
 
 
 
-void AnnotationsSet::computeFrameContours(int frameId, const cv::Rect2i& ROI)
+void AnnotationsSet::invalidateFrameContours(int frameId, const cv::Rect2i& ROI)
 {
     // verifying that the frameId makes sense
     if (frameId==-1)
         frameId = this->currentImgIndex;
-    else if ((frameId<=this->maxImgReached-this->bufferLength) || (frameId>this->maxImgReached))
+
+    AnnotationsFrame* frame = this->accessCachedFrame(frameId);
+    if (!frame)
         return;
 
+    // using the whole image by default
+    if (ROI == cv::Rect2i(-3,-3,0,0))
+        invalidateContours(*frame, Rect2i(Point2i(0, 0), frame->getSize()));
+    else
+        invalidateContours(*frame, ROI);
+}
+
 
-    // simply fills a
-    Rect2i currentROI = ROI;
 
-    if (ROI == cv::Rect2i(-3,-3,0,0))
+void AnnotationsSet::invalidateContours(AnnotationsFrame& frame, const cv::Rect2i& ROI)
+{
+    // checking that the image is already filled correctly
+    if (!frame.contours.data)
+        frame.contours = Mat::zeros(frame.getSize(), CV_8UC1);
+
+    int tilesCols = (frame.getSize().width + _AnnotationsSet_contoursTileSize - 1) / _AnnotationsSet_contoursTileSize;
+    int tilesRows = (frame.getSize().height + _AnnotationsSet_contoursTileSize - 1) / _AnnotationsSet_contoursTileSize;
+    frame.dirtyContoursTiles.resize(tilesCols*tilesRows, 0);
+
+    // the contour of a pixel depends on its 8 neighbours
+    Rect2i dirtyArea = Rect2i(ROI.x-1, ROI.y-1, ROI.width+2, ROI.height+2) & Rect2i(Point2i(0, 0), frame.getSize());
+    if (dirtyArea.area()<=0)
+        return;
+
+    for (int tileRow=dirtyArea.tl().y/_AnnotationsSet_contoursTileSize; tileRow<=(dirtyArea.br().y-1)/_AnnotationsSet_contoursTileSize; tileRow++)
+        for (int tileCol=dirtyArea.tl().x/_AnnotationsSet_contoursTileSize; tileCol<=(dirtyArea.br().x-1)/_AnnotationsSet_contoursTileSize; tileCol++)
+            frame.dirtyContoursTiles[tileRow*tilesCols + tileCol] = 1;
+
+    frame.contoursDirty = true;
+}
+
+
+
+void AnnotationsSet::computeFrameContours(AnnotationsFrame& frame)
+{
+    Rect2i imageArea(Point2i(0, 0), frame.getSize());
+    invalidateContours(frame, imageArea);
+    refreshContours(frame, imageArea);
+}
+
+
+
+void AnnotationsSet::refreshContours(const AnnotationsFrame& frame, const cv::Rect2i& area)
+{
+    if (!frame.contoursDirty)
+        return;
+
+    Rect2i imageArea(Point2i(0, 0), frame.getSize());
+    Rect2i refreshedArea = area & imageArea;
+    if (refreshedArea.area()<=0)
+        return;
+
+    int tilesCols = (imageArea.width + _AnnotationsSet_contoursTileSize - 1) / _AnnotationsSet_contoursTileSize;
+
+    // listing the dirty tiles first, so that they can be spread across the cores
+    std::vector<int> dirtyTiles;
+    for (int tileRow=refreshedArea.tl().y/_AnnotationsSet_contoursTileSize; tileRow<=(refreshedArea.br().y-1)/_AnnotationsSet_contoursTileSize; tileRow++)
+    {
+        for (int tileCol=refreshedArea.tl().x/_AnnotationsSet_contoursTileSize; tileCol<=(refreshedArea.br().x-1)/_AnnotationsSet_contoursTileSize; tileCol++)
+        {
+            if (frame.dirtyContoursTiles[tileRow*tilesCols + tileCol])
+                dirtyTiles.push_back(tileRow*tilesCols + tileCol);
+        }
+    }
+
+    auto computeTiles = [&](const cv::Range& range)
+    {
+        for (int k=range.start; k<range.end; k++)
+        {
+            Rect2i tile((dirtyTiles[k]%tilesCols)*_AnnotationsSet_contoursTileSize, (dirtyTiles[k]/tilesCols)*_AnnotationsSet_contoursTileSize,
+                        _AnnotationsSet_contoursTileSize, _AnnotationsSet_contoursTileSize);
+            computeContours(frame, tile & imageArea);
+        }
+    };
+
+    if ((int)dirtyTiles.size() * _AnnotationsSet_contoursTileSize * _AnnotationsSet_contoursTileSize >= _AnnotationsSet_contoursParallelArea)
+        cv::parallel_for_(cv::Range(0, (int)dirtyTiles.size()), computeTiles);
+    else
+        computeTiles(cv::Range(0, (int)dirtyTiles.size()));
+
+    for (int tileIndex: dirtyTiles)
+        frame.dirtyContoursTiles[tileIndex] = 0;
+
+    // the flag is only dropped once every tile is clean
+    if (refreshedArea == imageArea || std::find(frame.dirtyContoursTiles.begin(), frame.dirtyContoursTiles.end(), 1) == frame.dirtyContoursTiles.end())
+        frame.contoursDirty = false;
+}
+
+
+
+void AnnotationsSet::computeContours(const AnnotationsFrame& frame, const cv::Rect2i& currentROI)
+{
+    // large areas are split by rows across the cores, the rows being independent from each other
+    if (currentROI.area() >= _AnnotationsSet_contoursParallelArea)
     {
-        // using the whole image
-        currentROI = Rect2i(Point2i(0, 0), this->getOriginalImg(frameId).size());
+        cv::parallel_for_(cv::Range(currentROI.tl().y, currentROI.br().y), [&](const cv::Range& rows)
+        {
+            for (int i=rows.start; i<rows.end; i++)
+                computeContoursRow(frame, i, currentROI.tl().x, currentROI.br().x);
+        });
     }
     else
     {
-        // ensuring that the argument passed is well within the boundaries of the image
-        currentROI = ROI & Rect2i(Point2i(0, 0), this->getOriginalImg(frameId).size());
+        for (int i=currentROI.tl().y; i<currentROI.br().y; i++)
+            computeContoursRow(frame, i, currentROI.tl().x, currentROI.br().x);
     }
 
-    // checking that the image is already filled correctly
-    if (!this->annotationsContoursBuffer[frameId % this->bufferLength].data)
+    // that's all folks :)
+}
+
+
+
+void AnnotationsSet::computeContoursRow(const AnnotationsFrame& frame, int row, int startCol, int endCol)
+{
+    // a pixel of an object is part of its contour when it lies at the boundaries of the image,
+    // or when one of its 8 neighbours belongs to another object. The whole row is compared against
+    // the shifted rows above and below without any branch, so that the compiler vectorizes the loops
+    uchar* contoursRow = frame.contours.ptr<uchar>(row);
+
+    // a pixel belongs to an object when its class isn't null - for the packed labels, when the label is at least 1 << shift
+    bool packed = frame.isPacked();
+    const int32_t* labelsRow = packed ? frame.labels.ptr<int32_t>(row) : NULL;
+    const int16_t* classesRow = packed ? NULL : frame.classes.ptr<int16_t>(row);
+    const int32_t minObjectLabel = 1 << _AnnotationsSet_labelsClassShift;
+    auto isObjectPixel = [&](int j) { return (uchar)(packed ? (labelsRow[j] >= minObjectLabel) : (classesRow[j] != 0)); };
+
+    int lastRow = frame.getSize().height -1;
+    int lastCol = frame.getSize().width -1;
+
+    // first and last rows : every pixel of an object is a contour
+    if (row==0 || row==lastRow)
     {
-        this->annotationsContoursBuffer[frameId % this->bufferLength] = Mat::zeros(this->getOriginalImg(frameId).size(), CV_8UC1);
+        for (int j=startCol; j<endCol; j++)
+            contoursRow[j] = isObjectPixel(j);
+        return;
     }
 
-    // storing useful data and pointers for more readability...
-    const Mat& currClasses = this->annotationsClassesBuffer[frameId % this->bufferLength];
-    const Mat& currObjIds = this->annotationsIdsBuffer[frameId % this->bufferLength];
-    Mat& currContours = this->annotationsContoursBuffer[frameId % this->bufferLength];
+    // same thing for the first and last columns
+    if (startCol==0)
+    {
+        contoursRow[0] = isObjectPixel(0);
+        startCol = 1;
+    }
 
-    int lastRow = this->getOriginalImg(frameId).rows -1;
-    int lastCol = this->getOriginalImg(frameId).cols -1;
+    if (endCol==lastCol+1)
+    {
+        contoursRow[lastCol] = isObjectPixel(lastCol);
+        endCol = lastCol;
+    }
 
-    // now running through the selected area
-    for (int i=currentROI.tl().y; i<currentROI.br().y; i++)
+    if (packed)
     {
-        for (int j=currentROI.tl().x; j<currentROI.br().x; j++)
+        // a single comparison per neighbour
+        const int32_t* upRow = frame.labels.ptr<int32_t>(row-1);
+        const int32_t* currRow = labelsRow;
+        const int32_t* downRow = frame.labels.ptr<int32_t>(row+1);
+
+        for (int j=startCol; j<endCol; j++)
         {
-            // default : not part of a contour
-            currContours.at<uchar>(i,j) = 0;
+            int32_t label = currRow[j];
+            int differentObject = (upRow[j-1]!=label) | (upRow[j]!=label) | (upRow[j+1]!=label) |
+                                  (currRow[j-1]!=label) | (currRow[j+1]!=label) |
+                                  (downRow[j-1]!=label) | (downRow[j]!=label) | (downRow[j+1]!=label);
 
-            // is it some part of an object?
-            if (currClasses.at<int16_t>(i,j) != 0)
-            {
-                // yes
-                if (i==0 || i==lastRow || j==0 || j==lastCol)
-                {
-                    // we are necessarily at the boundaries of the image, it's a contour
-                    currContours.at<uchar>(i,j) = 1;
-                    continue;   // no need to go further...!
-                }
+            contoursRow[j] = (uchar)((label >= minObjectLabel) & differentObject);
+        }
+    }
+    else
+    {
+        // both the classes and the ids have to be compared
+        const int16_t* upClasses = frame.classes.ptr<int16_t>(row-1);
+        const int16_t* downClasses = frame.classes.ptr<int16_t>(row+1);
+        const int32_t* upIds = frame.ids.ptr<int32_t>(row-1);
+        const int32_t* currIds = frame.ids.ptr<int32_t>(row);
+        const int32_t* downIds = frame.ids.ptr<int32_t>(row+1);
+
+        for (int j=startCol; j<endCol; j++)
+        {
+            int16_t classId = classesRow[j];
+            int32_t objId = currIds[j];
+            int differentClass = (upClasses[j-1]!=classId) | (upClasses[j]!=classId) | (upClasses[j+1]!=classId) |
+                                 (classesRow[j-1]!=classId) | (classesRow[j+1]!=classId) |
+                                 (downClasses[j-1]!=classId) | (downClasses[j]!=classId) | (downClasses[j+1]!=classId);
+            int differentId = (upIds[j-1]!=objId) | (upIds[j]!=objId) | (upIds[j+1]!=objId) |
+                              (currIds[j-1]!=objId) | (currIds[j+1]!=objId) |
+                              (downIds[j-1]!=objId) | (downIds[j]!=objId) | (downIds[j+1]!=objId);
+
+            contoursRow[j] = (uchar)((classId != 0) & (differentClass | differentId));
+        }
+    }
+}
 
-                // ok, need to check the surrounding pixels
-                // fortunately, we already have handled the case when we're at the borders of the image
 
-                bool alreadySolved = false;
 
-                int currClass = currClasses.at<int16_t>(i,j);
-                int currObjId = currObjIds.at<int32_t>(i,j);
 
-                // evaluating the surrounding pixels
-                for (int u=i-1; u<=i+1; u++)
-                {
-                    for (int v=j-1; v<=j+1; v++)
-                    {
-                        if (u==i && v==j)
-                            continue;
 
-                        // one object different is enough
-                        if (currClasses.at<int16_t>(u,v)!=currClass || currObjIds.at<int32_t>(u,v)!=currObjId)
-                        {
-                            currContours.at<uchar>(i,j) = 1;    // store the result
-                            alreadySolved = true;   // end the loops
-                            break;
-                        }
-                    }
 
-                    if (alreadySolved)
-                        break;
-                }
-            }
+string AnnotationsSet::getFrameAnnotationImageFileName(int frameId) const
+{
+    // the file names only are read : the decode-ahead thread relies on this as well
+    return this->config.getAnnotatedImageFileName(this->imageFilePath, (this->videoFileName.length()>0 ? this->videoFileName : this->imageFileName), frameId);
+}
+
+
+string AnnotationsSet::getFrameLabelsFileName(int frameId) const
+{
+    return this->config.getLabelsFileName(this->imageFilePath, (this->videoFileName.length()>0 ? this->videoFileName : this->imageFileName), frameId);
+}
+
+
+
+void AnnotationsSet::loadFrameAnnotationsPlanes(int frameId, cv::Mat& classesMat, cv::Mat& objIdsMat) const
+{
+    // the labels file is the reference when there's one, the annotation image was written by an older configuration otherwise
+    string labelsFileName = this->getFrameLabelsFileName(frameId);
+    string annotationImageFileName = this->getFrameAnnotationImageFileName(frameId);
+
+    if (labelsFileName.length()>0)
+    {
+        this->waitForSaveBehind(labelsFileName);
+        if (readLabelsFile(labelsFileName, classesMat, objIdsMat))
+            return;
+    }
+
+    this->waitForSaveBehind(annotationImageFileName);
+    this->loadAnnotationsImageFile(annotationImageFileName, classesMat, objIdsMat);
+}
+
+
+void AnnotationsSet::saveFrameAnnotationsPlanes(int frameId, const cv::Mat& classesMat, const cv::Mat& objIdsMat) const
+{
+    if (!classesMat.data || (classesMat.size() != objIdsMat.size()))
+        return;
+
+    string savingFileName = this->getFrameLabelsFileName(frameId);
+    bool labelsFile = (savingFileName.length()>0);
+    if (!labelsFile)
+        savingFileName = this->getFrameAnnotationImageFileName(frameId);
+
+    // if there is no such file already, don't create one if there's no pixel-level class at all
+    bool emptyFile = !QtCvUtils::fileExists(savingFileName);
+
+    for (int k=1; k<=this->config.getPropsNumber(); k++)
+    {
+        AnnotationClassType classType = this->config.getProperty(k).classType;
+        if ((classType != _ACT_BoundingBoxOnly) && (classType != _ACT_CentroidFrontOnly))
+            emptyFile = false;
+    }
+
+    if (emptyFile)
+        return;
+
+    this->queueFramePlanesSave(savingFileName, labelsFile, classesMat, objIdsMat);
+}
+
+
+
+bool AnnotationsSet::writeLabelsFile(const std::string& fileName, const cv::Mat& classesMat, const cv::Mat& objIdsMat)
+{
+    if (!classesMat.data || (classesMat.size() != objIdsMat.size()))
+        return false;
+
+    QtCvUtils::generatePath(fileName);
+
+    std::ofstream fsOut(fileName, std::ios::binary | std::ios::trunc);
+    if (!fsOut.is_open())
+        return false;
+
+    uint32_t header[4] = { _AnnotationsSet_labelsFileMagic, _AnnotationsSet_labelsFileVersion, (uint32_t)classesMat.cols, (uint32_t)classesMat.rows };
+    fsOut.write((const char*)header, sizeof(header));
+
+    // the runs of a row are gathered before being written at once
+    vector<int32_t> runsLengths;
+    vector<int16_t> runsClasses;
+    vector<int32_t> runsIds;
+
+    for (int i=0; i<classesMat.rows; i++)
+    {
+        const int16_t* classesRow = classesMat.ptr<int16_t>(i);
+        const int32_t* idsRow = objIdsMat.ptr<int32_t>(i);
+
+        runsLengths.clear();
+        runsClasses.clear();
+        runsIds.clear();
+
+        int runStart = 0;
+        for (int j=1; j<=classesMat.cols; j++)
+        {
+            if ((j<classesMat.cols) && (classesRow[j]==classesRow[runStart]) && (idsRow[j]==idsRow[runStart]))
+                continue;
+
+            runsLengths.push_back(j-runStart);
+            runsClasses.push_back(classesRow[runStart]);
+            runsIds.push_back(idsRow[runStart]);
+            runStart = j;
         }
+
+        uint32_t runsNumber = (uint32_t)runsLengths.size();
+        fsOut.write((const char*)&runsNumber, sizeof(runsNumber));
+        fsOut.write((const char*)runsLengths.data(), runsNumber*sizeof(int32_t));
+        fsOut.write((const char*)runsClasses.data(), runsNumber*sizeof(int16_t));
+        fsOut.write((const char*)runsIds.data(), runsNumber*sizeof(int32_t));
     }
 
-    // that's all folks :)
+    return fsOut.good();
 }
 
 
+bool AnnotationsSet::readLabelsFile(const std::string& fileName, cv::Mat& classesMat, cv::Mat& objIdsMat, const cv::Size& expectedSize)
+{
+    std::ifstream fsIn(fileName, std::ios::binary);
+    if (!fsIn.is_open())
+        return false;
+
+    uint32_t header[4];
+    if (!fsIn.read((char*)header, sizeof(header)) || (header[0] != _AnnotationsSet_labelsFileMagic) || (header[1] != _AnnotationsSet_labelsFileVersion))
+        return false;
+
+    int cols = (int)header[2], rows = (int)header[3];
+    if ((cols<=0) || (rows<=0) || ((expectedSize.area()>0) && (expectedSize != Size(cols, rows))))
+        return false;
+
+    // the planes are left untouched as long as they have the right size
+    classesMat.create(rows, cols, CV_16SC1);
+    objIdsMat.create(rows, cols, CV_32SC1);
+
+    // a truncated or corrupted file doesn't leave half of the planes behind
+    auto rejectFile = [&]() { classesMat.setTo(0); objIdsMat.setTo(0); return false; };
+
+    vector<int32_t> runsLengths;
+    vector<int16_t> runsClasses;
+    vector<int32_t> runsIds;
+
+    for (int i=0; i<rows; i++)
+    {
+        uint32_t runsNumber = 0;
+        if (!fsIn.read((char*)&runsNumber, sizeof(runsNumber)) || (runsNumber>(uint32_t)cols))
+            return rejectFile();
+
+        runsLengths.resize(runsNumber);
+        runsClasses.resize(runsNumber);
+        runsIds.resize(runsNumber);
+        fsIn.read((char*)runsLengths.data(), runsNumber*sizeof(int32_t));
+        fsIn.read((char*)runsClasses.data(), runsNumber*sizeof(int16_t));
+        fsIn.read((char*)runsIds.data(), runsNumber*sizeof(int32_t));
+        if (!fsIn)
+            return rejectFile();
+
+        int16_t* classesRow = classesMat.ptr<int16_t>(i);
+        int32_t* idsRow = objIdsMat.ptr<int32_t>(i);
+
+        int j = 0;
+        for (uint32_t r=0; r<runsNumber; r++)
+        {
+            // a corrupted run would write outside of the row
+            if ((runsLengths[r]<=0) || (runsLengths[r]>cols-j))
+                return rejectFile();
+
+            std::fill(classesRow+j, classesRow+j+runsLengths[r], runsClasses[r]);
+            std::fill(idsRow+j, idsRow+j+runsLengths[r], runsIds[r]);
+            j += runsLengths[r];
+        }
+
+        if (j != cols)
+            return rejectFile();
+    }
 
+    return true;
+}
 
 
 
@@ -3103,80 +6179,109 @@ void AnnotationsSet::loadAnnotationsImageFile(const std::string& fileName, cv::M
     if (!imLoad.data)
         return;
 
-    // look at the config and record the minColorIndex and the maxColorIndex, it is faster
-    vector<Vec3b> minColorIndex, maxColorIndex;
-    vector<Vec3i> multipliersIndex;
-    vector<bool> classUniform;
+    // initialize classesMat and objIdsMat
+    classesMat = Mat::zeros(imLoad.size(), CV_16SC1);
+    objIdsMat = Mat::zeros(imLoad.size(), CV_32SC1);
+
+
+    // read the image content...
+    decodeAnnotationsImage(this->getColorDecoder(), imLoad, classesMat, objIdsMat);
+
+    // that's all
+}
+
+
+
+
+
 
-    // fill the vectors..
-    for (int i=0; i<this->config.getPropsNumber(); i++)
+
+AnnotationsColorDecoder AnnotationsSet::getColorDecoder() const
+{
+    AnnotationsColorDecoder decoder;
+
+    int classesNumber = this->config.getPropsNumber();
+    decoder.wordsNumber = (classesNumber+63)/64;
+    for (int c=0; c<3; c++)
+        decoder.channelsMasks[c].assign(256*decoder.wordsNumber, 0);
+
+    decoder.minColors.assign(classesNumber, Vec3b(0,0,0));
+    decoder.multipliers.assign(classesNumber, Vec3i(0,0,0));
+
+    for (int k=0; k<classesNumber; k++)
     {
-        classUniform.push_back(this->config.getProperty(i+1).classType==_ACT_Uniform);
+        const AnnotationsProperties& classProps = this->config.getProperty(k+1);
 
-        if (this->config.getProperty(i+1).classType == _ACT_BoundingBoxOnly)
-        {
-            // give an impossible color so that it is not taken into account
-            minColorIndex.push_back(Vec3b(0,0,0));
-            maxColorIndex.push_back(Vec3b(0,0,0));
-            multipliersIndex.push_back(Vec3i(1,1,1));
+        // nothing to look for
+        if (classProps.classType == _ACT_BoundingBoxOnly)
             continue;
-        }
 
-        minColorIndex.push_back(this->config.getProperty(i+1).minIdBGRRecRange);
+        bool classUniform = (classProps.classType == _ACT_Uniform);
 
         // warning : there's an exception when the class is uniform
-        if (classUniform[i])
-            maxColorIndex.push_back(minColorIndex[i]);
-        else
-            maxColorIndex.push_back(this->config.getProperty(i+1).maxIdBGRRecRange);
+        Vec3b minColor = classProps.minIdBGRRecRange;
+        Vec3b maxColor = classUniform ? minColor : classProps.maxIdBGRRecRange;
+
+        // this class accepts every value within [min, max] of each channel
+        for (int c=0; c<3; c++)
+            for (int v=minColor[c]; v<=maxColor[c]; v++)
+                decoder.channelsMasks[c][v*decoder.wordsNumber + k/64] |= ((uint64_t)1 << (k%64));
 
         // already calculate the multipliers
-        multipliersIndex.push_back( Vec3i(1, (maxColorIndex[i][0]-minColorIndex[i][0]+1), (maxColorIndex[i][0]-minColorIndex[i][0]+1)*(maxColorIndex[i][1]-minColorIndex[i][1]+1)) );
+        decoder.minColors[k] = minColor;
+        if (!classUniform)
+            decoder.multipliers[k] = Vec3i(1, (maxColor[0]-minColor[0]+1), (maxColor[0]-minColor[0]+1)*(maxColor[1]-minColor[1]+1));
     }
 
-    // initialize classesMat and objIdsMat
-    classesMat = Mat::zeros(imLoad.size(), CV_16SC1);
-    objIdsMat = Mat::zeros(imLoad.size(), CV_32SC1);
+    return decoder;
+}
 
 
-    // read the image content...
-    for (int i=0; i<imLoad.rows; i++)
+
+int AnnotationsSet::decodeAnnotationsImage(const AnnotationsColorDecoder& decoder, const cv::Mat& encodedIm, cv::Mat& classesMat, cv::Mat& objIdsMat)
+{
+    std::atomic<int> unknownColors(0);
+
+    // the rows are independent from each other
+    cv::parallel_for_(cv::Range(0, encodedIm.rows), [&](const cv::Range& rows)
     {
-        for (int j=0; j<imLoad.cols; j++)
+        for (int i=rows.start; i<rows.end; i++)
         {
-            Vec3b pxValue = imLoad.at<Vec3b>(i,j);
+            const Vec3b* encodedRow = encodedIm.ptr<Vec3b>(i);
+            int16_t* classesRow = classesMat.ptr<int16_t>(i);
+            int32_t* idsRow = objIdsMat.ptr<int32_t>(i);
+
+            // the pixels mostly come in runs of the same color : it is decoded once per run
+            Vec3b lastColor(0,0,0);
+            int lastClass = 0, lastId = 0;
 
-            if (pxValue != Vec3b(0,0,0))    // there is something there..
+            for (int j=0; j<encodedIm.cols; j++)
             {
-                for (int k=0; k<(int)minColorIndex.size(); k++)
+                if (encodedRow[j] != lastColor)
                 {
-                    if ( (pxValue[0]>=minColorIndex[k][0]) && (pxValue[1]>=minColorIndex[k][1]) && (pxValue[2]>=minColorIndex[k][2])
-                         && (pxValue[0]<=maxColorIndex[k][0]) && (pxValue[1]<=maxColorIndex[k][1]) && (pxValue[2]<=maxColorIndex[k][2]) )
-                    {
-                        // we belong to this class
-                        classesMat.at<int16_t>(i,j) = k+1;
-
-                        // if the class uniform, we don't need to do anything else
-                        // if not, however, we need to decode the pixels information
-                        if (!classUniform[k])
-                        {
-                            // this is just a matter of multiplication, nothing fancy here
-                            int objInd = (multipliersIndex[k][0] * (pxValue[0]-minColorIndex[k][0]))
-                                       + (multipliersIndex[k][1] * (pxValue[1]-minColorIndex[k][1]))
-                                       + (multipliersIndex[k][2] * (pxValue[2]-minColorIndex[k][2]));
-
-                            objIdsMat.at<int32_t>(i,j) = objInd;
-                        }
+                    lastColor = encodedRow[j];
 
-                        // there's no need to go any further, we know already the right class and object id
-                        break;
+                    // black stands for the absence of annotation
+                    if (lastColor == Vec3b(0,0,0))
+                    {
+                        lastClass = 0;
+                        lastId = 0;
+                    }
+                    else if (!decoder.decode(lastColor, lastClass, lastId))
+                    {
+                        lastClass = 0;
+                        lastId = 0;
+                        unknownColors++;
                     }
                 }
+
+                classesRow[j] = (int16_t)lastClass;
+                idsRow[j] = lastId;
             }
         }
-    }
+    });
 
-    // that's all
+    return unknownColors;
 }
 
 
@@ -3184,99 +6289,70 @@ void AnnotationsSet::loadAnnotationsImageFile(const std::string& fileName, cv::M
 
 
 
-
-void AnnotationsSet::saveAnnotationsImageFile(const std::string& fileName, const cv::Mat& classesMat, const cv::Mat& objIdsMat) const
+std::vector<AnnotationsClassEncoder> AnnotationsSet::getClassesColorEncoders() const
 {
-    if (!classesMat.data || (classesMat.size() != objIdsMat.size()))
-        return;
+    // indexed by class id - the first one stands for the "none" class
+    std::vector<AnnotationsClassEncoder> encoders(this->config.getPropsNumber()+1);
 
-
-    // look at the config and record the minColorIndex and the maxColorIndex, it is faster
-    vector<Vec3b> minColorIndex, maxColorIndex;
-    vector<Vec3i> dividersIndex;
-    vector<bool> classUniform;
-
-
-    // if there is no such file already, don't create one if there's no pixel-level data in the annotations to store
-    bool emptyImage = !QtCvUtils::fileExists(fileName);
-
-
-    // fill the vectors..
-    for (int i=0; i<this->config.getPropsNumber(); i++)
+    for (int k=1; k<=this->config.getPropsNumber(); k++)
     {
-        classUniform.push_back(this->config.getProperty(i+1).classType==_ACT_Uniform);
+        const AnnotationsProperties& classProps = this->config.getProperty(k);
+        AnnotationsClassEncoder& encoder = encoders[k];
 
-        if ( (this->config.getProperty(i+1).classType == _ACT_BoundingBoxOnly) || (this->config.getProperty(i+1).classType == _ACT_CentroidFrontOnly) )
-        {
-            // give an impossible color so that it is not taken into account
-            minColorIndex.push_back(Vec3b(0,0,0));
-            maxColorIndex.push_back(Vec3b(0,0,0));
-            dividersIndex.push_back(Vec3i(1,1,1));
+        if ( (classProps.classType == _ACT_BoundingBoxOnly) || (classProps.classType == _ACT_CentroidFrontOnly) )
             continue;
-        }
-
-        emptyImage = false;
 
-        minColorIndex.push_back(this->config.getProperty(i+1).minIdBGRRecRange);
+        encoder.pixelLevel = true;
+        encoder.uniform = (classProps.classType == _ACT_Uniform);
+        encoder.minColor = classProps.minIdBGRRecRange;
 
-        // warning : there's an exception when the class is uniform
-        if (classUniform[i])
-            maxColorIndex.push_back(minColorIndex[i]);
-        else
-            maxColorIndex.push_back(this->config.getProperty(i+1).maxIdBGRRecRange);
-
-        // already calculate the dividers
-        dividersIndex.push_back( Vec3i((maxColorIndex[i][0]-minColorIndex[i][0]+1), (maxColorIndex[i][1]-minColorIndex[i][1]+1), (maxColorIndex[i][2]-minColorIndex[i][2]+1)) );
+        // +1 is there because the max value is to be included
+        // anyway, x%1 == 0 and x/1 == x (every range should be positive since we assume that max >= min..!)
+        for (int c=0; c<3; c++)
+            encoder.dividers[c] = encoder.uniform ? 1 : (std::max(0, classProps.maxIdBGRRecRange[c]-classProps.minIdBGRRecRange[c])+1);
     }
 
-
-    // there's no need to go further
-    if (emptyImage)
-        return;
+    return encoders;
+}
 
 
-    // generate the image that we will want to store
-    Mat generateIm = Mat::zeros(classesMat.size(), CV_8UC3);
 
+void AnnotationsSet::encodeAnnotationsImage(const std::vector<AnnotationsClassEncoder>& encoders, const cv::Mat& classesMat, const cv::Mat& objIdsMat, cv::Mat& encodedIm)
+{
+    encodedIm.create(classesMat.size(), CV_8UC3);
 
-    // run through the image content and fill the pixel colors...
-    for (int i=0; i<classesMat.rows; i++)
+    // the rows are independent from each other
+    cv::parallel_for_(cv::Range(0, classesMat.rows), [&](const cv::Range& rows)
     {
-        for (int j=0; j<classesMat.cols; j++)
+        for (int i=rows.start; i<rows.end; i++)
         {
-            if (classesMat.at<int16_t>(i,j) != 0)    // there is something there..
-            {
-                int currClass = classesMat.at<int16_t>(i,j);
+            const int16_t* classesRow = classesMat.ptr<int16_t>(i);
+            const int32_t* idsRow = objIdsMat.ptr<int32_t>(i);
+            Vec3b* encodedRow = encodedIm.ptr<Vec3b>(i);
 
-                if (classUniform[currClass-1])
-                    // simplest case - uniform : we use the min value
-                    generateIm.at<Vec3b>(i,j) = minColorIndex[currClass-1];
-                else
-                {
-                    // hardest case : we have to calculate the Vec3b value
-                    // unlike the saveCurrentAnnot, we cannot calculate it "offline" because we cannot count on the record indexation
-                    Vec3b bytesContent;
-                    int currObjIdRemaining = objIdsMat.at<int32_t>(i,j);
-                    for (size_t c=0; c<3; c++)
-                    {
-                        // +1 is there because the max value is to be included
-                        // anyway, x%1 == 0 and x/1 == x
-                        bytesContent[c] = (uchar) currObjIdRemaining % (dividersIndex[currClass-1][c]);
-                        currObjIdRemaining /= (dividersIndex[currClass-1][c]);
-                    }
+            // the pixels mostly come in runs of the same object : its color is computed once per run
+            int lastClass = 0, lastId = 0;
+            Vec3b lastColor(0,0,0);
 
-                    // fill the color
-                    for (size_t c=0; c<3; c++)
-                    {
-                        generateIm.at<Vec3b>(i,j)[c] = bytesContent[c] + minColorIndex[currClass-1][c];
-                    }
+            for (int j=0; j<classesMat.cols; j++)
+            {
+                int currClass = classesRow[j];
+                if (currClass != lastClass || idsRow[j] != lastId)
+                {
+                    lastClass = currClass;
+                    lastId = idsRow[j];
+
+                    // nothing there, or a class which isn't stored into the images
+                    if (currClass<=0 || currClass>=(int)encoders.size() || !encoders[currClass].pixelLevel)
+                        lastColor = Vec3b(0,0,0);
+                    else
+                        lastColor = encoders[currClass].encode(lastId);
                 }
+
+                encodedRow[j] = lastColor;
             }
         }
-    }
-
-    // finally store the image
-    QtCvUtils::imwrite(fileName, generateIm);
+    });
 }
 
 
@@ -3287,13 +6363,21 @@ void AnnotationsSet::saveAnnotationsImageFile(const std::string& fileName, const
 
 
 
-void AnnotationsSet::handleAnnotationsModifications(const vector<Point2i>& affectedObjectsList, const vector<Rect2i>& affectedObjectsBBs)
+void AnnotationsSet::handleAnnotationsModifications(const vector<Point2i>& affectedObjectsList, const vector<Rect2i>& affectedObjectsBBs,
+                                                    const vector<AnnotationMoments>& removedPixelsMoments)
 {
 
     // if some objects need to be erased, we cannot do it on the fly. We need to wait until the whole procedure has been completed,
     // in order to protect that
     vector<int> eraseList;
 
+    AnnotationsFrame* frame = this->accessCachedFrame(this->currentImgIndex);
+    if (!frame)
+        return;
+
+    // the record indices are rebuilt once, at the very end of the procedure
+    this->annotsRecord.beginBatch();
+
     for (size_t k=0; k<affectedObjectsList.size(); k++)
     {
         // get the ID of the object that was affected
@@ -3307,13 +6391,12 @@ void AnnotationsSet::handleAnnotationsModifications(const vector<Point2i>& affec
         if (recordId == -1)
             continue;
 
+        // the moments simply lose the removed pixels
+        this->annotsRecord.subtractMoments(recordId, removedPixelsMoments[k]);
+
         // store the original annotation BB, we will use it quite extensively..
         Rect2i annotOrigBB = this->annotsRecord.getAnnotationById(recordId).BoundingBox;
 
-        // actually, I had tried something implying less pixels evaluation.
-        // but since we cannot prevent the affected annotations from having some holes,
-        // we're forced to evaluate the whole original annotation area and we cannot just evaluate the modified bounding box
-
         // the only case when we know for sure that we don't have to do any modification is
         // when the modified area is strictly inside the original annotation area
         Rect2i commonBB = annotOrigBB & affectedObjectsBBs[k];
@@ -3324,28 +6407,66 @@ void AnnotationsSet::handleAnnotationsModifications(const vector<Point2i>& affec
              (commonBB.br().y < annotOrigBB.br().y) )
             continue;
 
-        // OK we've handled the easiest case, now we need to run through the whole original area
+        // OK we've handled the easiest case, now we need to find the new boundaries within the original area
         // initiate some boundary variables outside of the area
         int TCoord=annotOrigBB.br().y, BCoord=annotOrigBB.tl().y-1, LCoord=annotOrigBB.br().x, RCoord=annotOrigBB.tl().x-1;
 
-        // now updating all of this mess :)
-        for (int i=annotOrigBB.tl().y; i<annotOrigBB.br().y; i++)
+        int64_t objectKey = ((int64_t)currClassId << 32) | (uint32_t)currObjectId;
+        auto foundOccupancy = frame->occupancy.find(objectKey);
+
+        if (foundOccupancy != frame->occupancy.end())
+        {
+            // the histograms are up to date : only their ends need to be looked at
+            const AnnotationsOccupancy& objectOccupancy = foundOccupancy->second;
+
+            int i = annotOrigBB.tl().y;
+            while (i<annotOrigBB.br().y && objectOccupancy.rowsCount[i]==0)
+                i++;
+
+            if (i<annotOrigBB.br().y)
+            {
+                TCoord = i;
+                for (BCoord=annotOrigBB.br().y-1; objectOccupancy.rowsCount[BCoord]==0; BCoord--) {}
+                for (LCoord=annotOrigBB.tl().x; objectOccupancy.colsCount[LCoord]==0; LCoord++) {}
+                for (RCoord=annotOrigBB.br().x-1; objectOccupancy.colsCount[RCoord]==0; RCoord--) {}
+            }
+        }
+        else
         {
-            for (int j=annotOrigBB.tl().x; j<annotOrigBB.br().x; j++)
+            // we cannot prevent the affected annotations from having some holes,
+            // so we're forced to evaluate the whole original annotation area and we cannot just evaluate the modified bounding box.
+            // The occupancy histograms are built along the way, so that this happens once per object
+            AnnotationsOccupancy& objectOccupancy = frame->occupancy[objectKey];
+            objectOccupancy.rowsCount.assign(frame->getSize().height, 0);
+            objectOccupancy.colsCount.assign(frame->getSize().width, 0);
+
+            // now updating all of this mess :)
+            // a single plane to read when the packed labels are available
+            bool usePackedLabels = frame->isPacked();
+            int32_t currLabel = packLabel(currClassId, currObjectId);
+
+            for (int i=annotOrigBB.tl().y; i<annotOrigBB.br().y; i++)
             {
-                if ( (this->accessCurrentAnnotationsClasses().at<int16_t>(i,j) == currClassId)
-                     && (this->accessCurrentAnnotationsIds().at<int32_t>(i,j) == currObjectId) )
-                    // we found a pixel that corresponds to the object
+                for (int j=annotOrigBB.tl().x; j<annotOrigBB.br().x; j++)
                 {
-                    // update the bounding box
-                    if (j<LCoord)
-                        LCoord = j;
-                    if (j>RCoord)
-                        RCoord = j;
-                    if (i<TCoord)
-                        TCoord = i;
-                    if (i>BCoord)
-                        BCoord = i;
+                    if ( usePackedLabels ? (frame->labels.at<int32_t>(i,j) == currLabel)
+                                         : ( (frame->classes.at<int16_t>(i,j) == currClassId)
+                                             && (frame->ids.at<int32_t>(i,j) == currObjectId) ) )
+                        // we found a pixel that corresponds to the object
+                    {
+                        objectOccupancy.rowsCount[i]++;
+                        objectOccupancy.colsCount[j]++;
+
+                        // update the bounding box
+                        if (j<LCoord)
+                            LCoord = j;
+                        if (j>RCoord)
+                            RCoord = j;
+                        if (i<TCoord)
+                            TCoord = i;
+                        if (i>BCoord)
+                            BCoord = i;
+                    }
                 }
             }
         }
@@ -3353,8 +6474,11 @@ void AnnotationsSet::handleAnnotationsModifications(const vector<Point2i>& affec
         // if the coordinates haven't been touched, then it means that the object has been suppressed
         // this is easy to check with the condition about BCoord/TCoord or LCoord/RCoord - only one of them two is sufficient
         if (TCoord>BCoord)
+        {
             // this is a suppression case - store it for later
             eraseList.push_back(recordId);
+            frame->occupancy.erase(objectKey);
+        }
         else
             // simply update the value with the new ones acquired
             this->annotsRecord.updateBoundingBox( recordId, Rect2i(Point2i(LCoord, TCoord), Point2i(RCoord+1,BCoord+1)) );
@@ -3363,14 +6487,11 @@ void AnnotationsSet::handleAnnotationsModifications(const vector<Point2i>& affec
 
 
     // finally erase the objects that have been completely removed
-    if (eraseList.size()>0)
-    {
-        // as usual, start with the biggest index first
-        sort(eraseList.begin(), eraseList.end());
+    this->annotsRecord.deleteAnnotationsGroup(eraseList);
+    if (eraseList.size())
+        this->invalidateLockTable();
 
-        for (int k=(int)eraseList.size()-1; k>=0; k--)
-            this->annotsRecord.removeAnnotation(eraseList[k]);
-    }
+    this->annotsRecord.commitBatch();
 
 
 }
@@ -7,10 +7,29 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include "QtCvUtils.h"
+#include "ParamsHandler.h"
 
 #include <algorithm>
 #include <numeric>
 #include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <list>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <climits>
+#include <cmath>
 
 
 /*
@@ -163,6 +182,7 @@ const std::string _AnnotsConfig_YAMLKey_ClassesDefs_Node  = "ClassesDefinitions"
 const std::string _AnnotsConfig_YAMLKey_ImageFileNamingRule  = "ImageFilesNamingRule";
 const std::string _AnnotsConfig_YAMLKey_SummaryFileNamingRule  = "SummaryFileNamingRule";
 const std::string _AnnotsConfig_YAMLKey_CsvFileNamingRule  = "CsvFileNamingRule";
+const std::string _AnnotsConfig_YAMLKey_LabelsFileNamingRule  = "LabelsFilesNamingRule";
 
 
 class AnnotationsConfig
@@ -187,8 +207,12 @@ public:
     const std::string& getSummaryFileNamingRule() const { return this->summaryFileNamingRule; }
     void setCsvFileNamingRule(const std::string& rule) { this->csvFileNamingRule = rule; }
     const std::string& getCsvFileNamingRule() const { return this->csvFileNamingRule; }
+    void setLabelsFileNamingRule(const std::string& rule) { this->labelsFileNamingRule = rule; }
+    const std::string& getLabelsFileNamingRule() const { return this->labelsFileNamingRule; }
+    bool useLabelsFiles() const { return this->labelsFileNamingRule.length()>0; }
 
     std::string getAnnotatedImageFileName(const std::string& origImgPath, const std::string& origImgFileName, int frameNumber) const;
+    std::string getLabelsFileName(const std::string& origImgPath, const std::string& origImgFileName, int frameNumber) const;
     std::string getSummaryFileName(const std::string& origImgPath, const std::string& origiImgFileName) const;
     std::string getCsvFileName(const std::string& origImgPath, const std::string& origiImgFileName) const;
 
@@ -211,6 +235,9 @@ private:
     std::string imageFileNamingRule;
     std::string summaryFileNamingRule;
     std::string csvFileNamingRule;
+    std::string labelsFileNamingRule;   // empty : the frames are only stored as color images
+
+    static std::string applyFrameNamingRule(const std::string& rule, const std::string& origImgPath, const std::string& origImgFileName, int frameNumber);
 };
 
 
@@ -232,6 +259,41 @@ const std::string _AnnotObj_YAMLKey_Frame = "Fr";
 const std::string _AnnotObj_YAMLKey_BBox  = "BB";
 const std::string _AnnotObj_YAMLKey_Cntrd = "Ct";
 const std::string _AnnotObj_YAMLKey_Front = "Ft";
+const std::string _AnnotObj_YAMLKey_Moments = "Mo";
+const std::string _AnnotObj_YAMLKey_Locked = "Lk";
+
+
+
+// raw spatial moments of the pixels of an annotation : pixel count, first and second order sums of the coordinates.
+// Integer sums, so that they follow the pixels being added and removed without drifting. Empty for the bounding box classes
+class AnnotationMoments
+{
+public:
+    AnnotationMoments() : m00(0), m10(0), m01(0), m20(0), m11(0), m02(0) {}
+
+    void addPixel(int x, int y) { this->m00++; this->m10+=x; this->m01+=y; this->m20+=(int64_t)x*x; this->m11+=(int64_t)x*y; this->m02+=(int64_t)y*y; }
+    AnnotationMoments& operator+=(const AnnotationMoments& m) { this->m00+=m.m00; this->m10+=m.m10; this->m01+=m.m01; this->m20+=m.m20; this->m11+=m.m11; this->m02+=m.m02; return *(this); }
+    AnnotationMoments& operator-=(const AnnotationMoments& m) { this->m00-=m.m00; this->m10-=m.m10; this->m01-=m.m01; this->m20-=m.m20; this->m11-=m.m11; this->m02-=m.m02; return *(this); }
+
+    bool operator==(const AnnotationMoments& m) const { return (this->m00==m.m00 && this->m10==m.m10 && this->m01==m.m01 && this->m20==m.m20 && this->m11==m.m11 && this->m02==m.m02); }
+    bool operator!=(const AnnotationMoments& m) const { return !(*this == m); }
+
+    bool isEmpty() const { return (this->m00 <= 0); }
+    cv::Point2d getCentroid() const { return this->isEmpty() ? cv::Point2d() : cv::Point2d((double)this->m10/this->m00, (double)this->m01/this->m00); }
+    double getOrientation() const   // angle of the major axis with the x axis, in radians
+    {
+        if (this->isEmpty())
+            return 0;
+
+        cv::Point2d c = this->getCentroid();
+        double mu20 = (double)this->m20/this->m00 - c.x*c.x;
+        double mu11 = (double)this->m11/this->m00 - c.x*c.y;
+        double mu02 = (double)this->m02/this->m00 - c.y*c.y;
+        return 0.5*std::atan2(2*mu11, mu20-mu02);
+    }
+
+    int64_t m00, m10, m01, m20, m11, m02;
+};
 
 
 
@@ -239,8 +301,8 @@ class AnnotationObject
 {
 public:
     AnnotationObject() : ClassId(0), ObjectId(0), FrameNumber(0), locked(false) {}
-    AnnotationObject(const AnnotationObject& ao) : ClassId(ao.ClassId), ObjectId(ao.ObjectId), FrameNumber(ao.FrameNumber), BoundingBox(ao.BoundingBox), Centroid(ao.Centroid), Front(ao.Front), locked(ao.locked) {}
-    AnnotationObject& operator=(const AnnotationObject& ao) { this->ClassId=ao.ClassId; this->ObjectId=ao.ObjectId; this->FrameNumber=ao.FrameNumber; this->BoundingBox=ao.BoundingBox; this->Centroid=ao.Centroid; this->Front=ao.Front; this->locked=ao.locked; return *(this); }
+    AnnotationObject(const AnnotationObject& ao) : ClassId(ao.ClassId), ObjectId(ao.ObjectId), FrameNumber(ao.FrameNumber), BoundingBox(ao.BoundingBox), Centroid(ao.Centroid), Front(ao.Front), Moments(ao.Moments), locked(ao.locked) {}
+    AnnotationObject& operator=(const AnnotationObject& ao) { this->ClassId=ao.ClassId; this->ObjectId=ao.ObjectId; this->FrameNumber=ao.FrameNumber; this->BoundingBox=ao.BoundingBox; this->Centroid=ao.Centroid; this->Front=ao.Front; this->Moments=ao.Moments; this->locked=ao.locked; return *(this); }
 
     void write(cv::FileStorage& fs) const
     {
@@ -249,7 +311,20 @@ public:
                    << _AnnotObj_YAMLKey_Frame << this->FrameNumber
                    << _AnnotObj_YAMLKey_BBox  << this->BoundingBox
                    << _AnnotObj_YAMLKey_Cntrd << this->Centroid
-                   << _AnnotObj_YAMLKey_Front << this->Front<< "}";
+                   << _AnnotObj_YAMLKey_Front << this->Front;
+
+        // the moments only exist for the pixel-level annotations. FileStorage has no 64 bits integers : doubles keep them exact up to 2^53
+        if (!this->Moments.isEmpty())
+        {
+            fs << _AnnotObj_YAMLKey_Moments << "[:" << (double)this->Moments.m00 << (double)this->Moments.m10 << (double)this->Moments.m01
+                                             << (double)this->Moments.m20 << (double)this->Moments.m11 << (double)this->Moments.m02 << "]";
+        }
+
+        // only the locked objects carry the key
+        if (this->locked)
+            fs << _AnnotObj_YAMLKey_Locked << 1;
+
+        fs << "}";
     }
 
     void writeToCsv(std::ostream& fs) const
@@ -264,7 +339,13 @@ public:
            << this->Centroid.x << _annotObj_Csv_FieldSeparator
            << this->Centroid.y << _annotObj_Csv_FieldSeparator
            << this->Front.x << _annotObj_Csv_FieldSeparator
-           << this->Front.y <<  std::endl;
+           << this->Front.y << _annotObj_Csv_FieldSeparator
+           << this->Moments.m00 << _annotObj_Csv_FieldSeparator
+           << this->Moments.m10 << _annotObj_Csv_FieldSeparator
+           << this->Moments.m01 << _annotObj_Csv_FieldSeparator
+           << this->Moments.m20 << _annotObj_Csv_FieldSeparator
+           << this->Moments.m11 << _annotObj_Csv_FieldSeparator
+           << this->Moments.m02 << std::endl;
     }
 
     static void writeCsvHeader(std::ostream& fs)
@@ -279,7 +360,13 @@ public:
            << "Ct_x" << _annotObj_Csv_FieldSeparator
            << "Ct_y" << _annotObj_Csv_FieldSeparator
            << "Ft_x" << _annotObj_Csv_FieldSeparator
-           << "Ft_y" << std::endl;
+           << "Ft_y" << _annotObj_Csv_FieldSeparator
+           << "M00" << _annotObj_Csv_FieldSeparator
+           << "M10" << _annotObj_Csv_FieldSeparator
+           << "M01" << _annotObj_Csv_FieldSeparator
+           << "M20" << _annotObj_Csv_FieldSeparator
+           << "M11" << _annotObj_Csv_FieldSeparator
+           << "M02" << std::endl;
     }
 
     void read(const cv::FileNode& node)
@@ -290,6 +377,24 @@ public:
         node[_AnnotObj_YAMLKey_BBox]  >> this->BoundingBox;
         node[_AnnotObj_YAMLKey_Cntrd] >> this->Centroid;
         node[_AnnotObj_YAMLKey_Front] >> this->Front;
+
+        // older files don't have any moments : they are computed again when the frames are loaded
+        this->Moments = AnnotationMoments();
+        std::vector<double> momentsValues;
+        node[_AnnotObj_YAMLKey_Moments] >> momentsValues;
+        if (momentsValues.size()==6)
+        {
+            this->Moments.m00 = (int64_t)momentsValues[0];
+            this->Moments.m10 = (int64_t)momentsValues[1];
+            this->Moments.m01 = (int64_t)momentsValues[2];
+            this->Moments.m20 = (int64_t)momentsValues[3];
+            this->Moments.m11 = (int64_t)momentsValues[4];
+            this->Moments.m02 = (int64_t)momentsValues[5];
+        }
+
+        int lockedValue = 0;
+        node[_AnnotObj_YAMLKey_Locked] >> lockedValue;
+        this->locked = (lockedValue != 0);
     }
 
     int ClassId;
@@ -297,6 +402,7 @@ public:
     int FrameNumber;
     cv::Rect2i BoundingBox;
     cv::Point2i Centroid, Front;
+    AnnotationMoments Moments;
     bool locked;
 };
 
@@ -319,7 +425,184 @@ public:
 
 const std::string _AnnotsRecord_YAMLKey_Node  = "AnnotationsRecord";
 
+// the record node of the YAML and JSON files is written and parsed on the fly, without FileStorage building the whole document in memory
+// the text is the same as the FileStorage one, byte for byte : same indentation, lines wrapped at the same margin, same numbers format
+const int _AnnotsRecord_textWrapMargin = 71;
+const size_t _AnnotsRecord_textBufferSize = 1 << 20;   // the text is handed over to the stream by blocks of this size
+
+
+
+// composite (frame, class, object) key - an annotation is unique given those 3 values,
+// which allows us to reach it directly instead of scanning the content of its frame
+struct AnnotationKey
+{
+    AnnotationKey(int frameNumber=0, int classId=0, int objectId=0) : FrameNumber(frameNumber), ClassId(classId), ObjectId(objectId) {}
+    AnnotationKey(const AnnotationObject& ao) : FrameNumber(ao.FrameNumber), ClassId(ao.ClassId), ObjectId(ao.ObjectId) {}
+
+    bool operator==(const AnnotationKey& k) const { return (this->FrameNumber==k.FrameNumber && this->ClassId==k.ClassId && this->ObjectId==k.ObjectId); }
+
+    int FrameNumber;
+    int ClassId;
+    int ObjectId;
+};
+
+struct AnnotationKeyHash
+{
+    size_t operator()(const AnnotationKey& k) const
+    {
+        // pack the 3 values into 64 bits (the class Id is small, the object Id rarely goes beyond 24 bits),
+        // then mix them so that consecutive frames / objects don't end up into neighbouring buckets
+        uint64_t h = ((uint64_t)(uint32_t)k.FrameNumber << 32) ^ ((uint64_t)(uint32_t)k.ClassId << 24) ^ (uint64_t)(uint32_t)k.ObjectId;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return (size_t)h;
+    }
+};
+
+
+
+
+// read-only view over a contiguous list of record ids (the content of a frame, or the occurrences of an object)
+// /!\ as for a reference to a vector, it is invalidated by any modification of the record
+
+class AnnotationIdsRange
+{
+public:
+    AnnotationIdsRange() : first(NULL), last(NULL) {}
+    AnnotationIdsRange(const int* first, const int* last) : first(first), last(last) {}
+
+    const int* begin() const { return this->first; }
+    const int* end() const { return this->last; }
+    size_t size() const { return (size_t)(this->last - this->first); }
+    bool empty() const { return (this->first == this->last); }
+    const int& operator[](size_t k) const { return this->first[k]; }
+
+    std::vector<int> toVector() const { return std::vector<int>(this->first, this->last); }    // copy, when the record is about to be modified
+
+private:
+    const int* first;
+    const int* last;
+};
+
+
+
+
+// index from a key (frame number, object id...) to a list of record ids, stored in a flat way (CSR like) :
+// all of the ids are stored in a single vector, sorted by key, and an offsets vector tells where each key starts.
+// Editing a key copies its content into a small overflow table. The overflow is merged back into the flat vectors
+// once it gets too big, so that editing stays cheap and the memory stays compact
 
+const int _AnnotsFlatIndex_default_minEditedRowsBeforeRebuild = 64;
+
+
+class AnnotationsFlatIndex
+{
+public:
+    AnnotationsFlatIndex() : rowsNumber(0) {}
+
+    int getRowsNumber() const { return this->rowsNumber; }      // the highest key + 1
+    AnnotationIdsRange getRow(int key) const;
+
+    void append(int key, int id);           // add an id at the end of the key content
+    void insertSorted(int key, int id, const std::vector<int>& sortingValues);  // add an id, keeping the key content sorted by sortingValues[id] (then by id)
+    bool erase(int key, int id);            // remove an id from the key content - returns false if it wasn't there
+
+    void assign(const std::vector<int>& keys, int minRowsNumber=0);     // build the whole index at once : keys[id] is the key of id (-1 to skip it)
+                                                                        // ids are stored in increasing order within each key
+    void sortRows(const std::vector<int>& sortingValues);               // sort the content of every key by sortingValues[id] (then by id)
+    void exportFlat(std::vector<int>& rowsOffsets, std::vector<int>& rowsIds);  // copy of the flat vectors, once the overflow table is merged into them
+    void importFlat(std::vector<int>& rowsOffsets, std::vector<int>& rowsIds);  // take over flat vectors built elsewhere (their content is swapped in)
+    void clear();
+
+private:
+    std::vector<int>& accessEditedRow(int key);     // copy the key content into the overflow table if not already done
+    void rebuild();                                 // merge the overflow table into the flat vectors
+
+    int rowsNumber;
+    std::vector<int> offsets;       // content of key k is ids[offsets[k]..offsets[k+1]] (when it hasn't been edited since the last rebuild)
+    std::vector<int> ids;
+    std::unordered_map<int, std::vector<int> > editedRows;  // overflow table
+};
+
+
+
+
+// per-frame uniform grid over the annotations areas, so that we don't need to test every object of a frame
+// when looking for the ones located around a given position (hit tests, browser filters, painting...)
+
+const int _AnnotsSpatialIndex_default_cellSize = 64;            // in pixels
+const int _AnnotsSpatialIndex_default_maxCellsPerObject = 64;   // objects covering more cells are stored separately
+
+
+class AnnotationsSpatialIndex
+{
+public:
+    AnnotationsSpatialIndex(int cellSize=_AnnotsSpatialIndex_default_cellSize) : cellSize(cellSize) {}
+
+    void insert(int frameId, int annotationId, const cv::Rect2i& area);
+    void remove(int frameId, int annotationId, const cv::Rect2i& area);    // area has to be the same as the one used when inserting the object
+    std::vector<int> query(int frameId, const cv::Rect2i& area) const;     // returns the candidates (sorted, without doublons) which area may intersect the given one
+                                                                            // it's up to the caller to perform the exact test
+    void clear() { this->framesGrids.clear(); }
+
+private:
+    struct FrameGrid
+    {
+        std::unordered_map<int64_t, std::vector<int> > cells;   // key = packed (cellX, cellY)
+        std::vector<int> largeObjects;                          // objects covering too many cells - always returned as candidates
+    };
+
+    int toCell(int coord) const { return (coord>=0) ? coord/this->cellSize : -((-coord+this->cellSize-1)/this->cellSize); }
+    static int64_t cellKey(int cellX, int cellY) { return ((int64_t)cellY << 32) | (int64_t)(uint32_t)cellX; }
+
+    int cellSize;
+    std::vector<FrameGrid> framesGrids;     // indexed by frame number
+};
+
+
+
+// the journal of the record : its modifications, appended next to the summary file between two full saves of the record
+// the entries are designated by their (frame, class, object) key, which, unlike their record id, survives the compactions
+enum AnnotationsJournalOpType { _AJO_Add, _AJO_UpdateBox, _AJO_UpdateCentroidFront, _AJO_UpdateMoments, _AJO_Lock, _AJO_Remove, _AJO_Relabel };
+const std::string _AnnotsJournal_OpCodes = "ABCMKRL";   // one letter per operation type, starting each line of the journal file
+
+class AnnotationsJournalOp
+{
+public:
+    AnnotationsJournalOp() : type(_AJO_Add), newClassId(0), newObjectId(0) {}
+    AnnotationsJournalOp(AnnotationsJournalOpType t, const AnnotationObject& ao, int newClass=0, int newObject=0) : type(t), annot(ao), newClassId(newClass), newObjectId(newObject) {}
+
+    void writeToStream(std::ostream& fs) const;         // a single line, only made of the values the operation needs
+    bool readFromString(const std::string& line);       // false when the line isn't a complete operation
+
+    AnnotationsJournalOpType type;
+    AnnotationObject annot;         // the entry, once modified. For a relabelling, its key is the one before the operation
+    int newClassId;                 // relabelling only
+    int newObjectId;
+};
+
+
+
+// one entry of the binary record snapshot : fixed width, no padding, so that the rows can be read straight from a mapped file.
+// It holds what the summary file holds for the entry, not more : loading either one gives the same record
+struct AnnotationsSnapshotRow
+{
+    int32_t classId, objectId, frameNumber, locked;
+    int32_t boundingBox[4];     // x, y, width, height
+    int32_t centroid[2];
+    int32_t front[2];
+    int64_t moments[6];         // m00, m10, m01, m20, m11, m02
+};
+
+static_assert(sizeof(AnnotationsSnapshotRow) == 96, "the snapshot rows shall not be padded");
+
+
+// when a batch is committed, the modified entries are reported one by one into the indices if they are few enough
+// (no more than 1/ratio of the record size), otherwise the indices are entirely rebuilt
+const int _AnnotsRecord_default_batchReplayRatio = 16;
 
 class AnnotationsRecord
 {
@@ -327,12 +610,37 @@ public:
     AnnotationsRecord();
     ~AnnotationsRecord();
 
-    const std::vector<AnnotationObject>& getRecord() const;     // access the entire record
-    const std::vector<int>& getAnnotationIds(int classId, int objectId) const;    // retrieve the indices of objects corresponding to a given class and a given object ID.
+    // access the entire record, column by column - all of the columns share the same indexing (i.e. the record ids)
+    // /!\ removed entries are still there until compact() is called (their class id is 0)
+    int getRecordSize() const { return (int)this->classIds.size(); }
+    const std::vector<int>& getClassIdsColumn() const { return this->classIds; }
+    const std::vector<int>& getObjectIdsColumn() const { return this->objectIds; }
+    const std::vector<int>& getFrameNumbersColumn() const { return this->frameNumbers; }
+    const std::vector<cv::Rect2i>& getBoundingBoxesColumn() const { return this->boundingBoxes; }
+    const std::vector<cv::Point2i>& getCentroidsColumn() const { return this->centroids; }
+    const std::vector<cv::Point2i>& getFrontsColumn() const { return this->fronts; }
+    const std::vector<uint8_t>& getLocksColumn() const { return this->locks; }
+    const std::vector<AnnotationMoments>& getMomentsColumn() const { return this->moments; }
+
+    AnnotationIdsRange getAnnotationIds(int classId, int objectId) const;       // retrieve the indices of objects corresponding to a given class and a given object ID.
                                                                                   // several results are possible given they are each located on a separate frame
-    const std::vector<int>& getFrameContentIds(int id) const;   // get all the IDs inside a frame
-    int getRecordedFramesNumber() const { return this->framesIndex.size(); }
-    const AnnotationObject& getAnnotationById(int id) const;    // retrieve a specific object by his ID
+                                                                                  // this is the object track : its content is sorted by frame number
+
+    // object track queries - binary searches within getAnnotationIds
+    int getTrackLength(int classId, int objectId) const { return (int)this->getAnnotationIds(classId, objectId).size(); }
+    AnnotationIdsRange getTrackBetween(int classId, int objectId, int firstFrame, int lastFrame) const;    // the part of the track located within [firstFrame, lastFrame]
+    int searchTrackAtOrBefore(int classId, int objectId, int frameId) const;    // the last annotation of the track located at frameId or before (-1 if none)
+    int searchTrackAtOrAfter(int classId, int objectId, int frameId) const;     // the first annotation of the track located at frameId or after (-1 if none)
+    std::vector<cv::Point2i> getTrackGaps(int classId, int objectId) const;     // the (last frame before, first frame after) pairs surrounding the frames missing within the track
+    AnnotationIdsRange getFrameContentIds(int id) const;        // get all the IDs inside a frame (sorted)
+    std::vector<int> getFrameContentIdsWithin(int id, const cv::Rect2i& area) const;
+                                                                // get the IDs inside a frame which bounding box intersects the area
+                                                                // (the bottom right corner is included, so that CF objects front and centroid are both covered)
+    int getRecordedFramesNumber() const { this->refreshIndices(); return this->framesIndex.getRowsNumber(); }
+    AnnotationObject getAnnotationById(int id) const;           // retrieve a specific object by his ID (assembled from the columns)
+    bool isAnnotationValid(int id) const { return (id>=0 && id<(int)this->classIds.size() && this->classIds[id]>0); }
+                                                                // tells whether the ID corresponds to an existing (i.e. not removed) annotation
+    bool isAnnotationLocked(int id) const { return (this->isAnnotationValid(id) && this->locks[id]!=0); }
 
     int getFirstAvailableObjectId(int classId) const;       // when we want to create a new annotation, we need to know a new object id, given a class.
                                                             // this function allows us to find such an object ID
@@ -342,7 +650,9 @@ public:
     int addNewAnnotation(const AnnotationObject&);                          // push a new annotation object, at the end of the main vector (return its index)
     void updateBoundingBox(int annotationIndex, const cv::Rect2i newBB);    // edit a bounding box given the object ID in the record vector
     void updateCentroidFront(int annotationIndex, const cv::Point2i newCt, const cv::Point2i newFt);    // edit a bounding box given the object ID in the record vector
-    void removeAnnotation(int annotationIndex);                             // remove an annotation given its id in the record vector
+    void updateMoments(int annotationIndex, const AnnotationMoments& newMoments);
+    void subtractMoments(int annotationIndex, const AnnotationMoments& removedPixels);
+    void removeAnnotation(int annotationIndex);                             // remove an annotation given its id in the record vector. The other ids are not affected
     void clearFrame(int frameId);                                           // remove all of the objects included in a given frame
 
 
@@ -356,8 +666,15 @@ public:
 
     void clear();   // the ultimate killer - simply clear all of the vectors
 
+    void beginBatch();  // from there, the frames, objects and spatial indices are no longer maintained after every single modification
+    void commitBatch(); // ... they are rebuilt all at once here. Batches can be nested, only the outermost commit performs the rebuild
+                        // (the keys index and the available object ids are always up to date, reading any other index within a batch rebuilds it first)
 
-    void setObjectLock(int id, bool lock) { if (id<0 || id>=(int)this->record.size()) return; this->record[id].locked = lock; }
+    void compact(); // get rid of the removed entries. /!\ this renumbers the record ids, hence it shall only be called when saving the record
+    int getRemovedAnnotationsNumber() const { return this->removedAnnotationsNumber; }
+
+
+    void setObjectLock(int id, bool lock) { if (!this->isAnnotationValid(id) || (this->locks[id]!=0)==lock) return; this->locks[id] = lock ? 1 : 0; this->logJournalOp(_AJO_Lock, id); }
 
 
     void writeContentToYaml(cv::FileStorage& fs) const;
@@ -365,12 +682,73 @@ public:
 
     void writeContentToCsv(std::ostream& fs) const;
 
+    // every modification is logged into the journal, until it is taken (appended to the journal file) or cleared (the whole record was saved)
+    const std::vector<AnnotationsJournalOp>& getJournal() const { return this->journal; }
+    void takeJournal(std::vector<AnnotationsJournalOp>& ops) { ops.clear(); ops.swap(this->journal); }
+    void clearJournal() { this->journal.clear(); }
+    bool applyJournalOp(const AnnotationsJournalOp& op);   // replays an operation read back from a journal file. False when its entry can't be found
+
+    // the valid entries, copied so that they can be written while the record keeps being modified
+    std::vector<AnnotationObject> getAnnotationsSnapshot() const;
+    static void writeAnnotationsToYaml(cv::FileStorage& fs, const std::vector<AnnotationObject>& annotations);
+    static void writeAnnotationsToCsv(std::ostream& fs, const std::vector<AnnotationObject>& annotations);
+
+    // binary snapshot : the entries as fixed-width rows, followed by the frames and objects indices as they are stored, so that loading it sorts nothing
+    static void writeSnapshotToStream(std::ostream& fs, const std::vector<AnnotationObject>& annotations);
+    bool readSnapshot(const char* data, size_t size);   // the data usually lies within a mapped file. False (and an empty record) when it's inconsistent
+
+    // streaming serialization of the record node as YAML or JSON text, the same as writeAnnotationsToYaml / readContentFromYaml
+    static void writeAnnotationsToText(std::ostream& fs, const std::vector<AnnotationObject>& annotations, bool json);
+    bool readContentFromText(const char* data, size_t size, bool json, size_t& endPosition);   // data starts with the record node key, endPosition is where the node ends
+                                                                                                // False (and an empty record) when the syntax isn't the expected one
+
 
 
 private:
-    std::vector<AnnotationObject> record;           // stores all the objects
-    std::vector< std::vector<int> > framesIndex;    // first index corresponds to the frame number, second index corresponds to the entry index into the record vector
-    std::vector< std::vector< std::vector<int> > > objectsIndex;    // first index = ClassId-1, second index = ObjectId, last index to the position in record
+    // stores all the objects, one column per field - removed ones are kept as tombstones (class id set to 0) until the next compaction
+    std::vector<int> classIds;
+    std::vector<int> objectIds;
+    std::vector<int> frameNumbers;
+    std::vector<cv::Rect2i> boundingBoxes;
+    std::vector<cv::Point2i> centroids;
+    std::vector<cv::Point2i> fronts;
+    std::vector<uint8_t> locks;
+    std::vector<AnnotationMoments> moments;
+
+    int removedAnnotationsNumber;                   // number of tombstones into the columns
+    // the following indices are deferred during a batch, hence mutable : they may be brought up to date by the accessors
+    mutable AnnotationsFlatIndex framesIndex;               // key = frame number, content = entries indices into the columns
+    mutable std::vector<AnnotationsFlatIndex> objectsIndex; // first index = ClassId-1, key = ObjectId, content = positions in the columns
+    mutable AnnotationsSpatialIndex spatialIndex;           // locates the objects of a frame given their bounding box
+
+    int batchDepth;                                 // number of beginBatch() calls not yet committed
+    mutable bool indicesOutdated;                   // some modifications were not reported into the deferred indices
+    mutable std::unordered_map<int, AnnotationObject> batchOriginals;  // record id -> entry as known by the deferred indices (ClassId is 0 if it was not indexed)
+
+    std::vector< std::vector<int> > objectsOccurrences; // first index = ClassId-1, key = ObjectId, content = number of annotations of this object
+    std::vector< std::set<int> > freeObjectIds;    // first index = ClassId-1, contains the object ids lower than objectsOccurrences[ClassId-1].size() which have no occurrence
+                                                    // the lowest one is the answer of getFirstAvailableObjectId
+
+    std::unordered_map<AnnotationKey, int, AnnotationKeyHash> keysIndex;   // (frame, class, object) -> position in the columns. Used by searchAnnotation
+
+    std::vector<AnnotationsJournalOp> journal;      // modifications not yet appended to the journal file
+
+    static cv::Rect2i getIndexedArea(const cv::Rect2i& bb) { return cv::Rect2i(bb.x, bb.y, bb.width+1, bb.height+1); }
+
+    void pushAnnotation(const AnnotationObject& annot);    // append an object at the end of each column
+
+    void indexObject(int annotationIndex, int classId, int objectId);     // add / remove an annotation index into objectsIndex, keeping objectsOccurrences and freeObjectIds up to date
+    void unindexObject(int annotationIndex, int classId, int objectId);
+    void unindexKey(const AnnotationKey& key, int annotationIndex);       // remove a key from keysIndex, only if it still points to annotationIndex
+
+    void rebuildIndices();                          // rebuild all of the indices from the record content, in a few linear passes
+    void rebuildKeysIndex();                        // same, restricted to the keys index, the objects occurrences and the available object ids
+    void rebuildDeferredIndices() const;            // same, restricted to the frames, objects and spatial indices
+    void rebuildSpatialIndex() const;
+    void replayBatchModifications() const;          // report the entries of batchOriginals into the deferred indices, one by one
+    void refreshIndices() const;                    // bring the deferred indices up to date, using one of the two methods above
+    void rememberBatchOriginal(int annotationIndex);    // to be called before modifying an entry - keeps its indexed state when a batch is opened
+    void logJournalOp(AnnotationsJournalOpType type, int annotationIndex, int newClassId=0, int newObjectId=0) { this->journal.push_back(AnnotationsJournalOp(type, this->getAnnotationById(annotationIndex), newClassId, newObjectId)); }
 };
 
 
@@ -384,9 +762,245 @@ private:
 // finally, the class that stores the pixel-level information
 // stores all of the data into images, loads original images or videos (to be annotated), handles the communication with the GUI as well
 
-const int _AnnotationsSet_default_bufferLength = 16;
 const int _AnnotationsSet_default_classNoneValue = 0;
 
+// frames cache : the decoded frames are kept, least recently used first out, as long as they fit into the memory budget
+const int _AnnotationsSet_default_framesCacheBudgetMB = 4096;
+const int _AnnotationsSet_default_seekPreloadedFrames = 16;     // frames decoded before the required one when it has to be read from the video
+const size_t _AnnotationsSet_default_recycledFramesNumber = 2;  // evicted frames kept aside, so that their allocations are reused by the next decoded ones
+const int _AnnotationsSet_default_decodeAheadLength = 4;         // frames decoded by the background thread while the current one is annotated
+
+// packed labels : the class id (high bits) and the object id (low bits) of every pixel stored into a single CV_32SC1 plane,
+// so that "same object?" is a single comparison. It replaces the classes and ids planes, until some value doesn't fit in it
+const int _AnnotationsSet_labelsClassShift = 22;
+const int _AnnotationsSet_labelsMaxClassId = (1 << (31-_AnnotationsSet_labelsClassShift)) - 1;
+const int _AnnotationsSet_labelsMaxObjectId = (1 << _AnnotationsSet_labelsClassShift) - 1;
+const bool _AnnotationsSet_default_usePackedLabels = true;
+
+// contours are tracked per square tile : modifications only mark the tiles they touch, which are computed again when read
+const int _AnnotationsSet_contoursTileSize = 64;
+const int _AnnotationsSet_contoursParallelArea = 256*256;   // areas above which the contours are computed by all the cores
+
+// native labels files : the classes and ids planes stored as they are, every row being run-length encoded
+// header : magic, version, cols, rows - then, for every row : the runs number, the runs lengths (int32), classes (int16) and ids (int32)
+const uint32_t _AnnotationsSet_labelsFileMagic = 0x424C4E41;    // "ANLB"
+const uint32_t _AnnotationsSet_labelsFileVersion = 1;
+
+
+
+
+
+// how the objects of a class are turned into the colors of the annotation images
+class AnnotationsClassEncoder
+{
+public:
+    AnnotationsClassEncoder() : pixelLevel(false), uniform(false), minColor(0,0,0) { this->dividers[0] = this->dividers[1] = this->dividers[2] = 1; }
+
+    // the object id is written in base (max-min+1), one digit per channel, starting with the blue one
+    // (the remaining id is cast to a byte before the modulo, exactly as the images have always been written)
+    cv::Vec3b encode(int objectId) const
+    {
+        if (this->uniform)
+            return this->minColor;
+
+        cv::Vec3b color;
+        for (int c=0; c<3; c++)
+        {
+            color[c] = (uint8_t)(((uint8_t)objectId % this->dividers[c]) + this->minColor[c]);
+            objectId /= this->dividers[c];
+        }
+        return color;
+    }
+
+    bool pixelLevel;        // false for the classes which aren't stored into the images (bounding boxes, centroid-front)
+    bool uniform;
+    cv::Vec3b minColor;
+    int dividers[3];
+};
+
+
+
+
+
+// the other way around : finds the class and the object id of a color of the annotation images.
+// Every channel value gives the set of classes which range contains it, as a bitmask (64 classes per word) :
+// the class of a color is the lowest bit set in the AND of its three masks
+class AnnotationsColorDecoder
+{
+public:
+    AnnotationsColorDecoder() : wordsNumber(0) {}
+
+    bool decode(const cv::Vec3b& color, int& classId, int& objectId) const    // false if no class matches the color
+    {
+        for (int w=0; w<this->wordsNumber; w++)
+        {
+            uint64_t classesMask = this->channelsMasks[0][color[0]*this->wordsNumber+w]
+                                 & this->channelsMasks[1][color[1]*this->wordsNumber+w]
+                                 & this->channelsMasks[2][color[2]*this->wordsNumber+w];
+            if (!classesMask)
+                continue;
+
+            int bit = 0;
+            while (!(classesMask & 1))
+            {
+                classesMask >>= 1;
+                bit++;
+            }
+
+            int k = w*64 + bit;
+            classId = k+1;
+
+            // this is just a matter of multiplication, nothing fancy here
+            objectId = (this->multipliers[k][0] * (color[0]-this->minColors[k][0]))
+                     + (this->multipliers[k][1] * (color[1]-this->minColors[k][1]))
+                     + (this->multipliers[k][2] * (color[2]-this->minColors[k][2]));
+            return true;
+        }
+
+        return false;
+    }
+
+    int wordsNumber;
+    std::vector<uint64_t> channelsMasks[3];     // 256 entries per channel, wordsNumber words per entry
+    std::vector<cv::Vec3b> minColors;           // indexed by class id - 1
+    std::vector<cv::Vec3i> multipliers;         // all of them null for the uniform classes
+};
+
+
+
+
+
+// number of pixels of an object in every row and column of the image : its bounding box is found at the ends of the histograms
+class AnnotationsOccupancy
+{
+public:
+    std::vector<int> rowsCount;
+    std::vector<int> colsCount;
+};
+
+
+
+
+
+// one frame of the cache : the original image along with all of its annotations planes
+class AnnotationsFrame
+{
+public:
+    AnnotationsFrame() : contoursDirty(false), dirty(false) {}
+
+    size_t getBytesNumber() const;
+    void release();
+
+    // the annotations are stored either into the packed labels, or into the classes and ids planes
+    cv::Size getSize() const { return this->originalImage.size(); }
+    bool isPacked() const { return (this->labels.data != NULL); }
+    void resetAnnotationsPlanes(bool packed);   // zero annotations, stored the way it's asked for
+    bool storeAnnotationsPlanes(const cv::Mat& classesMat, const cv::Mat& objIdsMat, bool packed);   // false when some value doesn't fit into the packed labels
+    bool packLabels() { return this->storeAnnotationsPlanes(this->classes, this->ids, true); }
+    void unpackLabels() const;                  // derive the classes and ids planes from the packed labels, if they're not there yet
+    void dropUnpackedPlanes() { if (this->isPacked()) { this->classes.release(); this->ids.release(); } }  // every time the packed labels are written
+    void copyAnnotationsPlanesTo(cv::Mat& classesMat, cv::Mat& objIdsMat) const;
+    void getPixelAnnotation(int i, int j, int& classId, int& objectId) const;
+
+    static bool joinLabels(const cv::Mat& classesMat, const cv::Mat& objIdsMat, cv::Mat& labelsMat);    // false when some value doesn't fit
+    static void splitLabels(const cv::Mat& labelsMat, cv::Mat& classesMat, cv::Mat& objIdsMat);
+
+    cv::Mat originalImage;  // original image, in CV8U_C1 or CV8UC3 (BGR) format
+    mutable cv::Mat classes;    // corresponding class for every pixel, in CV_16SC1 format - only derived on demand from the packed labels when there are some
+    mutable cv::Mat ids;        // corresponding object Id for every pixel, in CV_32SC1 format - same thing
+    mutable cv::Mat contours;   // stores the contours of objects, in CV_8UC1 format - 0 = no contour, anything above = contour. Up to date only outside of the dirty tiles
+    cv::Mat labels;         // packed class and object ids, in CV_32SC1 format - the only annotations storage while packedLabelsEnabled
+
+    mutable std::vector<uint8_t> dirtyContoursTiles;  // one flag per contours tile, row by row
+    mutable bool contoursDirty;                     // at least one of the tiles is dirty
+
+    // key = (class id << 32) | object id. Built for an object the first time its bounding box has to be computed again,
+    // then kept up to date by the mask writes. Dropped whenever the planes are rewritten by other means
+    std::unordered_map<int64_t, AnnotationsOccupancy> occupancy;
+
+    bool dirty;             // the classes and ids may hold changes that are not on the disk yet
+
+    std::list<int>::iterator usePosition;  // position within the least recently used list
+};
+
+
+
+
+
+// a frame prepared by the decode-ahead thread : stepping to it only moves its planes into the frames cache
+class DecodedAheadFrame
+{
+public:
+    DecodedAheadFrame() : frameId(-1) {}
+
+    int frameId;
+    AnnotationsFrame frame;
+
+    std::vector<cv::Point2i> observedObjects;       // (class, object id) couples found in the annotation image, to be checked against the record
+    std::vector<cv::Rect2i> observedBoundingBoxes;
+    std::vector<AnnotationMoments> observedMoments;
+};
+
+
+
+
+
+// a file to be written by the save-behind thread : the writing function holds copies of everything it writes,
+// so that the GUI thread never waits for the disk
+class SaveBehindJob
+{
+public:
+    SaveBehindJob() : atomic(true) {}
+
+    std::string fileName;
+    std::function<bool(const std::string&)> write;     // writes the content into the given file
+    bool atomic;    // the content goes into a temporary file, renamed once complete. Otherwise the file itself is handed (appending to it,
+                    // removing it) and the job is never merged with another one
+};
+
+
+
+
+
+// keyframes of a video : seeking to the closest keyframe before a frame, then decoding only the remaining frames is way faster than
+// decoding the whole video from the start. The index is built once, reading the packets without decoding them, and stored next to the summary file
+
+const std::string _VideoKeyframesIndex_FileNameSuffix = "_keyframes";
+
+const std::string _VideoKeyframesIndex_YAMLKey_Node = "KeyframesIndex";
+const std::string _VideoKeyframesIndex_YAMLKey_VideoFileName = "VideoFileName";
+const std::string _VideoKeyframesIndex_YAMLKey_VideoFileSize = "VideoFileSize";
+const std::string _VideoKeyframesIndex_YAMLKey_Keyframes = "Keyframes";
+const std::string _VideoKeyframesIndex_YAMLKey_Timestamps = "Timestamps";
+
+
+class VideoKeyframesIndex
+{
+public:
+    VideoKeyframesIndex() { this->clear(); }
+
+    void clear();
+    bool isEmpty() const { return (this->keyframes.size()==0); }
+
+    bool scanVideo(const std::string& videoFileName);
+            // needs the raw streams of the FFmpeg backend - the index stays empty if they're not available
+    bool writeToFile(const std::string& fileName) const;
+    bool readFromFile(const std::string& fileName, const std::string& videoFileName);
+            // fails when the stored index was built from another video file
+
+    int searchPrecedingKeyframe(int frameId) const;     // position of the last keyframe at or before frameId, -1 if there's none
+    int getKeyframe(int position) const { return this->keyframes[position]; }
+    double getTimestamp(int position) const { return this->timestamps[position]; }
+
+private:
+    static long long getFileSize(const std::string& fileName);
+
+    std::vector<int> keyframes;         // frame numbers, in display order
+    std::vector<double> timestamps;     // presentation times, in ms - the same as CAP_PROP_POS_MSEC once the frame is decoded
+    std::string videoFileName;
+    long long videoFileSize;
+};
+
 
 
 
@@ -396,32 +1010,65 @@ const std::string _AnnotationsSet_YAMLKey_FilePath  = "FilePath";
 const std::string _AnnotationsSet_YAMLKey_ImageFileName  = "ImageFileName";
 const std::string _AnnotationsSet_YAMLKey_VideoFileName  = "VideoFileName";
 const std::string _AnnotationsSet_YAMLKey_RecordingTimeDate  = "RecordingTimeDate";
+const std::string _AnnotationsSet_YAMLKey_JournalId  = "JournalId";
 
+// the journal file goes next to the summary file it follows up. Its first line holds the journal id of that summary file
+const std::string _AnnotationsSet_JournalFileNameSuffix = "_journal.txt";
+const std::string _AnnotationsSet_JournalHeader = "AnnotationsJournal";
 
+// the binary snapshot of the record goes next to the summary file as well. It's loaded instead of the summary file as long as it belongs to it
+// header : magic, version, then the size and the modification time (ms since epoch) of the summary file written along - the snapshot is rejected
+// when the summary file doesn't match them any more (edited, or replaced by another one, even keeping its date). Then the file path, the image and video file names, the journal id and the configuration (YAML), each one as its length followed by its characters,
+// and finally the record snapshot. Everything is stored in the byte order of the machine : a snapshot from another one is rejected (its magic doesn't match)
+const std::string _AnnotationsSet_RecordSnapshotFileNameSuffix = "_record.bin";
+const uint32_t _AnnotationsSet_recordSnapshotMagic = 0x53524E41;  // "ANRS"
+const uint32_t _AnnotationsSet_recordSnapshotVersion = 3;    // 3 : the locks are in the summary file as well
 
 
 
 
-class AnnotationsSet
+
+
+class AnnotationsSet : public ParamsHandler
 {
 public:
     AnnotationsSet();
     ~AnnotationsSet();
 
+    // the frames cache budget can be modified at any time
+    virtual void setValueCalled(const std::string& paramName);
+
 
     // standard accessors stuff.. those images are returned for index = currentImgIndex
     const cv::Mat& getCurrentOriginalImg() const;
     const cv::Mat& getCurrentAnnotationsClasses() const;
     const cv::Mat& getCurrentAnnotationsIds() const;
     const cv::Mat& getCurrentContours() const;
+    const cv::Mat& getCurrentContours(const cv::Rect2i& area) const;     // only the contours within the area are guaranteed to be up to date
 
 
 
-    // access any image within the buffer
+    // access any image within the frames cache - empty matrices are returned for the frames that aren't cached
+    bool isFrameCached(int id) const { return (this->findCachedFrame(id) != NULL); }
     const cv::Mat& getOriginalImg(int id) const;
     const cv::Mat& getAnnotationsClasses(int id) const;
     const cv::Mat& getAnnotationsIds(int id) const;
     const cv::Mat& getContours(int id) const;
+    const cv::Mat& getContours(int id, const cv::Rect2i& area) const;
+
+
+    // packed labels - available only when hasPackedLabels() is true. The classes and ids planes are then derived from them
+    // whenever they're asked for, until the frame is modified again : the pixel loops had better read the labels
+    bool hasPackedLabels() const { return this->packedLabelsEnabled; }
+    const cv::Mat& getCurrentAnnotationsLabels() const;
+    const cv::Mat& getAnnotationsLabels(int id) const;
+    static bool canPackLabel(int classId, int objectId) { return (classId>=0 && classId<=_AnnotationsSet_labelsMaxClassId && objectId>=0 && objectId<=_AnnotationsSet_labelsMaxObjectId); }
+    static int32_t packLabel(int classId, int objectId) { return (int32_t)((classId << _AnnotationsSet_labelsClassShift) | objectId); }
+    static int unpackLabelClass(int32_t label) { return (int)(label >> _AnnotationsSet_labelsClassShift); }
+    static int unpackLabelObject(int32_t label) { return (int)(label & _AnnotationsSet_labelsMaxObjectId); }
+
+    // every contour of the frame computed again, whatever its dirty tiles - the way the decode-ahead thread prepares a frame
+    static void computeFrameContours(AnnotationsFrame& frame);
 
 
 
@@ -432,7 +1079,8 @@ public:
     int getClosestCFFromPosition(int x, int y, int searchingWindowRadius) const;
 
 
-    const std::vector<int>& getObjectsListOnCurrentFrame() const { return this->annotsRecord.getFrameContentIds(this->currentImgIndex); }
+    AnnotationIdsRange getObjectsListOnCurrentFrame() const { return this->annotsRecord.getFrameContentIds(this->currentImgIndex); }
+    std::vector<int> getObjectsListOnCurrentFrame(const cv::Rect2i& area) const { return this->annotsRecord.getFrameContentIdsWithin(this->currentImgIndex, area); }
 
     int getCurrentFramePosition() const { return this->currentImgIndex; }
 
@@ -461,7 +1109,8 @@ public:
 
 
     bool loadCurrentAnnotationImage();
-    bool saveCurrentAnnotationImage(const std::string& forcedFileName="") const;
+    bool saveCurrentAnnotationImage(const std::string& forcedFileName="") const { return this->saveAnnotationImage(this->currentImgIndex, forcedFileName); }
+    bool saveAnnotationImage(int frameId, const std::string& forcedFileName="") const;
 
 
     void closeFile(bool pleaseSave=false);
@@ -478,8 +1127,8 @@ public:
 
 
 
-    void setObjectLock(int objectId, bool lock) { this->annotsRecord.setObjectLock(objectId, lock); }
-    void setClassLock(int classId, bool lock) { this->config.setClassLock(classId, lock); }
+    void setObjectLock(int objectId, bool lock) { this->annotsRecord.setObjectLock(objectId, lock); this->invalidateLockTable(); }
+    void setClassLock(int classId, bool lock) { this->config.setClassLock(classId, lock); this->invalidateLockTable(); }
 
 
 
@@ -552,58 +1201,150 @@ public:
 
 
 
+protected:
+    virtual void initParamsHandler();
+
 private:
     void setDefaultConfig();
 
 
-    void handleAnnotationsModifications(const std::vector<cv::Point2i>& affectedObjectsList, const std::vector<cv::Rect>& affectedBoundingBoxes);
+    void handleAnnotationsModifications(const std::vector<cv::Point2i>& affectedObjectsList, const std::vector<cv::Rect>& affectedBoundingBoxes,
+                                        const std::vector<AnnotationMoments>& removedPixelsMoments);
                 // when performing a new annotation or removing pixels, we are susceptible of modifying previous annotations or even deleting them
                 // this method is designed to handle such cases
 
 
 
-    void loadAnnotationsImageFile(const std::string& fileName, cv::Mat& classesMat, cv::Mat& objIdsMat) const;
-    void saveAnnotationsImageFile(const std::string& fileName, const cv::Mat& classesMat, const cv::Mat& objIdsMat) const;
-
+    bool decodeAnnotationImage(int frameId, const cv::Size& frameSize, cv::Mat& classesMat, cv::Mat& objIdsMat, std::vector<cv::Point2i>& observedObjectsList,
+                               std::vector<cv::Rect2i>& observedObjectsBBs, std::vector<AnnotationMoments>& observedObjectsMoments) const;
+            // fills the classes and ids planes from the labels file or the annotation image of the frame, and lists the objects found there
+    void registerObservedObjects(int frameId, const std::vector<cv::Point2i>& observedObjectsList, const std::vector<cv::Rect2i>& observedObjectsBBs,
+                                 const std::vector<AnnotationMoments>& observedObjectsMoments);
+            // add the objects to the record, or update their bounding boxes
 
+    std::string getFrameAnnotationImageFileName(int frameId) const;
+    std::string getFrameLabelsFileName(int frameId) const;     // empty when the configuration doesn't ask for labels files
+    void loadFrameAnnotationsPlanes(int frameId, cv::Mat& classesMat, cv::Mat& objIdsMat) const;  // labels file first, annotation image otherwise
+    void saveFrameAnnotationsPlanes(int frameId, const cv::Mat& classesMat, const cv::Mat& objIdsMat) const;
+    static bool writeLabelsFile(const std::string& fileName, const cv::Mat& classesMat, const cv::Mat& objIdsMat);
+    static bool readLabelsFile(const std::string& fileName, cv::Mat& classesMat, cv::Mat& objIdsMat, const cv::Size& expectedSize=cv::Size());
 
-    // used within the class to make easier the modification of both matrices
-    cv::Mat& accessCurrentAnnotationsClasses();
-    cv::Mat& accessCurrentAnnotationsIds();
-    cv::Mat& accessCurrentContours();
+    void loadAnnotationsImageFile(const std::string& fileName, cv::Mat& classesMat, cv::Mat& objIdsMat) const;
+    std::vector<AnnotationsClassEncoder> getClassesColorEncoders() const;     // indexed by class id
+    static void encodeAnnotationsImage(const std::vector<AnnotationsClassEncoder>& encoders, const cv::Mat& classesMat, const cv::Mat& objIdsMat, cv::Mat& encodedIm);
+    AnnotationsColorDecoder getColorDecoder() const;
+    static int decodeAnnotationsImage(const AnnotationsColorDecoder& decoder, const cv::Mat& encodedIm, cv::Mat& classesMat, cv::Mat& objIdsMat);  // returns the number of unknown colors
+
+
+
+    cv::Rect2i applyMaskToCurrentFrame(const cv::Mat& mask, const cv::Point2i& topLeftCorner, int classId, int objectId,   // returns the bounds of the written pixels
+                                       std::vector<cv::Point2i>& affectedObjectsList, std::vector<cv::Rect2i>& affectedObjectsBBs,
+                                       std::vector<AnnotationMoments>& removedPixelsMoments, AnnotationMoments& writtenPixelsMoments);
+    void storeFrameAnnotationsPlanes(int frameId, const cv::Mat& classesMat, const cv::Mat& objIdsMat);  // rewrite the annotations of a cached frame as a whole
+    void disablePackedLabels();                 // used when a value cannot be packed - the frames are stored into classes and ids planes again
+
+
+
+    // frames cache handling
+    // the planes of a frame are only modified through the frame itself : NULL when it's not cached, which every caller checks
+    const AnnotationsFrame* findCachedFrame(int frameId) const;
+    AnnotationsFrame* accessCachedFrame(int frameId) { return const_cast<AnnotationsFrame*>(this->findCachedFrame(frameId)); }
+    AnnotationsFrame& storeFrameIntoCache(int frameId, const cv::Mat& im);  // copy the image and zero the annotations planes, reusing an evicted frame when possible
+    void touchCachedFrame(int frameId);         // mark the frame as the most recently used one
+    void evictCachedFrame(int frameId);         // the annotations planes are written back first when they're dirty
+    void enforceFramesCacheBudget();            // evict the least recently used frames until the cache fits into its budget - the current frame always stays
+    void clearFramesCache();                    // drop every frame, without writing anything back
+    size_t getFramesCacheBytes() const;
+
+    bool loadVideoFrame(int frameId);           // decode a frame, store it into the cache, load its annotations and make it the current frame
+
+    // decode-ahead thread : it owns vidCap while it runs, the GUI thread only takes the frames it has prepared
+    void startDecodeAhead();                    // only when the capture stands past the frames that were already visited
+    void stopDecodeAhead();                     // the prepared frames are dropped
+    void decodeAheadLoop();
+    bool decodeFrameAhead(int frameId, DecodedAheadFrame& decoded);
+    bool takeDecodedAheadFrame(int frameId, DecodedAheadFrame& decoded);  // waits when the frame is being decoded
+    void storeDecodedAheadFrame(DecodedAheadFrame& decoded);            // move the frame into the cache and make it the current frame
+    bool seekVideoToKeyframe(int position);     // position within the keyframes index. Verifies where the capture landed
+
+    std::string getKeyframesIndexFileName() const;
+
+    // save-behind thread : the files are written in the background, in the order they were queued
+    // a file queued again before being written is only written once, with its latest content
+    void queueSaveBehind(const std::string& fileName, const std::function<bool(const std::string&)>& write, bool atomic=true) const;
+    void queueFramePlanesSave(const std::string& fileName, bool labelsFile, const cv::Mat& classesMat, const cv::Mat& objIdsMat) const;
+    void queueFramePlanesSave(const std::string& fileName, bool labelsFile, const AnnotationsFrame& frame) const;   // the packed labels are unpacked by the thread
+    void waitForSaveBehind(const std::string& fileName="") const;  // until the file is written - every queued file when no name is given
+    bool flushSaveBehind() const;               // false when some write failed since the last flush
+    void stopSaveBehind();                      // the queued files are written first
+    void saveBehindLoop() const;
+    static bool writeFileAtomically(const std::string& fileName, const std::function<bool(const std::string&)>& write);
+    static bool isStreamedSummaryFormat(const std::string& fileName, bool& json);     // the record node of the YAML and JSON summary files is streamed
+    bool readSummaryFile(const std::string& fileName, std::string& summaryJournalId);  // sets the file names, the configuration and the record
+    static bool writeSummaryFile(const std::string& fileName, const std::string& filePath, const std::string& imageFileName, const std::string& videoFileName,
+                                 const std::string& recordingTimeDate, const std::string& journalId, const AnnotationsConfig& config, const std::vector<AnnotationObject>& annotations);
+
+    // record journal : between two full saves of the summary file, the autosaves only append the record modifications to its journal
+    void queueJournalAppend();
+    int replayJournal(const std::string& summaryFileName, const std::string& summaryJournalId);    // -1 : no journal, 0 : the journal can't be continued, 1 : replayed
+    static std::string getJournalFileName(const std::string& summaryFileName) { return getSummaryCompanionFileName(summaryFileName, _AnnotationsSet_JournalFileNameSuffix); }
+    static std::string generateJournalId();
+    void forgetJournal() { this->journalSummaryFileName.clear(); this->journalId.clear(); this->journalStarted = false; }   // the next autosave saves the whole record
+
+    // binary record snapshot : written along with every summary file, it spares the parsing of the YAML when the summary file is loaded again
+    static std::string getRecordSnapshotFileName(const std::string& summaryFileName) { return getSummaryCompanionFileName(summaryFileName, _AnnotationsSet_RecordSnapshotFileNameSuffix); }
+    static bool writeRecordSnapshotFile(const std::string& fileName, const std::string& summaryFileName, const std::string& filePath, const std::string& imageFileName, const std::string& videoFileName,
+                                        const std::string& journalId, const AnnotationsConfig& config, const std::vector<AnnotationObject>& annotations);
+    bool readRecordSnapshotFile(const std::string& fileName, const std::string& summaryFileName, std::string& summaryJournalId);   // sets the file names, the configuration and the record
+    static std::string getSummaryCompanionFileName(const std::string& summaryFileName, const std::string& suffix);  // the summary file name, its extension replaced by the suffix
 
 
 
     void mergeIntraFrameAnnotations(int newClassId, int newObjectId, const std::vector<int>& listObjects);
 
-    void computeFrameContours(int frameId=-1, const cv::Rect2i& ROI=cv::Rect2i(-3,-3,0,0));
+    void invalidateFrameContours(int frameId=-1, const cv::Rect2i& ROI=cv::Rect2i(-3,-3,0,0));
+    static void invalidateContours(AnnotationsFrame& frame, const cv::Rect2i& ROI);    // marks the tiles touched by the ROI grown by 1 pixel
+    static void refreshContours(const AnnotationsFrame& frame, const cv::Rect2i& area);  // computes the dirty tiles within the area
+    static void computeContours(const AnnotationsFrame& frame, const cv::Rect2i& ROI);     // ROI within the image boundaries
+    static void computeContoursRow(const AnnotationsFrame& frame, int row, int startCol, int endCol);
 
 
 
-    bool isAnnotLockedOnCurrentFrame(int classId, int objId) const;
+    bool isAnnotLockedOnCurrentFrame(int classId, int objId) const;     // a lookup into the lock table, built again when needed
+    void buildLockTable() const;
+    void invalidateLockTable() { this->lockTableFrame = -1; }
 
 
 
 
 
-    // this set of vectors stores the original images as well as their corresponding annotations.
-    // those are buffers, since we are likely to annotate a video and it is convenient to recall the previous frames easily
-    std::vector<cv::Mat> originalImagesBuffer;  	// original image, in CV8U_C1 or CV8UC3 (BGR) format
-    std::vector<cv::Mat> annotationsClassesBuffer;	// corresponding class for every pixel, in CV_16SC1 format
-    std::vector<cv::Mat> annotationsIdsBuffer;		// corresponding object Id for every pixel, in CV_32SC1 format
-    std::vector<cv::Mat> annotationsContoursBuffer; // stores the contours of objects, in CV_8UC1 format - 0 = no contour, anything above = contour
+    // the frames cache stores the original images as well as their corresponding annotations, indexed by frame number
+    // we are likely to annotate a video and it is convenient to recall the previous frames easily
+    std::unordered_map<int, AnnotationsFrame> framesCache;
+    std::list<int> framesUseOrder;                  // cached frame numbers, the most recently used one first
+    std::vector<AnnotationsFrame> recycledFrames;   // evicted frames, whose allocations are waiting to be reused
+    mutable int lastFoundFrameId;                   // the pixel loops access the same frame again and again : remember the last lookup
+    mutable const AnnotationsFrame* lastFoundFrame;
+    bool packedLabelsEnabled;
 
-    // in order to know where we are within the buffer
+    // lock table of the current frame, so that the annotation paths don't look for the locks into the config and the record
+    mutable std::vector<uint8_t> lockedClasses;             // indexed by class id
+    mutable std::unordered_set<int64_t> lockedObjects;      // (class id << 32) | object id, for the locked annotations of the frame
+    mutable int lockTableFrame;                             // frame the table was built for, -1 when it has to be built again
+
+    // cache settings
+    int framesCacheBudgetMB;
+    int seekPreloadedFrames;
+
+    // in order to know where we are within the video
     int currentImgIndex;
     int maxImgReached;
+    int nextVideoFrame;         // the frame that vidCap will decode next
     bool reachedTheEndOfVideo;
 
     // records whether some changes were done on the current annotation
     bool changesPerformedUponCurrentAnnot;
 
-    // those buffers will be assigned dynamically, in case we need to change their length
-    int bufferLength;
-
     // store the configuration locally. It is not supposed to be modified once the annotation is launched
     AnnotationsConfig config;
 
@@ -615,6 +1356,33 @@ private:
 
     // video accessor object
     cv::VideoCapture vidCap;
+    VideoKeyframesIndex keyframesIndex;
+
+    // decode-ahead thread
+    std::thread decodeAheadThread;
+    std::mutex decodeAheadMutex;                    // protects everything below - vidCap belongs to the thread as long as it runs
+    std::condition_variable decodeAheadCondition;
+    std::deque<DecodedAheadFrame> decodedAheadFrames;
+    int decodeAheadLength;                          // setting
+    int decodeAheadCapacity;                        // the setting, as it was when the thread was started
+    int decodeAheadNextFrame;
+    bool decodeAheadPackedLabels;
+    bool decodeAheadStopRequested;
+    bool decodeAheadRunning;
+
+    // save-behind thread - the writes are not part of the annotations state, hence mutable : the saving methods stay const
+    mutable std::thread saveBehindThread;
+    mutable std::mutex saveBehindMutex;             // protects everything below
+    mutable std::condition_variable saveBehindCondition;
+    mutable std::deque<SaveBehindJob> saveBehindJobs;
+    mutable std::string saveBehindWrittenFile;      // the file being written, empty when the thread is idle
+    mutable int saveBehindFailures;
+    mutable bool saveBehindStopRequested;
+
+    // record journal
+    std::string journalSummaryFileName;             // the summary file the journal follows up - empty until the record is entirely saved or loaded
+    std::string journalId;                          // written into that summary file, and on top of its journal
+    bool journalStarted;                            // the journal file already has its header
 
 
     // store the image/video/annotation loaded
@@ -0,0 +1,174 @@
+#include "AnnotationsSet.h"
+
+#include <iostream>
+
+using namespace cv;
+
+
+// contours kernel benchmark : a 4K frame is filled with random objects, then its contours are computed by the former
+// per-pixel kernel and by the current one, through the classes and ids planes as well as through the packed labels.
+// Built only when ANNOTATE_BUILD_CONTOURS_BENCHMARK is set - the return value is not null when the contours differ
+
+const int _ContoursBenchmark_frameWidth = 3840;
+const int _ContoursBenchmark_frameHeight = 2160;
+const int _ContoursBenchmark_objectsNumber = 2000;
+const int _ContoursBenchmark_runsNumber = 10;
+
+
+
+// the kernel as it was before the row kernel : one pixel at a time, through at<>, looking for the first different neighbour
+static void computeContoursPerPixel(const Mat& currClasses, const Mat& currObjIds, Mat& currContours)
+{
+    int lastRow = currClasses.rows -1;
+    int lastCol = currClasses.cols -1;
+
+    for (int i=0; i<currClasses.rows; i++)
+    {
+        for (int j=0; j<currClasses.cols; j++)
+        {
+            // default : not part of a contour
+            currContours.at<uchar>(i,j) = 0;
+
+            if (currClasses.at<int16_t>(i,j) == 0)
+                continue;
+
+            // we are at the boundaries of the image, it's a contour
+            if (i==0 || i==lastRow || j==0 || j==lastCol)
+            {
+                currContours.at<uchar>(i,j) = 1;
+                continue;
+            }
+
+            int currClass = currClasses.at<int16_t>(i,j);
+            int currObjId = currObjIds.at<int32_t>(i,j);
+
+            bool alreadySolved = false;
+            for (int u=i-1; u<=i+1 && !alreadySolved; u++)
+            {
+                for (int v=j-1; v<=j+1; v++)
+                {
+                    if (u==i && v==j)
+                        continue;
+
+                    // one object different is enough
+                    if (currClasses.at<int16_t>(u,v)!=currClass || currObjIds.at<int32_t>(u,v)!=currObjId)
+                    {
+                        currContours.at<uchar>(i,j) = 1;
+                        alreadySolved = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+// overlapping ellipses and rectangles, of random classes and object ids - the ones drawn last hide the others
+static void fillRandomObjects(Mat& classesMat, Mat& objIdsMat)
+{
+    classesMat = Mat::zeros(_ContoursBenchmark_frameHeight, _ContoursBenchmark_frameWidth, CV_16SC1);
+    objIdsMat = Mat::zeros(_ContoursBenchmark_frameHeight, _ContoursBenchmark_frameWidth, CV_32SC1);
+
+    RNG rng(0x4b);
+    for (int k=0; k<_ContoursBenchmark_objectsNumber; k++)
+    {
+        int classId = rng.uniform(1, 32);
+        int objectId = rng.uniform(1, 5000);
+
+        Point2i center(rng.uniform(0, _ContoursBenchmark_frameWidth), rng.uniform(0, _ContoursBenchmark_frameHeight));
+        Size2i axes(rng.uniform(4, 200), rng.uniform(4, 200));
+
+        if (rng.uniform(0, 2) == 0)
+        {
+            double angle = rng.uniform(0., 180.);
+            ellipse(classesMat, center, axes, angle, 0., 360., Scalar(classId), FILLED);
+            ellipse(objIdsMat, center, axes, angle, 0., 360., Scalar(objectId), FILLED);
+        }
+        else
+        {
+            Rect2i box(center - Point2i(axes.width, axes.height), center + Point2i(axes.width, axes.height));
+            rectangle(classesMat, box, Scalar(classId), FILLED);
+            rectangle(objIdsMat, box, Scalar(objectId), FILLED);
+        }
+    }
+}
+
+
+
+// average duration of a run, in ms
+static double timeRuns(const std::function<void()>& run)
+{
+    run();  // warming up the caches and the threads pool
+
+    auto start = std::chrono::steady_clock::now();
+    for (int k=0; k<_ContoursBenchmark_runsNumber; k++)
+        run();
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / _ContoursBenchmark_runsNumber;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    Mat classesMat, objIdsMat;
+    fillRandomObjects(classesMat, objIdsMat);
+
+    // the reference
+    Mat referenceContours(classesMat.size(), CV_8UC1);
+    double perPixelTime = timeRuns([&]() { computeContoursPerPixel(classesMat, objIdsMat, referenceContours); });
+
+    // the current kernel, the frame being stored both ways
+    AnnotationsFrame unpackedFrame;
+    unpackedFrame.originalImage = Mat::zeros(classesMat.size(), CV_8UC1);
+    unpackedFrame.storeAnnotationsPlanes(classesMat, objIdsMat, false);
+
+    AnnotationsFrame packedFrame;
+    packedFrame.originalImage = Mat::zeros(classesMat.size(), CV_8UC1);
+    if (!packedFrame.storeAnnotationsPlanes(classesMat, objIdsMat, true))
+    {
+        std::cout << "the random objects don't fit into the packed labels" << std::endl;
+        return 1;
+    }
+
+    int threadsNumber = getNumThreads();
+    setNumThreads(1);
+    double unpackedTime = timeRuns([&]() { AnnotationsSet::computeFrameContours(unpackedFrame); });
+    double packedTime = timeRuns([&]() { AnnotationsSet::computeFrameContours(packedFrame); });
+
+    setNumThreads(threadsNumber);
+    double unpackedParallelTime = timeRuns([&]() { AnnotationsSet::computeFrameContours(unpackedFrame); });
+    double packedParallelTime = timeRuns([&]() { AnnotationsSet::computeFrameContours(packedFrame); });
+
+    std::cout << _ContoursBenchmark_frameWidth << "x" << _ContoursBenchmark_frameHeight << ", " << _ContoursBenchmark_objectsNumber << " objects, "
+              << countNonZero(referenceContours) << " contour pixels" << std::endl;
+    std::cout << "per-pixel kernel                   : " << perPixelTime << " ms" << std::endl;
+    std::cout << "row kernel, classes and ids, 1 core : " << unpackedTime << " ms (x" << perPixelTime/unpackedTime << ")" << std::endl;
+    std::cout << "row kernel, packed labels, 1 core   : " << packedTime << " ms (x" << perPixelTime/packedTime << ")" << std::endl;
+    std::cout << "row kernel, classes and ids, " << threadsNumber << " threads : " << unpackedParallelTime << " ms (x" << perPixelTime/unpackedParallelTime << ")" << std::endl;
+    std::cout << "row kernel, packed labels, " << threadsNumber << " threads   : " << packedParallelTime << " ms (x" << perPixelTime/packedParallelTime << ")" << std::endl;
+
+    // the contours have to be the very same ones, whichever the way they're computed
+    Mat contoursDifferences;
+    bool identical = true;
+    for (const AnnotationsFrame* frame: {&unpackedFrame, &packedFrame})
+    {
+        compare(frame->contours, referenceContours, contoursDifferences, CMP_NE);
+        if (countNonZero(contoursDifferences) != 0)
+        {
+            std::cout << countNonZero(contoursDifferences) << " pixels differ from the per-pixel kernel, "
+                      << (frame->isPacked() ? "packed labels" : "classes and ids") << std::endl;
+            identical = false;
+        }
+    }
+
+    if (identical)
+        std::cout << "the contours are identical" << std::endl;
+
+    return (identical ? 0 : 1);
+}
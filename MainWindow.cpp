@@ -523,6 +523,13 @@ void MainWindow::configureOFTracking()
 }
 
 
+void MainWindow::configureFramesCache()
+{
+    ParamsQEditorWindow *configWindow = new ParamsQEditorWindow(this->annotations);
+    configWindow->show();
+}
+
+
 void MainWindow::setPenWidth()
 {
     bool ok;
@@ -812,6 +819,10 @@ void MainWindow::createActions()
     connect(this->interpolateLastBBsAct, SIGNAL(triggered()), this->annotateArea, SLOT(interpolateBBObjects()));
 
 
+    this->configureFramesCacheAct = new QAction(tr("Video Frames Cache Settings"), this);
+    connect(this->configureFramesCacheAct, SIGNAL(triggered()), this, SLOT(configureFramesCache()));
+
+
 
     this->nextFrameAct->setShortcut(Qt::Key_Right);
     this->prevFrameAct->setShortcut(Qt::Key_Left);
@@ -922,6 +933,7 @@ void MainWindow::createMenus()
     this->settingsMenu->addAction(this->loadClassesConfigAct);
     this->settingsMenu->addAction(this->configureSuperPixelsAct);
     this->settingsMenu->addAction(this->configureOFTrackingAct);
+    this->settingsMenu->addAction(this->configureFramesCacheAct);
 
 
 
@@ -109,6 +109,7 @@ private slots:
     void loadConfiguration();
     void configureSuperPixels();
     void configureOFTracking();
+    void configureFramesCache();
 
     void setPenWidth();
     void increasePenWidth();
@@ -204,6 +205,9 @@ private:
     // optical flow tracking related stuff
     QAction *configureOFTrackingAct, *OFTrackToNextFrameAct, *OFTrackMultipleFramesAct, *interpolateLastBBsAct;
 
+    // video frames cache related stuff
+    QAction *configureFramesCacheAct;
+
 
 
     QAction *printAct;
@@ -78,11 +78,14 @@ void OptFlowTracking::trackAnnotations()
     // at first, find the bounding box - we're not going to work on the whole image if it is not required
 
     // copy the original annotations references
-    const vector<int> origAnnotsIds = this->originAnnots->getRecord().getFrameContentIds(this->originAnnots->getCurrentFramePosition()-1);
+    const vector<int> origAnnotsIds = this->originAnnots->getRecord().getFrameContentIds(this->originAnnots->getCurrentFramePosition()-1).toVector();
 
     if (origAnnotsIds.size()<1)
         return; // nothing to track at all
 
+    if (!this->originAnnots->isFrameCached(this->originAnnots->getCurrentFramePosition()-1))
+        return; // the previous frame has been dropped from the frames cache
+
     Rect2i workingArea = this->originAnnots->getRecord().getAnnotationById(origAnnotsIds[0]).BoundingBox;
 
     for (size_t k=1; k<origAnnotsIds.size(); k++)
@@ -206,14 +209,20 @@ void OptFlowTracking::trackAnnotations()
                 newAnnotationMask.copyTo(origAnnotMask);
 
                 // now looking at the points in the previous annotation
-                const Mat& prevClassMat = this->originAnnots->getAnnotationsClasses(prevAnnot.FrameNumber);
-                const Mat& prevObjIdMat = this->originAnnots->getAnnotationsIds(prevAnnot.FrameNumber);
+                // a single plane to read when the packed labels are available - the classes and ids planes are only read without them
+                const Mat& prevLabelsMat = this->originAnnots->getAnnotationsLabels(prevAnnot.FrameNumber);
+                bool usePackedLabels = this->originAnnots->hasPackedLabels() && prevLabelsMat.data;
+                int32_t prevLabel = AnnotationsSet::packLabel(prevAnnot.ClassId, prevAnnot.ObjectId);
+
+                const Mat* prevClassMat = usePackedLabels ? NULL : &this->originAnnots->getAnnotationsClasses(prevAnnot.FrameNumber);
+                const Mat* prevObjIdMat = usePackedLabels ? NULL : &this->originAnnots->getAnnotationsIds(prevAnnot.FrameNumber);
 
                 for (int i=prevAnnot.BoundingBox.tl().y; i<prevAnnot.BoundingBox.br().y; i++)
                 {
                     for (int j=prevAnnot.BoundingBox.tl().x; j<prevAnnot.BoundingBox.br().x; j++)
                     {
-                        if ((prevClassMat.at<int16_t>(i,j)==prevAnnot.ClassId) && (prevObjIdMat.at<int32_t>(i,j)==prevAnnot.ObjectId))
+                        if ( usePackedLabels ? (prevLabelsMat.at<int32_t>(i,j)==prevLabel)
+                                             : ((prevClassMat->at<int16_t>(i,j)==prevAnnot.ClassId) && (prevObjIdMat->at<int32_t>(i,j)==prevAnnot.ObjectId)) )
                         {
                             // found an element of this annotation, store its position in both the newAnnotationMask matrix and the
                             origAnnotMask.at<uchar>(i-newBB.tl().y, j-newBB.tl().x) = 255;
@@ -9,6 +9,8 @@
 #include <QDebug>
 #include <QDateTime>
 #include <QDir>
+#include <QFile>
+#include <cstdio>
 
 
 
@@ -115,6 +117,12 @@ namespace QtCvUtils
    }
 
 
+   inline cv::Rect2i qRectToCvRect2i(const QRect& r)
+   {
+        return cv::Rect2i(r.x(), r.y(), r.width(), r.height());
+   }
+
+
    inline bool imwrite(const std::string& fileName, const cv::Mat& img)
    {
        // this function generates the standard image file
@@ -147,6 +155,47 @@ namespace QtCvUtils
        }
    }
 
+   inline bool getFileStamp(const std::string& fileName, int64_t& size, int64_t& lastModified)
+   {
+       // the size and the modification time (ms since epoch) of a file : they tell whether it was replaced since
+       QFileInfo fileInfo(QString::fromStdString(fileName));
+       if (!fileInfo.exists() || !fileInfo.isFile())
+           return false;
+       size = (int64_t)fileInfo.size();
+       lastModified = (int64_t)fileInfo.lastModified().toMSecsSinceEpoch();
+       return true;
+   }
+
+   inline bool isSameFile(const std::string& fileName1, const std::string& fileName2)
+   {
+       if (fileName1.empty() || fileName2.empty())
+           return false;
+
+       return (QFileInfo(QString::fromStdString(fileName1)).absoluteFilePath() == QFileInfo(QString::fromStdString(fileName2)).absoluteFilePath());
+   }
+
+   inline std::string getTemporaryFileName(const std::string& fileName)
+   {
+       // the extension is kept, since it tells OpenCV which format to write
+       std::string::size_type dotPos = fileName.find_last_of('.');
+       std::string::size_type slashPos = fileName.find_last_of('/');
+       if (dotPos == std::string::npos || (slashPos != std::string::npos && dotPos<slashPos))
+           return fileName + "~tmp";
+
+       return fileName.substr(0, dotPos) + "~tmp" + fileName.substr(dotPos);
+   }
+
+   inline bool replaceFile(const std::string& srcFileName, const std::string& dstFileName)
+   {
+       // the destination is replaced at once, it never holds a partially written content
+       if (std::rename(srcFileName.c_str(), dstFileName.c_str()) == 0)
+           return true;
+
+       // some platforms don't rename over an existing file
+       std::remove(dstFileName.c_str());
+       return (std::rename(srcFileName.c_str(), dstFileName.c_str()) == 0);
+   }
+
    inline std::string getDateTimeStr()
    {
        return QDateTime::currentDateTime().toString(Qt::ISODate).toStdString();